@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace heos2mqtt {
+
+// Parses a decimal count between min and max inclusive. Signs, trailing
+// junk and out of range values give nullopt.
+inline std::optional<unsigned long> parse_count(std::string_view text, unsigned long min, unsigned long max) {
+    unsigned long value = 0;
+    const auto* last = text.data() + text.size();
+    auto [end, ec] = std::from_chars(text.data(), last, value);
+    if (text.empty() || ec != std::errc{} || end != last || value < min || value > max) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+// Upper bound for --threads: more than a few threads per core only adds
+// contention on the io_context.
+inline unsigned long max_thread_count() {
+    return std::max(std::thread::hardware_concurrency(), 1U) * 4UL;
+}
+
+}  // namespace heos2mqtt
@@ -0,0 +1,255 @@
+#include "device_description.hpp"
+
+#include "logging/logging.hpp"
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <array>
+#include <memory>
+#include <utility>
+
+namespace heos2mqtt {
+
+using namespace logging;
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+
+namespace {
+
+// Descriptions are a few kilobytes; anything much larger is not one.
+constexpr std::uint64_t max_description_size = 256 * 1024;
+
+std::string decode_entities(std::string_view text) {
+    constexpr std::array<std::pair<std::string_view, char>, 5> entities{{
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''},
+    }};
+    std::string decoded;
+    decoded.reserve(text.size());
+    for (std::size_t pos = 0; pos < text.size();) {
+        bool replaced = false;
+        if (text[pos] == '&') {
+            for (const auto& [entity, c] : entities) {
+                if (text.substr(pos, entity.size()) == entity) {
+                    decoded.push_back(c);
+                    pos += entity.size();
+                    replaced = true;
+                    break;
+                }
+            }
+        }
+        if (!replaced) {
+            decoded.push_back(text[pos++]);
+        }
+    }
+    return decoded;
+}
+
+// The text of the first <name> element at or after pos, or nullopt.
+std::optional<std::string> element_text(std::string_view xml, std::string_view name, std::size_t pos) {
+    auto open = std::string("<").append(name).append(">");
+    auto close = std::string("</").append(name).append(">");
+    auto begin = xml.find(open, pos);
+    if (begin == std::string_view::npos) {
+        return std::nullopt;
+    }
+    begin += open.size();
+    auto end = xml.find(close, begin);
+    if (end == std::string_view::npos) {
+        return std::nullopt;
+    }
+    return decode_entities(xml.substr(begin, end - begin));
+}
+
+}  // namespace
+
+std::optional<detail::http_url> detail::parse_http_url(std::string_view url) {
+    constexpr std::string_view scheme = "http://";
+    if (url.substr(0, scheme.size()) != scheme) {
+        return std::nullopt;
+    }
+    url.remove_prefix(scheme.size());
+    auto slash = url.find('/');
+    auto authority = url.substr(0, slash);
+    http_url result;
+    result.target_ = slash == std::string_view::npos ? "/" : std::string(url.substr(slash));
+
+    // [v6]:port, host:port or host.
+    auto colon = authority.rfind(':');
+    if (!authority.empty() && authority.front() == '[') {
+        auto bracket = authority.find(']');
+        if (bracket == std::string_view::npos) {
+            return std::nullopt;
+        }
+        result.host_ = std::string(authority.substr(1, bracket - 1));
+        colon = authority.find(':', bracket);
+    } else {
+        result.host_ = std::string(authority.substr(0, colon));
+    }
+    result.port_ = colon == std::string_view::npos ? "80" : std::string(authority.substr(colon + 1));
+    if (result.host_.empty() || result.port_.empty()) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+std::optional<device_description> detail::parse_device_description(std::string_view xml) {
+    // Embedded devices follow the root device's own fields.
+    auto device = xml.find("<device>");
+    if (device == std::string_view::npos) {
+        return std::nullopt;
+    }
+    auto friendly_name = element_text(xml, "friendlyName", device);
+    if (!friendly_name) {
+        return std::nullopt;
+    }
+    device_description description;
+    description.friendly_name_ = std::move(*friendly_name);
+    description.model_name_ = element_text(xml, "modelName", device).value_or("");
+    description.serial_number_ = element_text(xml, "serialNumber", device).value_or("");
+    return description;
+}
+
+struct description_cache::fetch {
+    fetch(const net::strand<net::io_context::executor_type>& strand, detail::http_url url)
+      : resolver_(strand)
+      , stream_(strand)
+      , url_(std::move(url))
+    {
+        request_.method(beast::http::verb::get);
+        request_.target(url_.target_);
+        request_.set(beast::http::field::host, url_.host_ + ":" + url_.port_);
+        request_.set(beast::http::field::connection, "close");
+        parser_.body_limit(max_description_size);
+    }
+
+    net::ip::tcp::resolver resolver_;
+    beast::tcp_stream stream_;
+    beast::flat_buffer buffer_;
+    beast::http::request<beast::http::empty_body> request_;
+    beast::http::response_parser<beast::http::string_body> parser_;
+    detail::http_url url_;
+};
+
+description_cache::description_cache(net::io_context& io,
+                                     std::chrono::steady_clock::duration fetch_timeout,
+                                     metrics::registry& registry)
+  : strand_(net::make_strand(io))
+  , fetch_timeout_(fetch_timeout)
+  , hits_(registry.add_counter("upnp_description_cache_hits_total", "Device descriptions served from the cache"))
+  , fetches_(registry.add_counter("upnp_description_fetches_total", "Device descriptions fetched"))
+  , errors_(registry.add_counter("upnp_description_errors_total", "Device description fetches that failed"))
+{}
+
+void description_cache::begin_describe(const ssdp_device& device, completion_handler_type handler) {
+    net::dispatch(strand_, [this, device, handler = std::move(handler)]() mutable {
+        // Devices without a USN are known only by where they are described.
+        const auto& key = device.usn_.empty() ? device.location_ : device.usn_;
+        if (auto it = entries_.find(key); it != entries_.end()) {
+            if (std::chrono::steady_clock::now() < it->second.expires_) {
+                hits_.inc();
+                net::post(strand_,
+                    net::append(std::move(handler), boost::system::error_code{}, it->second.description_));
+                return;
+            }
+            entries_.erase(it);
+        }
+
+        auto [pending, first] = pending_.try_emplace(key);
+        pending->second.push_back(std::move(handler));
+        if (first) {
+            start_fetch(device);
+        }
+    });
+}
+
+void description_cache::start_fetch(const ssdp_device& device) {
+    auto key = device.usn_.empty() ? device.location_ : device.usn_;
+    auto url = detail::parse_http_url(device.location_);
+    if (!url) {
+        warning("UPnP: cannot fetch description from '{}'", device.location_);
+        finish_fetch(key, make_error_code(boost::system::errc::invalid_argument), {}, {});
+        return;
+    }
+
+    debug("UPnP: fetching description of {} from {}", key, device.location_);
+    fetches_.inc();
+    auto state = std::make_shared<fetch>(strand_, std::move(*url));
+    auto max_age = device.max_age_;
+    auto fail = [this, key](const char* stage, const boost::system::error_code& ec) {
+        warning("UPnP: description {} failed for {}: {}", stage, key, ec.message());
+        finish_fetch(key, ec, {}, {});
+    };
+
+    state->stream_.expires_after(fetch_timeout_);
+    state->resolver_.async_resolve(state->url_.host_, state->url_.port_,
+        [this, state, key, max_age, fail](const boost::system::error_code& ec,
+                                          const net::ip::tcp::resolver::results_type& endpoints) {
+            if (ec) {
+                fail("lookup", ec);
+                return;
+            }
+            state->stream_.async_connect(endpoints,
+                [this, state, key, max_age, fail](const boost::system::error_code& connect_ec,
+                                                  const net::ip::tcp::endpoint&) {
+                    if (connect_ec) {
+                        fail("connect", connect_ec);
+                        return;
+                    }
+                    beast::http::async_write(state->stream_, state->request_,
+                        [this, state, key, max_age, fail](const boost::system::error_code& write_ec, std::size_t) {
+                            if (write_ec) {
+                                fail("request", write_ec);
+                                return;
+                            }
+                            beast::http::async_read(state->stream_, state->buffer_, state->parser_,
+                                [this, state, key, max_age, fail](const boost::system::error_code& read_ec, std::size_t) {
+                                    if (read_ec) {
+                                        fail("read", read_ec);
+                                        return;
+                                    }
+                                    beast::error_code ignored;
+                                    state->stream_.socket().shutdown(net::ip::tcp::socket::shutdown_both, ignored);
+                                    const auto& response = state->parser_.get();
+                                    if (response.result() != beast::http::status::ok) {
+                                        fail("request", make_error_code(boost::system::errc::protocol_error));
+                                        return;
+                                    }
+                                    auto description = detail::parse_device_description(response.body());
+                                    if (!description) {
+                                        fail("parse", make_error_code(boost::system::errc::bad_message));
+                                        return;
+                                    }
+                                    finish_fetch(key, {}, *description, max_age);
+                                });
+                        });
+                });
+        });
+}
+
+void description_cache::finish_fetch(const std::string& usn,
+                                     const boost::system::error_code& ec,
+                                     const device_description& description,
+                                     std::chrono::seconds max_age) {
+    if (ec) {
+        errors_.inc();
+    } else {
+        info("UPnP: {} is '{}' ({}, serial {})", usn, description.friendly_name_, description.model_name_,
+            description.serial_number_);
+        entries_.insert_or_assign(usn, entry{description, std::chrono::steady_clock::now() + max_age});
+    }
+
+    auto pending = pending_.find(usn);
+    if (pending == pending_.end()) {
+        return;
+    }
+    auto handlers = std::move(pending->second);
+    pending_.erase(pending);
+    for (auto& handler : handlers) {
+        // Each handler runs on its own executor, not the cache's strand.
+        net::post(strand_, net::append(std::move(handler), ec, description));
+    }
+}
+
+}  // namespace heos2mqtt
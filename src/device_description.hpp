@@ -0,0 +1,90 @@
+#pragma once
+
+#include "metrics/metrics.hpp"
+#include "ssdp_resolver.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/asio/any_completion_handler.hpp>
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace heos2mqtt {
+
+// The parts of a UPnP device description that identify a device.
+struct device_description {
+    std::string friendly_name_;
+    std::string model_name_;
+    std::string serial_number_;
+};
+
+namespace detail {
+
+struct http_url {
+    std::string host_;
+    std::string port_;
+    std::string target_;
+};
+
+// Splits an http:// URL such as a LOCATION header. Returns nullopt for
+// other schemes.
+std::optional<http_url> parse_http_url(std::string_view url);
+
+// Reads the root device's friendlyName, modelName and serialNumber from a
+// UPnP description document. Returns nullopt if it has no friendlyName.
+std::optional<device_description> parse_device_description(std::string_view xml);
+
+}  // namespace detail
+
+// Fetches UPnP device descriptions from SSDP LOCATION URLs and caches them
+// by USN for the max-age of the response that announced them, so a device
+// is described once per lifetime rather than on every reconnect. Requests
+// for a USN already being fetched wait for that fetch.
+class description_cache {
+public:
+    using completion_handler_type =
+        boost::asio::any_completion_handler<void(boost::system::error_code, device_description)>;
+
+    explicit description_cache(boost::asio::io_context& io,
+                               std::chrono::steady_clock::duration fetch_timeout = std::chrono::seconds(3),
+                               metrics::registry& registry = metrics::registry::get_default());
+
+    template <boost::asio::completion_token_for<void(boost::system::error_code, device_description)> CompletionToken>
+    auto async_describe(const ssdp_device& device, CompletionToken&& token) // NOLINT(cppcoreguidelines-missing-std-forward)
+    {
+        auto initiation = [this, device](auto&& handler) {
+            this->begin_describe(device, completion_handler_type(std::forward<decltype(handler)>(handler)));
+        };
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, device_description)>(
+            initiation, token);
+    }
+
+private:
+    struct entry {
+        device_description description_;
+        std::chrono::steady_clock::time_point expires_;
+    };
+
+    struct fetch;
+
+    void begin_describe(const ssdp_device& device, completion_handler_type handler);
+    void start_fetch(const ssdp_device& device);
+    void finish_fetch(const std::string& usn,
+                      const boost::system::error_code& ec,
+                      const device_description& description,
+                      std::chrono::seconds max_age);
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    std::chrono::steady_clock::duration fetch_timeout_;
+    std::map<std::string, entry, std::less<>> entries_;
+    std::map<std::string, std::vector<completion_handler_type>, std::less<>> pending_;
+    metrics::counter& hits_;
+    metrics::counter& fetches_;
+    metrics::counter& errors_;
+};
+
+}  // namespace heos2mqtt
@@ -11,7 +11,6 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
-#include <fmt/ostream.h>
 #include <string_view>
 
 namespace heos2mqtt {
@@ -19,6 +18,57 @@ namespace heos2mqtt {
 using namespace std::chrono_literals;
 using namespace logging;
 
+namespace {
+
+constexpr std::size_t max_backoff_exponent{5};
+
+std::string device_labels(std::string_view device) {
+    return fmt::format("device=\"{}\"", metrics::escape(device));
+}
+
+}  // namespace
+
+std::pair<std::string, bool> detail::take_line(boost::asio::streambuf& buffer, std::size_t length) {
+    auto data = buffer.data();
+    std::string line(boost::asio::buffers_begin(data), boost::asio::buffers_begin(data) + static_cast<std::ptrdiff_t>(length));
+    buffer.consume(length);
+    const bool complete = !line.empty() && line.back() == '\n';
+    if (complete) {
+        line.pop_back();
+        // Trim carriage return if present.
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+    }
+    return {std::move(line), complete};
+}
+
+detail::client_metrics::client_metrics(std::string_view device, metrics::registry& registry)
+  : lines_read_(registry.add_counter("heos_lines_read_total", "Lines read from the HEOS CLI",
+        device_labels(device)))
+  , fragments_read_(registry.add_counter("heos_line_fragments_total", "Pieces of lines longer than the maximum line size",
+        device_labels(device)))
+  , bytes_read_(registry.add_counter("heos_bytes_read_total", "Bytes read from the HEOS CLI",
+        device_labels(device)))
+  , connects_(registry.add_counter("heos_connects_total", "Successful HEOS CLI connections",
+        device_labels(device)))
+  , connect_errors_(registry.add_counter("heos_connect_errors_total", "Failed SSDP resolves and connects",
+        device_labels(device)))
+  , read_errors_(registry.add_counter("heos_read_errors_total", "Connections lost while reading",
+        device_labels(device)))
+  , connected_(registry.add_gauge("heos_connected", "1 while connected to the HEOS CLI",
+        device_labels(device)))
+{}
+
+std::chrono::steady_clock::duration detail::reconnect_delay(
+    std::size_t attempt,
+    std::chrono::steady_clock::duration base,
+    std::chrono::steady_clock::duration max) {
+    auto exponent = std::min<std::size_t>(attempt, max_backoff_exponent);
+    auto multiplier = static_cast<std::chrono::steady_clock::rep>(std::size_t{1} << exponent);
+    return std::min(base * multiplier, max);
+}
+
 heos_client::heos_client(
     std::string_view log_name,
     boost::asio::io_context& io,
@@ -29,11 +79,12 @@ heos_client::heos_client(
   : log_name_{log_name}
   , strand_(boost::asio::make_strand(io))
   , ssdp_resolver_(io, std::move(ssdp_endpoint))
-  , socket_(io)
-  , reconnect_timer_(io)
+  , socket_(strand_)
+  , reconnect_timer_(strand_)
   , device_label_(std::move(device_label))
   , port_(port)
   , handler_(std::move(handler))
+  , metrics_(log_name_)
 {
     info("[{}] created for device '{}' (port {})", log_name_, device_label_, port_);
 }
@@ -71,33 +122,109 @@ void heos_client::set_reconnect_backoff(std::chrono::steady_clock::duration base
     });
 }
 
+void heos_client::set_max_line_size(std::size_t size) {
+    boost::asio::dispatch(strand_, [this, size]() {
+        max_line_size_ = std::max(size, detail::min_max_line_size);
+    });
+}
+
+void heos_client::set_ssdp_interfaces(std::vector<ssdp_interface> interfaces) {
+    ssdp_resolver_.set_interfaces(std::move(interfaces));
+}
+
+void heos_client::set_probe_fallback(std::vector<boost::asio::ip::address_v4> hosts) {
+    probe_sweep_.emplace(static_cast<boost::asio::io_context&>(strand_.context()), std::move(hosts), port_);
+}
+
 void heos_client::initiate_resolve() {
     if (stopping_) {
         return;
     }
 
     info("[{}]: SSDP resolving '{}'", log_name_, device_label_);
-    ssdp_resolver_.async_resolve(
-        "urn:schemas-denon-com:device:ACT-Denon:1",
+    ssdp_resolver_.async_resolve_device(
+        detail::heos_search_target, ssdp_resolver::default_timeout,
         boost::asio::bind_executor(
             strand_,
-            [this](const boost::system::error_code& ec,
-                   const boost::asio::ip::address& address) {
+            [this](const boost::system::error_code& ec, const ssdp_device& device) {
                 if (stopping_) {
                     return;
                 }
-                if (ec) {
-                    error("[{}]: SSDP resolve error: {}", log_name_, ec.message());
-                    schedule_reconnect();
+                if (ec && probe_sweep_) {
+                    warning("[{}]: SSDP resolve error: {}, probing {} hosts", log_name_, ec.message(),
+                        probe_sweep_->host_count());
+                    initiate_probe();
                     return;
                 }
+                if (!ec && description_cache_ && !device.location_.empty()) {
+                    initiate_describe(device);
+                }
+                handle_resolved(ec, device.address_, "SSDP");
+            }));
+}
 
-                host_ = address;
-                info("[{}]: SSDP resolved {} -> {}", log_name_, device_label_, fmt::streamed(address));
-                initiate_connect();
+void heos_client::initiate_describe(const ssdp_device& device) {
+    // Runs alongside the connect; the description only labels the device.
+    description_cache_->async_describe(
+        device,
+        boost::asio::bind_executor(
+            strand_,
+            [this](const boost::system::error_code& ec, device_description description) {
+                if (stopping_ || ec) {
+                    return;
+                }
+                auto& device_info = metrics::registry::get_default().add_gauge(
+                    "heos_device_info", "UPnP description of each HEOS device",
+                    fmt::format("device=\"{}\",friendly_name=\"{}\",model=\"{}\",serial=\"{}\"",
+                        metrics::escape(log_name_), metrics::escape(description.friendly_name_),
+                        metrics::escape(description.model_name_), metrics::escape(description.serial_number_)));
+                if (&device_info != device_info_) {
+                    info("[{}]: device is '{}' ({}, serial {})", log_name_, description.friendly_name_,
+                        description.model_name_, description.serial_number_);
+                    // The registry cannot drop a series, so the stale one
+                    // reads 0 and only the current one reads 1.
+                    if (device_info_ != nullptr) {
+                        device_info_->set(0);
+                    }
+                    device_info_ = &device_info;
+                }
+                device_info.set(1);
+                description_ = std::move(description);
+            }));
+}
+
+void heos_client::set_description_cache(std::shared_ptr<description_cache> cache) {
+    description_cache_ = std::move(cache);
+}
+
+void heos_client::initiate_probe() {
+    probe_sweep_->async_probe(
+        boost::asio::bind_executor(
+            strand_,
+            [this](const boost::system::error_code& ec,
+                   const boost::asio::ip::address& address) {
+                if (stopping_) {
+                    return;
+                }
+                handle_resolved(ec, address, "probe");
             }));
 }
 
+void heos_client::handle_resolved(const boost::system::error_code& ec,
+                                  const boost::asio::ip::address& address,
+                                  std::string_view source) {
+    if (ec) {
+        error("[{}]: {} resolve error: {}", log_name_, source, ec.message());
+        metrics_.connect_errors_.inc();
+        schedule_reconnect();
+        return;
+    }
+
+    host_ = address;
+    info("[{}]: {} resolved {} -> {}", log_name_, source, device_label_, detail::log_address(address));
+    initiate_connect();
+}
+
 void heos_client::initiate_connect() {
     if (stopping_) {
         return;
@@ -108,7 +235,7 @@ void heos_client::initiate_connect() {
         schedule_reconnect();
         return;
     }
-    info("[{}]: connecting to {}:{}", log_name_, fmt::streamed(*host_), port_);
+    info("[{}]: connecting to {}:{}", log_name_, detail::log_address(*host_), port_);
     boost::asio::ip::tcp::endpoint endpoint(*host_, port_);
     boost::asio::async_connect(
         socket_, std::array<boost::asio::ip::tcp::endpoint, 1>{endpoint},
@@ -121,11 +248,14 @@ void heos_client::initiate_connect() {
                 }
                 if (connect_ec) {
                     error("[{}]: connect error: {}", log_name_, connect_ec.message());
+                    metrics_.connect_errors_.inc();
                     schedule_reconnect();
                     return;
                 }
 
                 info("[{}]: connected", log_name_);
+                metrics_.connects_.inc();
+                metrics_.connected_.set(1);
                 reconnect_attempts_ = 0;
                 start_read();
             }));
@@ -133,9 +263,10 @@ void heos_client::initiate_connect() {
 
 void heos_client::start_read() {
     boost::asio::async_read_until(
-        socket_, read_buffer_, '\n',
+        socket_, read_buffer_, detail::line_or_limit{max_line_size_},
         boost::asio::bind_executor(
-            strand_, [this](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+            strand_, [this](const boost::system::error_code& ec, std::size_t bytes_transferred) {
+                line_trace trace{.read_ = line_trace::clock::now()};
                 if (stopping_) {
                     return;
                 }
@@ -143,22 +274,30 @@ void heos_client::start_read() {
                 if (ec) {
                     if (ec != boost::asio::error::operation_aborted) {
                         error("[{}]: read error: {}", log_name_, ec.message());
+                        metrics_.read_errors_.inc();
                     }
                     close_socket();
                     schedule_reconnect();
                     return;
                 }
 
-                std::istream stream(&read_buffer_);
-                std::string line;
-                std::getline(stream, line);
-                // Trim carriage return if present.
-                if (!line.empty() && line.back() == '\r') {
-                    line.pop_back();
+                auto [line, complete] = detail::take_line(read_buffer_, bytes_transferred);
+                metrics_.bytes_read_.inc(bytes_transferred);
+                trace.fragment_ = fragment_index_;
+                trace.continued_ = !complete;
+                if (complete) {
+                    metrics_.lines_read_.inc();
+                    fragment_index_ = 0;
+                } else {
+                    if (fragment_index_ == 0) {
+                        warning("[{}]: line exceeds {} bytes, delivering it in pieces", log_name_, max_line_size_);
+                    }
+                    metrics_.fragments_read_.inc();
+                    ++fragment_index_;
                 }
-
                 if (handler_) {
-                    handler_(line);
+                    trace.dispatched_ = line_trace::clock::now();
+                    handler_(std::move(line), trace);
                 }
 
                 start_read();
@@ -170,12 +309,7 @@ void heos_client::schedule_reconnect() {
         return;
     }
     reconnect_attempts_ = std::min<std::size_t>(reconnect_attempts_ + 1, 32);
-    auto exponent = std::min<std::size_t>(reconnect_attempts_, max_backoff_exponent);
-    auto multiplier = std::size_t{1} << exponent;
-    auto delay = reconnect_base_ * multiplier;
-    if (delay > reconnect_max_) {
-        delay = reconnect_max_;
-    }
+    auto delay = detail::reconnect_delay(reconnect_attempts_, reconnect_base_, reconnect_max_);
 
     info("[{}]: retry in {}", log_name_, delay);
     reconnect_timer_.expires_after(delay);
@@ -188,9 +322,11 @@ void heos_client::schedule_reconnect() {
 }
 
 void heos_client::close_socket() {
+    metrics_.connected_.set(0);
     boost::system::error_code ignored;
     socket_.close(ignored);
     read_buffer_.consume(read_buffer_.size());
+    fragment_index_ = 0;
 }
 
 }  // namespace heos2mqtt
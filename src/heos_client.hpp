@@ -1,22 +1,106 @@
 #pragma once
 
+#include "device_description.hpp"
+#include "line_trace.hpp"
+#include "metrics/metrics.hpp"
+#include "probe_sweep.hpp"
 #include "ssdp_resolver.hpp"
 
 #include <boost/asio.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace heos2mqtt {
 
+namespace detail {
+
+inline constexpr std::string_view heos_search_target = "urn:schemas-denon-com:device:ACT-Denon:1";
+
+inline constexpr std::size_t default_max_line_size = 1024 * 1024;
+// Smaller limits are raised to this; a piece must hold at least one UTF-8
+// character, and anything much shorter splits ordinary HEOS replies.
+inline constexpr std::size_t min_max_line_size = 64;
+
+// read_until match condition that completes at the first newline, or once
+// max_size bytes have arrived without one, so an over-long line is read in
+// bounded pieces. Pieces are cut on a UTF-8 character boundary.
+struct line_or_limit {
+    std::size_t max_size_;
+    // Bytes of the line searched so far. read_until resumes the search
+    // where the previous call stopped, so begin is that far past the start
+    // of the line and each byte is only searched once.
+    mutable std::size_t searched_{0};
+
+    template <typename Iterator>
+    std::pair<Iterator, bool> operator()(Iterator begin, Iterator end) const {
+        auto start = begin - static_cast<std::ptrdiff_t>(searched_);
+        const auto available = static_cast<std::size_t>(end - start);
+        // A newline just past max_size bytes still ends the line.
+        auto limit = available > max_size_ ? start + static_cast<std::ptrdiff_t>(max_size_ + 1) : end;
+        auto newline = std::find(begin, limit, '\n');
+        if (newline != limit) {
+            searched_ = 0;
+            return {std::next(newline), true};
+        }
+        if (available <= max_size_) {
+            // Wait for the byte past max_size, which may be the newline.
+            searched_ = available;
+            return {end, false};
+        }
+        searched_ = 0;
+        auto cut = start + static_cast<std::ptrdiff_t>(max_size_);
+        for (int i = 0; i < 3 && cut != start && (static_cast<unsigned char>(*cut) & 0xc0U) == 0x80U; ++i) {
+            --cut;
+        }
+        if (cut == start) {
+            cut = start + static_cast<std::ptrdiff_t>(max_size_);
+        }
+        return {cut, true};
+    }
+};
+
+// Removes the first length bytes of buffer, as delimited by a line_or_limit
+// read. Returns the text without its line ending, and whether it completed
+// a line (false for a piece of an over-long line).
+std::pair<std::string, bool> take_line(boost::asio::streambuf& buffer, std::size_t length);
+
+// Exponential backoff for the given (1-based) attempt, capped at max.
+std::chrono::steady_clock::duration reconnect_delay(std::size_t attempt,
+                                                    std::chrono::steady_clock::duration base,
+                                                    std::chrono::steady_clock::duration max);
+
+// Per-device metrics shared by both client implementations, labelled with
+// the client's log name.
+struct client_metrics {
+    explicit client_metrics(std::string_view device,
+                            metrics::registry& registry = metrics::registry::get_default());
+
+    metrics::counter& lines_read_;
+    metrics::counter& fragments_read_;
+    metrics::counter& bytes_read_;
+    metrics::counter& connects_;
+    metrics::counter& connect_errors_;
+    metrics::counter& read_errors_;
+    metrics::gauge& connected_;
+};
+
+}  // namespace detail
+
 class heos_client {
 public:
     using tcp = boost::asio::ip::tcp;
 
-    using line_handler = std::function<void(std::string)>;
+    using line_handler = std::function<void(std::string, line_trace)>;
 
     heos_client(
         std::string_view log_name,
@@ -30,9 +114,27 @@ public:
     void stop();
     void set_reconnect_backoff(std::chrono::steady_clock::duration base,
                                std::chrono::steady_clock::duration max);
+    // Lines longer than this are delivered in pieces of at most this size,
+    // bounding the read buffer. At least detail::min_max_line_size.
+    void set_max_line_size(std::size_t size);
+    // Searches for the device from each of these interfaces in parallel.
+    // Must be called before start().
+    void set_ssdp_interfaces(std::vector<ssdp_interface> interfaces);
+    // When SSDP finds nothing, sweeps these hosts for a HEOS CLI on the
+    // client's port instead, e.g. where the network filters multicast.
+    // Must be called before start().
+    void set_probe_fallback(std::vector<boost::asio::ip::address_v4> hosts);
+    // Describes the device from its SSDP LOCATION through this cache,
+    // which may be shared between clients. Must be called before start().
+    void set_description_cache(std::shared_ptr<description_cache> cache);
 
 private:
     void initiate_resolve();
+    void initiate_probe();
+    void initiate_describe(const ssdp_device& device);
+    void handle_resolved(const boost::system::error_code& ec,
+                         const boost::asio::ip::address& address,
+                         std::string_view source);
     void initiate_connect();
     void start_read();
     void schedule_reconnect();
@@ -41,6 +143,12 @@ private:
     std::string log_name_;
     boost::asio::strand<boost::asio::io_context::executor_type> strand_;
     ssdp_resolver ssdp_resolver_;
+    std::optional<probe_sweep> probe_sweep_;
+    std::shared_ptr<description_cache> description_cache_;
+    std::optional<device_description> description_;
+    // The heos_device_info series of the current description; zeroed when a
+    // new description changes its labels.
+    metrics::gauge* device_info_{nullptr};
     tcp::socket socket_;
     boost::asio::streambuf read_buffer_;
     boost::asio::steady_timer reconnect_timer_;
@@ -48,13 +156,17 @@ private:
     std::optional<boost::asio::ip::address> host_;
     boost::asio::ip::port_type port_;
     line_handler handler_;
+    detail::client_metrics metrics_;
+    std::size_t max_line_size_{detail::default_max_line_size};
+    std::uint32_t fragment_index_{0};
     bool started_{false};
     bool stopping_{false};
     std::size_t reconnect_attempts_{0};
     std::chrono::steady_clock::duration reconnect_base_{std::chrono::seconds(1)};
     std::chrono::steady_clock::duration reconnect_max_{std::chrono::seconds(30)};
-
-    static constexpr std::size_t max_backoff_exponent{5};
 };
 
 }  // namespace heos2mqtt
+
+template <>
+struct boost::asio::is_match_condition<heos2mqtt::detail::line_or_limit> : std::true_type {};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace heos2mqtt {
+
+// The commands and events of the HEOS CLI protocol specification, as
+// (enumerator, name) pairs.
+#define HEOS2MQTT_HEOS_COMMANDS(X)                                              \
+    X(system_register_for_change_events, "system/register_for_change_events")   \
+    X(system_check_account, "system/check_account")                             \
+    X(system_sign_in, "system/sign_in")                                         \
+    X(system_sign_out, "system/sign_out")                                       \
+    X(system_heart_beat, "system/heart_beat")                                   \
+    X(system_reboot, "system/reboot")                                           \
+    X(system_prettify_json_response, "system/prettify_json_response")           \
+    X(player_get_players, "player/get_players")                                 \
+    X(player_get_player_info, "player/get_player_info")                         \
+    X(player_get_play_state, "player/get_play_state")                           \
+    X(player_set_play_state, "player/set_play_state")                           \
+    X(player_get_now_playing_media, "player/get_now_playing_media")             \
+    X(player_get_volume, "player/get_volume")                                   \
+    X(player_set_volume, "player/set_volume")                                   \
+    X(player_volume_up, "player/volume_up")                                     \
+    X(player_volume_down, "player/volume_down")                                 \
+    X(player_get_mute, "player/get_mute")                                       \
+    X(player_set_mute, "player/set_mute")                                       \
+    X(player_toggle_mute, "player/toggle_mute")                                 \
+    X(player_get_play_mode, "player/get_play_mode")                             \
+    X(player_set_play_mode, "player/set_play_mode")                             \
+    X(player_get_queue, "player/get_queue")                                     \
+    X(player_play_queue, "player/play_queue")                                   \
+    X(player_remove_from_queue, "player/remove_from_queue")                     \
+    X(player_save_queue, "player/save_queue")                                   \
+    X(player_clear_queue, "player/clear_queue")                                 \
+    X(player_move_queue_item, "player/move_queue_item")                         \
+    X(player_play_next, "player/play_next")                                     \
+    X(player_play_previous, "player/play_previous")                             \
+    X(player_set_quickselect, "player/set_quickselect")                         \
+    X(player_play_quickselect, "player/play_quickselect")                       \
+    X(player_get_quickselects, "player/get_quickselects")                       \
+    X(player_check_update, "player/check_update")                               \
+    X(group_get_groups, "group/get_groups")                                     \
+    X(group_get_group_info, "group/get_group_info")                             \
+    X(group_set_group, "group/set_group")                                       \
+    X(group_get_volume, "group/get_volume")                                     \
+    X(group_set_volume, "group/set_volume")                                     \
+    X(group_volume_up, "group/volume_up")                                       \
+    X(group_volume_down, "group/volume_down")                                   \
+    X(group_get_mute, "group/get_mute")                                         \
+    X(group_set_mute, "group/set_mute")                                         \
+    X(group_toggle_mute, "group/toggle_mute")                                   \
+    X(browse_get_music_sources, "browse/get_music_sources")                     \
+    X(browse_get_source_info, "browse/get_source_info")                         \
+    X(browse_browse, "browse/browse")                                           \
+    X(browse_get_search_criteria, "browse/get_search_criteria")                 \
+    X(browse_search, "browse/search")                                           \
+    X(browse_play_stream, "browse/play_stream")                                 \
+    X(browse_play_preset, "browse/play_preset")                                 \
+    X(browse_play_input, "browse/play_input")                                   \
+    X(browse_add_to_queue, "browse/add_to_queue")                               \
+    X(browse_rename_playlist, "browse/rename_playlist")                         \
+    X(browse_delete_playlist, "browse/delete_playlist")                         \
+    X(browse_retrieve_metadata, "browse/retrieve_metadata")                     \
+    X(browse_get_service_options, "browse/get_service_options")                 \
+    X(browse_set_service_option, "browse/set_service_option")                   \
+    X(browse_multi_search, "browse/multi_search")                               \
+    X(event_sources_changed, "event/sources_changed")                           \
+    X(event_players_changed, "event/players_changed")                           \
+    X(event_groups_changed, "event/groups_changed")                             \
+    X(event_player_state_changed, "event/player_state_changed")                 \
+    X(event_player_now_playing_changed, "event/player_now_playing_changed")     \
+    X(event_player_now_playing_progress, "event/player_now_playing_progress")   \
+    X(event_player_playback_error, "event/player_playback_error")               \
+    X(event_player_queue_changed, "event/player_queue_changed")                 \
+    X(event_player_volume_changed, "event/player_volume_changed")               \
+    X(event_repeat_mode_changed, "event/repeat_mode_changed")                   \
+    X(event_shuffle_mode_changed, "event/shuffle_mode_changed")                 \
+    X(event_group_volume_changed, "event/group_volume_changed")                 \
+    X(event_user_changed, "event/user_changed")
+
+#define HEOS2MQTT_COMMAND_ENUMERATOR(id, name) id,
+#define HEOS2MQTT_COMMAND_NAME(id, name) name,
+
+enum class heos_command : std::uint8_t {
+    unknown,
+    HEOS2MQTT_HEOS_COMMANDS(HEOS2MQTT_COMMAND_ENUMERATOR)
+    count_
+};
+
+inline constexpr std::size_t heos_command_count = static_cast<std::size_t>(heos_command::count_);
+
+inline constexpr std::array<std::string_view, heos_command_count> heos_command_names{
+    "",
+    HEOS2MQTT_HEOS_COMMANDS(HEOS2MQTT_COMMAND_NAME)
+};
+
+#undef HEOS2MQTT_COMMAND_NAME
+#undef HEOS2MQTT_COMMAND_ENUMERATOR
+
+namespace detail {
+
+// Little-endian load of up to 8 bytes of text from pos.
+constexpr std::uint64_t load_word(std::string_view text, std::size_t pos) {
+    std::uint64_t word = 0;
+    auto count = text.size() - pos < 8 ? text.size() - pos : 8;
+    if (!std::is_constant_evaluated() && count == 8 && std::endian::native == std::endian::little) {
+        std::memcpy(&word, text.data() + pos, sizeof(word));
+        return word;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        word |= std::uint64_t{static_cast<std::uint8_t>(text[pos + i])} << (8 * i);
+    }
+    return word;
+}
+
+// Seeded multiplicative hash consuming 8 bytes per step.
+constexpr std::uint32_t command_hash(std::string_view name, std::uint32_t seed) {
+    std::uint64_t hash = seed ^ (name.size() * 0x9e3779b97f4a7c15ULL);
+    for (std::size_t pos = 0; pos < name.size(); pos += 8) {
+        hash = (hash ^ load_word(name, pos)) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 29;
+    }
+    return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+}
+
+// A collision-free slot table for heos_command_names, found at compile
+// time by trying seeds until every name lands in its own slot. With 1024
+// slots for about 70 names a few dozen seeds suffice.
+struct command_hash_table {
+    static constexpr std::size_t size = 1024;
+
+    std::uint32_t seed_{};
+    // Command index + 1 per slot, 0 for an empty slot.
+    std::array<std::uint8_t, size> slots_{};
+};
+
+consteval command_hash_table make_command_hash_table() {
+    for (std::uint32_t seed = 0;; ++seed) {
+        command_hash_table table{.seed_ = seed};
+        bool collision = false;
+        for (std::size_t i = 1; i < heos_command_count && !collision; ++i) {
+            auto& slot = table.slots_[command_hash(heos_command_names[i], seed) % command_hash_table::size];
+            collision = slot != 0;
+            slot = static_cast<std::uint8_t>(i);
+        }
+        if (!collision) {
+            return table;
+        }
+    }
+}
+
+inline constexpr command_hash_table command_table = make_command_hash_table();
+
+}  // namespace detail
+
+// Maps a command name such as "event/player_volume_changed" to its
+// enumerator with one hash and one string comparison. Unknown names give
+// heos_command::unknown.
+constexpr heos_command classify_command(std::string_view name) {
+    const auto& table = detail::command_table;
+    auto index = table.slots_[detail::command_hash(name, table.seed_) % detail::command_hash_table::size];
+    if (index == 0 || heos_command_names[index] != name) {
+        return heos_command::unknown;
+    }
+    return static_cast<heos_command>(index);
+}
+
+constexpr std::string_view to_string(heos_command command) {
+    return heos_command_names[static_cast<std::size_t>(command)];
+}
+
+// How urgently a line is published when the broker link is congested,
+// most urgent first.
+enum class publish_priority : std::uint8_t {
+    // Responses to commands, which someone is waiting for.
+    control,
+    // Player and group state: play state, volume, mute, modes, membership.
+    state,
+    // Now playing media, queues, sources and anything unclassified.
+    metadata,
+    // Progress ticks and heartbeats, superseded by the next one.
+    telemetry,
+};
+
+inline constexpr std::size_t publish_priority_count = 4;
+
+constexpr std::string_view to_string(publish_priority priority) {
+    constexpr std::array<std::string_view, publish_priority_count> names{"control", "state", "metadata", "telemetry"};
+    return names[static_cast<std::size_t>(priority)];
+}
+
+constexpr publish_priority command_priority(heos_command command) {
+    switch (command) {
+    case heos_command::event_player_now_playing_progress:
+    case heos_command::system_heart_beat:
+        return publish_priority::telemetry;
+    case heos_command::event_player_state_changed:
+    case heos_command::event_player_volume_changed:
+    case heos_command::event_group_volume_changed:
+    case heos_command::event_repeat_mode_changed:
+    case heos_command::event_shuffle_mode_changed:
+    case heos_command::event_players_changed:
+    case heos_command::event_groups_changed:
+    case heos_command::event_player_playback_error:
+    case heos_command::event_user_changed:
+        return publish_priority::state;
+    case heos_command::unknown:
+    case heos_command::event_sources_changed:
+    case heos_command::event_player_now_playing_changed:
+    case heos_command::event_player_queue_changed:
+        return publish_priority::metadata;
+    default:
+        return publish_priority::control;
+    }
+}
+
+// One handler per heos_command, indexed without hashing or branching.
+template <typename Handler>
+class heos_command_table {
+public:
+    constexpr Handler& operator[](heos_command command) {
+        return handlers_[static_cast<std::size_t>(command)];
+    }
+    constexpr const Handler& operator[](heos_command command) const {
+        return handlers_[static_cast<std::size_t>(command)];
+    }
+
+private:
+    std::array<Handler, heos_command_count> handlers_{};
+};
+
+}  // namespace heos2mqtt
@@ -0,0 +1,252 @@
+#include "heos_coro_client.hpp"
+#include "logging/logging.hpp"
+
+#include <boost/asio/experimental/awaitable_operators.hpp>
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <exception>
+#include <string_view>
+#include <tuple>
+
+namespace heos2mqtt {
+
+namespace net = boost::asio;
+using namespace logging;
+using namespace net::experimental::awaitable_operators;
+
+namespace {
+
+// Completion token that reports errors as values; cancellation is checked
+// explicitly rather than surfacing as exceptions.
+constexpr auto use_nothrow = net::as_tuple(net::use_awaitable);
+
+constexpr std::string_view heartbeat_command = "heos://system/heart_beat\r\n";
+
+}  // namespace
+
+heos_coro_client::heos_coro_client(
+    std::string_view log_name,
+    net::io_context& io,
+    std::string device_label,
+    net::ip::port_type port,
+    line_handler handler,
+    net::ip::udp::endpoint ssdp_endpoint)
+  : log_name_{log_name}
+  , strand_(net::make_strand(io))
+  , ssdp_resolver_(io, std::move(ssdp_endpoint))
+  , socket_(strand_)
+  , timer_(strand_)
+  , device_label_(std::move(device_label))
+  , port_(port)
+  , handler_(std::move(handler))
+  , metrics_(log_name_)
+{
+    info("[{}] created for device '{}' (port {})", log_name_, device_label_, port_);
+}
+
+void heos_coro_client::start() {
+    net::dispatch(strand_, [this]() {
+        if (started_) {
+            return;
+        }
+        started_ = true;
+        net::co_spawn(strand_, run(),
+            net::bind_cancellation_slot(cancel_signal_.slot(), [this](const std::exception_ptr& ex) {
+                if (!ex) {
+                    return;
+                }
+                try {
+                    std::rethrow_exception(ex);
+                } catch (const std::exception& e) {
+                    error("[{}]: client failed: {}", log_name_, e.what());
+                }
+            }));
+    });
+}
+
+void heos_coro_client::stop() {
+    net::dispatch(strand_, [this]() {
+        cancel_signal_.emit(net::cancellation_type::terminal);
+        close_socket();
+    });
+}
+
+void heos_coro_client::set_reconnect_backoff(std::chrono::steady_clock::duration base,
+                                             std::chrono::steady_clock::duration max) {
+    if (base <= std::chrono::steady_clock::duration::zero()) {
+        base = std::chrono::milliseconds(100);
+    }
+    max = std::max(max, base);
+    net::dispatch(strand_, [this, base, max]() {
+        reconnect_base_ = base;
+        reconnect_max_ = max;
+    });
+}
+
+void heos_coro_client::set_connect_timeout(std::chrono::steady_clock::duration timeout) {
+    net::dispatch(strand_, [this, timeout]() { connect_timeout_ = timeout; });
+}
+
+void heos_coro_client::set_heartbeat_interval(std::chrono::steady_clock::duration interval) {
+    net::dispatch(strand_, [this, interval]() { heartbeat_interval_ = interval; });
+}
+
+void heos_coro_client::set_max_line_size(std::size_t size) {
+    net::dispatch(strand_, [this, size]() { max_line_size_ = std::max(size, detail::min_max_line_size); });
+}
+
+void heos_coro_client::set_ssdp_interfaces(std::vector<ssdp_interface> interfaces) {
+    ssdp_resolver_.set_interfaces(std::move(interfaces));
+}
+
+void heos_coro_client::set_probe_fallback(std::vector<net::ip::address_v4> hosts) {
+    probe_sweep_.emplace(static_cast<net::io_context&>(strand_.context()), std::move(hosts), port_);
+}
+
+net::awaitable<void> heos_coro_client::run() {
+    co_await net::this_coro::throw_if_cancelled(false);
+    auto state = co_await net::this_coro::cancellation_state;
+
+    while (!state.cancelled()) {
+        if (co_await connect()) {
+            reconnect_attempts_ = 0;
+            co_await read_lines();
+            close_socket();
+        }
+        if (state.cancelled()) {
+            break;
+        }
+        co_await backoff();
+    }
+    debug("[{}]: stopped", log_name_);
+}
+
+net::awaitable<bool> heos_coro_client::connect() {
+    info("[{}]: SSDP resolving '{}'", log_name_, device_label_);
+    auto [resolve_ec, address] =
+        co_await ssdp_resolver_.async_resolve(detail::heos_search_target, use_nothrow);
+    if ((co_await net::this_coro::cancellation_state).cancelled()) {
+        co_return false;
+    }
+    std::string_view source = "SSDP";
+    if (resolve_ec && probe_sweep_) {
+        warning("[{}]: SSDP resolve error: {}, probing {} hosts", log_name_, resolve_ec.message(),
+            probe_sweep_->host_count());
+        source = "probe";
+        std::tie(resolve_ec, address) = co_await probe_sweep_->async_probe(use_nothrow);
+        if ((co_await net::this_coro::cancellation_state).cancelled()) {
+            co_return false;
+        }
+    }
+    if (resolve_ec) {
+        error("[{}]: {} resolve error: {}", log_name_, source, resolve_ec.message());
+        metrics_.connect_errors_.inc();
+        co_return false;
+    }
+    info("[{}]: {} resolved {} -> {}", log_name_, source, device_label_, detail::log_address(address));
+
+    tcp::endpoint endpoint(address, port_);
+    info("[{}]: connecting to {}:{}", log_name_, detail::log_address(address), port_);
+    timer_.expires_after(connect_timeout_);
+    auto result = co_await (
+        socket_.async_connect(endpoint, use_nothrow) ||
+        timer_.async_wait(use_nothrow));
+    if (result.index() == 1) {
+        error("[{}]: connect timed out", log_name_);
+        metrics_.connect_errors_.inc();
+        close_socket();
+        co_return false;
+    }
+    auto [connect_ec] = std::get<0>(result);
+    if (connect_ec) {
+        error("[{}]: connect error: {}", log_name_, connect_ec.message());
+        metrics_.connect_errors_.inc();
+        close_socket();
+        co_return false;
+    }
+    info("[{}]: connected", log_name_);
+    metrics_.connects_.inc();
+    metrics_.connected_.set(1);
+    co_return true;
+}
+
+net::awaitable<void> heos_coro_client::read_lines() {
+    for (;;) {
+        boost::system::error_code ec;
+        std::size_t bytes = 0;
+        if (heartbeat_interval_ > std::chrono::steady_clock::duration::zero()) {
+            // Partial reads stay in read_buffer_ when the timer wins, so the
+            // read can simply be reissued after the heartbeat.
+            timer_.expires_after(heartbeat_interval_);
+            auto result = co_await (
+                net::async_read_until(socket_, read_buffer_, detail::line_or_limit{max_line_size_}, use_nothrow) ||
+                timer_.async_wait(use_nothrow));
+            if (result.index() == 1) {
+                debug("[{}]: idle, sending heartbeat", log_name_);
+                auto [write_ec, written] = co_await net::async_write(
+                    socket_, net::buffer(heartbeat_command), use_nothrow);
+                if (write_ec) {
+                    error("[{}]: heartbeat error: {}", log_name_, write_ec.message());
+                    co_return;
+                }
+                continue;
+            }
+            std::tie(ec, bytes) = std::get<0>(result);
+        } else {
+            std::tie(ec, bytes) =
+                co_await net::async_read_until(socket_, read_buffer_, detail::line_or_limit{max_line_size_}, use_nothrow);
+        }
+
+        line_trace trace{.read_ = line_trace::clock::now()};
+        if ((co_await net::this_coro::cancellation_state).cancelled()) {
+            co_return;
+        }
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                error("[{}]: read error: {}", log_name_, ec.message());
+                metrics_.read_errors_.inc();
+            }
+            co_return;
+        }
+
+        auto [line, complete] = detail::take_line(read_buffer_, bytes);
+        metrics_.bytes_read_.inc(bytes);
+        trace.fragment_ = fragment_index_;
+        trace.continued_ = !complete;
+        if (complete) {
+            metrics_.lines_read_.inc();
+            fragment_index_ = 0;
+        } else {
+            if (fragment_index_ == 0) {
+                warning("[{}]: line exceeds {} bytes, delivering it in pieces", log_name_, max_line_size_);
+            }
+            metrics_.fragments_read_.inc();
+            ++fragment_index_;
+        }
+        if (handler_) {
+            trace.dispatched_ = line_trace::clock::now();
+            handler_(std::move(line), trace);
+        }
+    }
+}
+
+net::awaitable<void> heos_coro_client::backoff() {
+    reconnect_attempts_ = std::min<std::size_t>(reconnect_attempts_ + 1, 32);
+    auto delay = detail::reconnect_delay(reconnect_attempts_, reconnect_base_, reconnect_max_);
+    info("[{}]: retry in {}", log_name_, delay);
+    timer_.expires_after(delay);
+    co_await timer_.async_wait(use_nothrow);
+}
+
+void heos_coro_client::close_socket() {
+    metrics_.connected_.set(0);
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    read_buffer_.consume(read_buffer_.size());
+    fragment_index_ = 0;
+}
+
+}  // namespace heos2mqtt
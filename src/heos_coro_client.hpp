@@ -0,0 +1,81 @@
+#pragma once
+
+#include "heos_client.hpp"
+#include "probe_sweep.hpp"
+#include "ssdp_resolver.hpp"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace heos2mqtt {
+
+// Coroutine implementation of heos_client: the resolve -> connect -> read ->
+// backoff cycle is a single awaitable per device, spawned on the device
+// strand and stopped through a cancellation slot.
+class heos_coro_client {
+public:
+    using tcp = boost::asio::ip::tcp;
+    using line_handler = heos_client::line_handler;
+
+    heos_coro_client(
+        std::string_view log_name,
+        boost::asio::io_context& io,
+        std::string device_label,
+        boost::asio::ip::port_type port,
+        line_handler handler,
+        boost::asio::ip::udp::endpoint ssdp_endpoint = default_ssdp_endpoint);
+
+    void start();
+    void stop();
+    void set_reconnect_backoff(std::chrono::steady_clock::duration base,
+                               std::chrono::steady_clock::duration max);
+    void set_connect_timeout(std::chrono::steady_clock::duration timeout);
+
+    // Sends the HEOS heartbeat command after this much read inactivity. Zero
+    // (the default) disables heartbeats.
+    void set_heartbeat_interval(std::chrono::steady_clock::duration interval);
+    // Lines longer than this are delivered in pieces of at most this size,
+    // bounding the read buffer. At least detail::min_max_line_size.
+    void set_max_line_size(std::size_t size);
+    // Searches for the device from each of these interfaces in parallel.
+    // Must be called before start().
+    void set_ssdp_interfaces(std::vector<ssdp_interface> interfaces);
+    // When SSDP finds nothing, sweeps these hosts for a HEOS CLI on the
+    // client's port instead. Must be called before start().
+    void set_probe_fallback(std::vector<boost::asio::ip::address_v4> hosts);
+
+private:
+    boost::asio::awaitable<void> run();
+    boost::asio::awaitable<bool> connect();
+    boost::asio::awaitable<void> read_lines();
+    boost::asio::awaitable<void> backoff();
+    void close_socket();
+
+    std::string log_name_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    ssdp_resolver ssdp_resolver_;
+    std::optional<probe_sweep> probe_sweep_;
+    tcp::socket socket_;
+    boost::asio::streambuf read_buffer_;
+    boost::asio::steady_timer timer_;
+    boost::asio::cancellation_signal cancel_signal_;
+    std::string device_label_;
+    boost::asio::ip::port_type port_;
+    line_handler handler_;
+    detail::client_metrics metrics_;
+    std::size_t max_line_size_{detail::default_max_line_size};
+    std::uint32_t fragment_index_{0};
+    bool started_{false};
+    std::size_t reconnect_attempts_{0};
+    std::chrono::steady_clock::duration reconnect_base_{std::chrono::seconds(1)};
+    std::chrono::steady_clock::duration reconnect_max_{std::chrono::seconds(30)};
+    std::chrono::steady_clock::duration connect_timeout_{std::chrono::seconds(5)};
+    std::chrono::steady_clock::duration heartbeat_interval_{};
+};
+
+}  // namespace heos2mqtt
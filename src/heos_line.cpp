@@ -0,0 +1,304 @@
+#include "heos_line.hpp"
+
+#include <fmt/core.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HEOS2MQTT_HAVE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HEOS2MQTT_HAVE_NEON 1
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+
+namespace heos2mqtt {
+
+namespace {
+
+constexpr std::size_t npos = std::string_view::npos;
+constexpr std::size_t block_size = 16;
+
+// Yields the positions of the quotes in a line in order, computing one
+// 16 byte mask at a time.
+class quote_cursor {
+public:
+    explicit quote_cursor(std::string_view text)
+      : text_(text)
+      , mask_(detail::quote_mask(text, 0))
+    {}
+
+    std::size_t next() {
+        while (mask_ == 0) {
+            block_ += block_size;
+            if (block_ >= text_.size()) {
+                return npos;
+            }
+            mask_ = detail::quote_mask(text_, block_);
+        }
+        auto bit = static_cast<std::size_t>(std::countr_zero(mask_));
+        mask_ &= mask_ - 1;
+        return block_ + bit;
+    }
+
+    // The next quote that is not escaped by a backslash.
+    std::size_t next_unescaped() {
+        auto pos = next();
+        while (pos != npos) {
+            std::size_t backslashes = 0;
+            while (backslashes < pos && text_[pos - backslashes - 1] == '\\') {
+                ++backslashes;
+            }
+            if (backslashes % 2 == 0) {
+                return pos;
+            }
+            pos = next();
+        }
+        return npos;
+    }
+
+private:
+    std::string_view text_;
+    std::size_t block_{0};
+    std::uint32_t mask_;
+};
+
+std::size_t skip_space(std::string_view text, std::size_t pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+        ++pos;
+    }
+    return pos;
+}
+
+}  // namespace
+
+std::uint32_t detail::quote_mask_scalar(std::string_view text, std::size_t pos) {
+    std::uint32_t mask = 0;
+    auto end = std::min(text.size(), pos + block_size);
+    for (auto i = pos; i < end; ++i) {
+        if (text[i] == '"') {
+            mask |= std::uint32_t{1} << (i - pos);
+        }
+    }
+    return mask;
+}
+
+std::uint32_t detail::quote_mask(std::string_view text, std::size_t pos) {
+    if (pos + block_size > text.size()) {
+        return quote_mask_scalar(text, pos);
+    }
+    const char* block = text.data() + pos;
+#if defined(HEOS2MQTT_HAVE_SSE2)
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))));
+#elif defined(HEOS2MQTT_HAVE_NEON)
+    auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t*>(block)); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    // Keep one distinct bit per lane, then fold each half with pairwise
+    // adds; vaddv_u8 would do it in one step but is AArch64 only.
+    constexpr std::array<std::uint8_t, 16> lane_bits{1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    auto bits = vandq_u8(vceqq_u8(chunk, vdupq_n_u8('"')), vld1q_u8(lane_bits.data()));
+    auto folded = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    folded = vpadd_u8(folded, folded);
+    folded = vpadd_u8(folded, folded);
+    return static_cast<std::uint32_t>(vget_lane_u8(folded, 0)) |
+           (static_cast<std::uint32_t>(vget_lane_u8(folded, 1)) << 8);
+#else
+    (void)block;
+    return quote_mask_scalar(text, pos);
+#endif
+}
+
+heos_line_fields scan_heos_line(std::string_view line) {
+    heos_line_fields fields;
+    quote_cursor quotes(line);
+    auto open = quotes.next();
+    while (open != npos) {
+        auto close = quotes.next_unescaped();
+        if (close == npos) {
+            break;
+        }
+        auto after = skip_space(line, close + 1);
+        if (after >= line.size() || line[after] != ':') {
+            // A value; the next string may be a key.
+            open = quotes.next();
+            continue;
+        }
+        auto key = line.substr(open + 1, close - open - 1);
+        if (key == "payload") {
+            fields.has_payload_ = true;
+            break;
+        }
+        open = quotes.next();
+        if (open == npos || open != skip_space(line, after + 1)) {
+            // "heos": { ... } or a non-string value; open is the next key.
+            continue;
+        }
+        close = quotes.next_unescaped();
+        if (close == npos) {
+            break;
+        }
+        auto value = line.substr(open + 1, close - open - 1);
+        if (key == "command") {
+            fields.command_ = value;
+        } else if (key == "message") {
+            fields.message_ = value;
+        } else if (key == "result") {
+            fields.result_ = value;
+        }
+        open = quotes.next();
+    }
+    return fields;
+}
+
+std::optional<std::int64_t> message_pid(std::string_view message) {
+    constexpr std::string_view key = "pid=";
+    std::size_t pos = 0;
+    while ((pos = message.find(key, pos)) != std::string_view::npos) {
+        if (pos == 0 || message[pos - 1] == '&') {
+            auto value = message.substr(pos + key.size());
+            std::int64_t pid{};
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), pid);
+            if (ec != std::errc{} || (end != value.data() + value.size() && *end != '&')) {
+                return std::nullopt;
+            }
+            return pid;
+        }
+        pos += key.size();
+    }
+    return std::nullopt;
+}
+
+command_counters::command_counters(metrics::registry& registry) {
+    for (std::size_t i = 0; i < heos_command_count; ++i) {
+        auto command = static_cast<heos_command>(i);
+        auto name = command == heos_command::unknown ? std::string_view("other") : to_string(command);
+        counters_[command] = &registry.add_counter("heos_lines_total", "HEOS lines received by command",
+            fmt::format("command=\"{}\"", metrics::escape(name)));
+    }
+}
+
+heos_command command_counters::count(std::string_view line) {
+    auto command = classify_command(scan_heos_line(line).command_);
+    counters_[command]->inc();
+    return command;
+}
+
+line_filter::line_filter(metrics::registry& registry)
+  : nodes_(1)
+  , filtered_(registry.add_counter("heos_lines_filtered_total", "HEOS lines dropped by --drop rules"))
+{}
+
+std::optional<std::size_t> line_filter::symbol(char c) {
+    if (c >= 'a' && c <= 'z') {
+        return static_cast<std::size_t>(c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return static_cast<std::size_t>(c - '0') + 26;
+    }
+    if (c == '_') {
+        return 36;
+    }
+    if (c == '/') {
+        return 37;
+    }
+    return std::nullopt;
+}
+
+void line_filter::add_drop(std::string_view text) {
+    auto command = text;
+    std::optional<std::int64_t> pid;
+    if (auto at = text.find('@'); at != std::string_view::npos) {
+        command = text.substr(0, at);
+        auto value = text.substr(at + 1);
+        std::int64_t parsed{};
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+        if (value.empty() || ec != std::errc{} || end != value.data() + value.size()) {
+            throw std::invalid_argument("invalid player id in drop rule '" + std::string(text) + "'");
+        }
+        pid = parsed;
+    }
+
+    const bool prefix = !command.empty() && command.back() == '*';
+    if (prefix) {
+        command.remove_suffix(1);
+    }
+    if (command.empty() && !prefix) {
+        throw std::invalid_argument("empty command in drop rule '" + std::string(text) + "'");
+    }
+
+    if (!std::all_of(command.begin(), command.end(), [](char c) { return symbol(c).has_value(); })) {
+        throw std::invalid_argument("invalid character in drop rule '" + std::string(text) + "'");
+    }
+
+    std::size_t current = 0;
+    for (char c : command) {
+        auto index = *symbol(c);
+        auto child = nodes_[current].children_[index];
+        if (child == no_child) {
+            child = static_cast<std::int32_t>(nodes_.size());
+            nodes_[current].children_[index] = child;
+            nodes_.emplace_back();
+        }
+        current = static_cast<std::size_t>(child);
+    }
+
+    auto& target = prefix ? nodes_[current].prefix_ : nodes_[current].exact_;
+    target.active_ = true;
+    if (!pid) {
+        target.all_pids_ = true;
+        target.pids_.clear();
+    } else if (!target.all_pids_) {
+        auto it = std::lower_bound(target.pids_.begin(), target.pids_.end(), *pid);
+        if (it == target.pids_.end() || *it != *pid) {
+            target.pids_.insert(it, *pid);
+        }
+    }
+}
+
+bool line_filter::empty() const {
+    return nodes_.size() == 1 && !nodes_.front().prefix_.active_;
+}
+
+bool line_filter::matches(const rule& candidate, std::string_view message) {
+    if (!candidate.active_) {
+        return false;
+    }
+    if (candidate.all_pids_) {
+        return true;
+    }
+    auto pid = message_pid(message);
+    return pid && std::binary_search(candidate.pids_.begin(), candidate.pids_.end(), *pid);
+}
+
+bool line_filter::accepts(std::string_view line) const {
+    if (empty()) {
+        return true;
+    }
+    auto fields = scan_heos_line(line);
+    if (fields.command_.empty()) {
+        return true;
+    }
+
+    const node* current = &nodes_.front();
+    bool drop = matches(current->prefix_, fields.message_);
+    for (auto c = fields.command_.begin(); !drop && c != fields.command_.end(); ++c) {
+        auto index = symbol(*c);
+        if (!index || current->children_[*index] == no_child) {
+            return true;
+        }
+        current = &nodes_[static_cast<std::size_t>(current->children_[*index])];
+        drop = matches(current->prefix_, fields.message_);
+    }
+    drop = drop || matches(current->exact_, fields.message_);
+    if (drop) {
+        filtered_.inc();
+    }
+    return !drop;
+}
+
+}  // namespace heos2mqtt
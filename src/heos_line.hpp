@@ -0,0 +1,105 @@
+#pragma once
+
+#include "heos_command.hpp"
+#include "metrics/metrics.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace heos2mqtt {
+
+// The routing fields of a HEOS CLI line, as views into the line.
+struct heos_line_fields {
+    // heos.command, e.g. "event/player_volume_changed". Empty if missing.
+    std::string_view command_;
+    // heos.message, the URL-style query string, still encoded.
+    std::string_view message_;
+    // heos.result, "success" or "fail" for command responses.
+    std::string_view result_;
+    // Set if the line carries a payload, which needs a full JSON parse.
+    bool has_payload_{false};
+};
+
+namespace detail {
+
+// Bit i is set if text[pos + i] is '"', for the (up to) 16 bytes starting
+// at pos. Uses SSE2 or NEON where available.
+std::uint32_t quote_mask(std::string_view text, std::size_t pos);
+// Portable reference implementation of quote_mask.
+std::uint32_t quote_mask_scalar(std::string_view text, std::size_t pos);
+
+}  // namespace detail
+
+// Finds heos.command, heos.message and heos.result without parsing or
+// allocating. Quotes are located 16 bytes at a time and the scan walks
+// from string to string, looking only at the bytes around each one. It
+// stops at the payload, so song titles and browse results are never
+// examined. Anything unexpected yields empty fields.
+heos_line_fields scan_heos_line(std::string_view line);
+
+// The pid= parameter of a HEOS message, if present and numeric.
+std::optional<std::int64_t> message_pid(std::string_view message);
+
+// Counts lines per HEOS command as heos_lines_total{command="..."}, with
+// undocumented commands and non-HEOS lines counted as "other".
+class command_counters {
+public:
+    explicit command_counters(metrics::registry& registry = metrics::registry::get_default());
+
+    // Classifies line, counts it and returns its command.
+    heos_command count(std::string_view line);
+
+private:
+    heos_command_table<metrics::counter*> counters_;
+};
+
+// Drops lines by command name and optionally player id before they reach
+// the publisher. Rules are compiled into a trie over command names, so
+// each line costs one scan and one walk of its command.
+class line_filter {
+public:
+    explicit line_filter(metrics::registry& registry = metrics::registry::get_default());
+
+    // Adds a drop rule "command[@pid]". A command ending in '*' matches
+    // every command with that prefix, e.g. "event/*". Throws
+    // std::invalid_argument if the rule is malformed.
+    void add_drop(std::string_view rule);
+
+    [[nodiscard]] bool empty() const;
+
+    // False if the line matches a drop rule.
+    [[nodiscard]] bool accepts(std::string_view line) const;
+
+private:
+    // Command names use lower case letters, digits, '_' and '/'.
+    static constexpr std::size_t alphabet_size = 38;
+    static constexpr std::int32_t no_child = -1;
+
+    struct rule {
+        bool active_{false};
+        bool all_pids_{false};
+        // Sorted; consulted when all_pids_ is false.
+        std::vector<std::int64_t> pids_;
+    };
+
+    struct node {
+        node() { children_.fill(no_child); }
+
+        std::array<std::int32_t, alphabet_size> children_{};
+        // Rule for a command ending at this node.
+        rule exact_;
+        // Rule for every command passing through this node.
+        rule prefix_;
+    };
+
+    static std::optional<std::size_t> symbol(char c);
+    static bool matches(const rule& candidate, std::string_view message);
+
+    std::vector<node> nodes_;
+    metrics::counter& filtered_;
+};
+
+}  // namespace heos2mqtt
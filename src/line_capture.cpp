@@ -0,0 +1,259 @@
+#include "line_capture.hpp"
+#include "logging/logging.hpp"
+
+#include <boost/json.hpp>
+#include <fmt/core.h>
+
+#include <charconv>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace heos2mqtt {
+
+using namespace logging;
+
+namespace {
+
+// Lines delivered per handler turn at max speed before yielding to other
+// work on the io_context.
+constexpr std::size_t max_speed_batch{256};
+
+}  // namespace
+
+std::optional<double> detail::parse_replay_speed(std::string_view text) {
+    if (text == "max") {
+        return 0.0;
+    }
+    if (!text.empty() && (text.back() == 'x' || text.back() == 'X')) {
+        text.remove_suffix(1);
+    }
+    double speed{};
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), speed);
+    if (ec != std::errc{} || end != text.data() + text.size() || !(speed > 0.0)) {
+        return std::nullopt;
+    }
+    return speed;
+}
+
+line_recorder::line_recorder(const std::string& path)
+  : out_(path, std::ios::out | std::ios::trunc | std::ios::binary)
+{
+    if (!out_) {
+        throw std::runtime_error(fmt::format("cannot open capture file '{}' for writing", path));
+    }
+    info("recording HEOS lines to '{}'", path);
+    writer_ = std::thread([this]() { write_loop(); });
+}
+
+line_recorder::~line_recorder() {
+    {
+        std::lock_guard lock(mutex_);
+        closing_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+}
+
+void line_recorder::record(std::string_view line, line_trace::clock::time_point read_at) {
+    record(line, line_trace{.read_ = read_at});
+}
+
+void line_recorder::record(std::string_view line, const line_trace& trace) {
+    std::lock_guard lock(mutex_);
+    if (!origin_) {
+        origin_ = trace.read_;
+    }
+    boost::json::object entry{
+        {"t_us", std::chrono::duration_cast<std::chrono::microseconds>(trace.read_ - *origin_).count()},
+        {"line", line},
+    };
+    if (trace.fragmented()) {
+        entry["fragment"] = trace.fragment_;
+        if (trace.continued_) {
+            entry["more"] = true;
+        }
+    }
+    const bool idle = pending_.empty();
+    pending_ += boost::json::serialize(entry);
+    pending_ += '\n';
+    ++recorded_;
+    if (idle) {
+        wake_.notify_one();
+    }
+}
+
+void line_recorder::flush() {
+    std::unique_lock lock(mutex_);
+    flush_requested_ = true;
+    wake_.notify_one();
+    written_.wait(lock, [this]() { return !flush_requested_; });
+}
+
+void line_recorder::write_loop() {
+    std::string batch;
+    std::unique_lock lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this]() { return !pending_.empty() || flush_requested_ || closing_; });
+        const bool flush = flush_requested_ || closing_;
+        const bool last = closing_;
+        batch.clear();
+        batch.swap(pending_);
+        lock.unlock();
+        out_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+        if (flush) {
+            out_.flush();
+        }
+        lock.lock();
+        // Whatever was recorded while writing goes out on the next turn
+        // before a flush is reported done.
+        if (flush && pending_.empty()) {
+            flush_requested_ = false;
+            written_.notify_all();
+        }
+        if (last && pending_.empty()) {
+            return;
+        }
+    }
+}
+
+std::size_t line_recorder::recorded() const {
+    std::lock_guard lock(mutex_);
+    return recorded_;
+}
+
+line_replayer::line_replayer(boost::asio::io_context& io, const std::string& path, double speed,
+                             line_handler handler, done_handler done)
+  : strand_(boost::asio::make_strand(io))
+  , timer_(strand_)
+  , in_(path, std::ios::in | std::ios::binary)
+  , path_(path)
+  , speed_(speed)
+  , handler_(std::move(handler))
+  , done_(std::move(done))
+{
+    if (!in_) {
+        throw std::runtime_error(fmt::format("cannot open capture file '{}' for reading", path));
+    }
+}
+
+void line_replayer::start() {
+    boost::asio::dispatch(strand_, [this]() {
+        if (running_) {
+            return;
+        }
+        running_ = true;
+        stopping_ = false;
+        started_ = line_trace::clock::now();
+        if (speed_ > 0.0) {
+            info("replaying '{}' at {}x", path_, speed_);
+        } else {
+            info("replaying '{}' at max speed", path_);
+        }
+        replay_next();
+    });
+}
+
+void line_replayer::stop() {
+    boost::asio::dispatch(strand_, [this]() {
+        stopping_ = true;
+        timer_.cancel();
+    });
+}
+
+std::optional<line_replayer::record> line_replayer::next_record() {
+    std::string text;
+    while (std::getline(in_, text)) {
+        if (text.empty()) {
+            continue;
+        }
+        boost::system::error_code ec;
+        auto value = boost::json::parse(text, ec);
+        const auto* entry = ec ? nullptr : value.if_object();
+        const auto* t_us = entry ? entry->if_contains("t_us") : nullptr;
+        const auto* line = entry ? entry->if_contains("line") : nullptr;
+        if (t_us == nullptr || !t_us->is_int64() || line == nullptr || !line->is_string()) {
+            ++malformed_;
+            continue;
+        }
+        const auto* fragment = entry->if_contains("fragment");
+        const auto* more = entry->if_contains("more");
+        if ((fragment != nullptr && (!fragment->is_int64() || fragment->as_int64() < 0 ||
+                                     fragment->as_int64() > std::numeric_limits<std::uint32_t>::max())) ||
+            (more != nullptr && !more->is_bool())) {
+            ++malformed_;
+            continue;
+        }
+        const auto& content = line->as_string();
+        record next{t_us->as_int64(), std::string(content.data(), content.size())};
+        if (fragment != nullptr) {
+            next.fragment_ = static_cast<std::uint32_t>(fragment->as_int64());
+        }
+        next.continued_ = more != nullptr && more->as_bool();
+        return next;
+    }
+    return std::nullopt;
+}
+
+void line_replayer::replay_next() {
+    if (stopping_) {
+        return;
+    }
+
+    if (speed_ <= 0.0) {
+        for (std::size_t i = 0; i < max_speed_batch; ++i) {
+            auto next = next_record();
+            if (!next) {
+                finish();
+                return;
+            }
+            deliver(std::move(*next));
+        }
+        boost::asio::post(strand_, [this]() { replay_next(); });
+        return;
+    }
+
+    auto next = next_record();
+    if (!next) {
+        finish();
+        return;
+    }
+    if (!origin_us_) {
+        origin_us_ = next->t_us_;
+    }
+    const auto offset = std::chrono::duration<double, std::micro>(
+        static_cast<double>(next->t_us_ - *origin_us_) / speed_);
+    timer_.expires_at(started_ + std::chrono::duration_cast<line_trace::clock::duration>(offset));
+    timer_.async_wait([this, due = std::move(*next)](const boost::system::error_code& ec) mutable {
+        if (ec || stopping_) {
+            return;
+        }
+        deliver(std::move(due));
+        replay_next();
+    });
+}
+
+void line_replayer::deliver(record&& next) {
+    // Replayed lines are stamped as if they had just been read, so the
+    // downstream latency metrics stay meaningful.
+    line_trace trace{.read_ = line_trace::clock::now(), .fragment_ = next.fragment_, .continued_ = next.continued_};
+    trace.dispatched_ = trace.read_;
+    ++replayed_;
+    handler_(std::move(next.line_), trace);
+}
+
+void line_replayer::finish() {
+    running_ = false;
+    const auto elapsed = line_trace::clock::now() - started_;
+    if (malformed_ != 0) {
+        warning("skipped {} malformed records in '{}'", malformed_, path_);
+    }
+    info("replayed {} lines from '{}' in {:.3f}s", replayed_, path_,
+         std::chrono::duration<double>(elapsed).count());
+    if (done_) {
+        done_(replayed_, elapsed);
+    }
+}
+
+}  // namespace heos2mqtt
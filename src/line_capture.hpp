@@ -0,0 +1,118 @@
+#pragma once
+
+#include "line_trace.hpp"
+
+#include <boost/asio.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace heos2mqtt {
+
+// Capture files are NDJSON, one record per received line:
+//
+//   {"t_us":1234,"line":"{\"heos\": ...}"}
+//
+// t_us is the monotonic read time in microseconds relative to the first
+// record, so a capture can be replayed with its original pacing. A piece of
+// an over-long line also carries its "fragment" index and, on every piece
+// but the last, "more":true, so that a replay delivers it as a piece.
+
+namespace detail {
+
+// Parses a replay speed: "max" (returned as 0, meaning no pacing), or a
+// positive multiplier with an optional trailing 'x', e.g. "2x" or "0.5".
+std::optional<double> parse_replay_speed(std::string_view text);
+
+}  // namespace detail
+
+// Appends lines to a capture file. Safe to call from several strands.
+// record() only appends to a memory buffer; a background thread writes it
+// out, so a slow disk cannot stall the io threads.
+class line_recorder {
+public:
+    // Throws std::runtime_error if path cannot be opened for writing.
+    explicit line_recorder(const std::string& path);
+    // Writes out everything recorded.
+    ~line_recorder();
+
+    line_recorder(const line_recorder&) = delete;
+    line_recorder& operator=(const line_recorder&) = delete;
+
+    void record(std::string_view line, line_trace::clock::time_point read_at);
+    // As above, keeping the piece of an over-long line that line is.
+    void record(std::string_view line, const line_trace& trace);
+    // Returns once everything recorded so far is written and flushed.
+    void flush();
+
+    [[nodiscard]] std::size_t recorded() const;
+
+private:
+    void write_loop();
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable written_;
+    // Records not yet handed to the writer.
+    std::string pending_;
+    std::optional<line_trace::clock::time_point> origin_;
+    std::size_t recorded_{0};
+    bool flush_requested_{false};
+    bool closing_{false};
+    std::ofstream out_;
+    std::thread writer_;
+};
+
+// Feeds a capture file into a line handler without a socket, either paced
+// by the recorded timestamps scaled by speed, or as fast as the handler
+// accepts lines (speed 0).
+class line_replayer {
+public:
+    using line_handler = std::function<void(std::string, line_trace)>;
+    // Called once on the replayer's strand after the last line.
+    using done_handler = std::function<void(std::size_t lines, line_trace::clock::duration elapsed)>;
+
+    // Throws std::runtime_error if path cannot be opened for reading.
+    line_replayer(boost::asio::io_context& io, const std::string& path, double speed,
+                  line_handler handler, done_handler done = {});
+
+    void start();
+    void stop();
+
+private:
+    struct record {
+        std::int64_t t_us_{};
+        std::string line_;
+        std::uint32_t fragment_{0};
+        bool continued_{false};
+    };
+
+    std::optional<record> next_record();
+    void replay_next();
+    void deliver(record&& next);
+    void finish();
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::steady_timer timer_;
+    std::ifstream in_;
+    std::string path_;
+    double speed_;
+    line_handler handler_;
+    done_handler done_;
+    line_trace::clock::time_point started_;
+    std::optional<std::int64_t> origin_us_;
+    std::size_t replayed_{0};
+    std::size_t malformed_{0};
+    bool running_{false};
+    bool stopping_{false};
+};
+
+}  // namespace heos2mqtt
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace heos2mqtt {
+
+// Monotonic timestamps that follow one HEOS line from the socket to the
+// broker's acknowledgement. A default constructed trace means "not traced".
+//
+// A line longer than the client's maximum line size arrives as several
+// consecutive pieces: fragment_ counts them from 0 and continued_ is set on
+// every piece but the last.
+struct line_trace {
+    using clock = std::chrono::steady_clock;
+
+    // When the socket read that produced the line completed.
+    clock::time_point read_;
+    // When the line was handed to the line handler.
+    clock::time_point dispatched_;
+    std::uint32_t fragment_{0};
+    bool continued_{false};
+
+    [[nodiscard]] bool traced() const {
+        return read_ != clock::time_point{};
+    }
+
+    [[nodiscard]] bool fragmented() const {
+        return fragment_ != 0 || continued_;
+    }
+};
+
+}  // namespace heos2mqtt
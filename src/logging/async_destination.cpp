@@ -0,0 +1,210 @@
+#include "logging/async_destination.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+namespace logging {
+
+log_destination_async::log_destination_async(int fd)
+  : log_destination_async(fd, options{})
+{}
+
+log_destination_async::log_destination_async(int fd, options opts)
+  : fd_(fd)
+  , overflow_(opts.overflow_)
+  , mask_(std::bit_ceil(std::max<std::size_t>(opts.capacity_, 2)) - 1)
+  , slots_(std::make_unique<slot[]>(mask_ + 1)) // NOLINT(cppcoreguidelines-avoid-c-arrays)
+{
+    for (std::size_t i = 0; i <= mask_; ++i) {
+        slots_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+    batch_.reserve(batch_size + 1024);
+    writer_ = std::thread([this]() { run(); });
+}
+
+log_destination_async::~log_destination_async() {
+    stopping_.store(true, std::memory_order_release);
+    wake_writer();
+    writer_.join();
+}
+
+void log_destination_async::emit(const log_record& record) {
+    std::size_t pos = 0;
+    auto* target = claim_slot(pos);
+    if (!target) {
+        return;
+    }
+    auto message = record.message();
+    target->level_ = record.level();
+    target->timestamp_ = record.timestamp();
+    target->location_ = record.location();
+    target->formatter_ = nullptr;
+    if (message.size() > max_message_size) {
+        target->length_ = 0;
+        target->oversize_.assign(message);
+    } else {
+        target->length_ = static_cast<std::uint16_t>(message.size());
+        std::memcpy(target->message_.data(), message.data(), message.size());
+    }
+    publish_slot(*target, pos);
+}
+
+bool log_destination_async::defers_formatting() const {
+    return true;
+}
+
+void log_destination_async::emit_deferred(const deferred_record& record) {
+    std::size_t pos = 0;
+    auto* target = claim_slot(pos);
+    if (!target) {
+        return;
+    }
+    auto args = record.args().first(std::min(record.args().size(), max_message_size));
+    target->level_ = record.level();
+    target->timestamp_ = record.timestamp();
+    target->location_ = record.location();
+    target->formatter_ = record.formatter();
+    target->format_ = record.format();
+    target->length_ = static_cast<std::uint16_t>(args.size());
+    std::memcpy(target->message_.data(), args.data(), args.size());
+    publish_slot(*target, pos);
+}
+
+log_destination_async::slot* log_destination_async::claim_slot(std::size_t& pos) {
+    // Bounded MPSC ring after Vyukov: a slot is free for position pos when
+    // its sequence equals pos, and ready for the writer at pos + 1.
+    pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+        auto* target = &slots_[pos & mask_];
+        auto seq = target->sequence_.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return target;
+            }
+        } else if (diff < 0) {
+            if (overflow_ == overflow_policy::drop) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            wake_writer();
+            std::this_thread::yield();
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void log_destination_async::publish_slot(slot& target, std::size_t pos) {
+    target.sequence_.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in run(): either the writer sees this record
+    // before sleeping, or we see that it is asleep and wake it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        wake_writer();
+    }
+}
+
+void log_destination_async::flush() {
+    const auto target = enqueue_pos_.load(std::memory_order_acquire);
+    while (written_.load(std::memory_order_acquire) < target) {
+        wake_writer();
+        std::this_thread::yield();
+    }
+}
+
+std::uint64_t log_destination_async::dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+void log_destination_async::wake_writer() {
+    wake_.fetch_add(1, std::memory_order_release);
+    wake_.notify_one();
+}
+
+void log_destination_async::run() {
+    for (;;) {
+        if (drain() > 0) {
+            continue;
+        }
+        if (stopping_.load(std::memory_order_acquire)) {
+            // Producers are gone once the destructor runs; one final pass
+            // picks up anything published since the drain above.
+            if (drain() == 0) {
+                return;
+            }
+            continue;
+        }
+
+        auto seen = wake_.load(std::memory_order_acquire);
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto& next = slots_[dequeue_pos_ & mask_];
+        if (next.sequence_.load(std::memory_order_acquire) == dequeue_pos_ + 1 ||
+            stopping_.load(std::memory_order_acquire)) {
+            sleeping_.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        wake_.wait(seen, std::memory_order_acquire);
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
+
+std::size_t log_destination_async::drain() {
+    std::size_t count = 0;
+    for (;;) {
+        auto& item = slots_[dequeue_pos_ & mask_];
+        if (item.sequence_.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+            break;
+        }
+        std::string_view message(item.message_.data(), item.length_);
+        if (item.formatter_) {
+            scratch_.clear();
+            item.formatter_(scratch_, item.format_,
+                            reinterpret_cast<const std::byte*>(item.message_.data())); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            message = scratch_;
+        } else if (!item.oversize_.empty()) {
+            message = item.oversize_;
+        }
+        format_record(batch_, log_record{item.level_, item.timestamp_, message, item.location_});
+        item.oversize_.clear();
+        // Release the slot as soon as it is formatted so producers are not
+        // held up by the write below.
+        item.sequence_.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        ++count;
+        if (batch_.size() >= batch_size) {
+            write_batch();
+        }
+    }
+    write_batch();
+    return count;
+}
+
+void log_destination_async::write_batch() {
+    const char* data = batch_.data();
+    auto remaining = batch_.size();
+    while (remaining > 0) {
+        auto written = ::write(fd_, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nowhere left to report a failing log sink; discard the batch.
+            break;
+        }
+        data += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+    batch_.clear();
+    written_.store(dequeue_pos_, std::memory_order_release);
+}
+
+}  // namespace logging
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "logging/logging.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <source_location>
+#include <string>
+#include <thread>
+
+namespace logging {
+
+// What emit() does when the ring is full.
+enum class overflow_policy : uint8_t {
+    drop,   // discard the record and count it in dropped()
+    block   // spin until the writer frees a slot
+};
+
+// Destination that never performs I/O on the calling thread. Records are
+// copied into a preallocated lock-free ring and written to a file descriptor
+// in batches by a dedicated writer thread. Calls whose arguments can be
+// captured by value are not even formatted on the calling thread: the
+// serialized arguments go into the ring and are formatted by the writer.
+class log_destination_async final : public log_destination {
+public:
+    struct options {
+        std::size_t capacity_{1024};   // rounded up to a power of two
+        overflow_policy overflow_{overflow_policy::drop};
+    };
+
+    // fd is not owned and must outlive the destination.
+    explicit log_destination_async(int fd);
+    log_destination_async(int fd, options opts);
+
+    log_destination_async(const log_destination_async&) = delete;
+    log_destination_async& operator=(const log_destination_async&) = delete;
+    log_destination_async(log_destination_async&&) = delete;
+    log_destination_async& operator=(log_destination_async&&) = delete;
+
+    // Writes out everything still queued before returning.
+    ~log_destination_async() override;
+
+    void emit(const log_record& record) override;
+    [[nodiscard]] bool defers_formatting() const override;
+    void emit_deferred(const deferred_record& record) override;
+
+    // Blocks until every record emitted before the call has been written.
+    void flush();
+
+    [[nodiscard]] std::uint64_t dropped() const;
+
+    // Messages longer than this do not fit a slot inline and are copied
+    // into the slot's heap-backed overflow string instead.
+    static constexpr std::size_t max_message_size{max_deferred_args_size};
+
+private:
+    struct slot {
+        std::atomic<std::size_t> sequence_{0};
+        severity level_{};
+        clock::time_point timestamp_;
+        std::source_location location_;
+        // Set for deferred records, in which case message_ holds the
+        // serialized arguments rather than the formatted text.
+        deferred_formatter formatter_{nullptr};
+        std::string_view format_;
+        std::uint16_t length_{0};
+        std::array<char, max_message_size> message_{};
+        // Holds eagerly formatted messages longer than message_; cleared
+        // by the writer but keeps its capacity for the next oversize one.
+        std::string oversize_;
+    };
+
+    // Returns nullptr when the record is dropped.
+    [[nodiscard]] slot* claim_slot(std::size_t& pos);
+    void publish_slot(slot& target, std::size_t pos);
+    void wake_writer();
+    void run();
+    std::size_t drain();
+    void write_batch();
+
+    static constexpr std::size_t cache_line{64};
+    static constexpr std::size_t batch_size{64 * 1024};
+
+    int fd_;
+    overflow_policy overflow_;
+    std::size_t mask_;
+    std::unique_ptr<slot[]> slots_; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+    alignas(cache_line) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(cache_line) std::atomic<std::size_t> written_{0};
+    std::size_t dequeue_pos_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint32_t> wake_{0};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> stopping_{false};
+    std::string batch_;
+    std::string scratch_;
+    std::thread writer_;
+};
+
+}  // namespace logging
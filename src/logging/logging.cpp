@@ -3,14 +3,215 @@
 #include <fmt/chrono.h>
 #include <fmt/core.h>
 
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
 #include <iterator>
-#include <filesystem>
+#include <map>
+#include <mutex>
+#include <vector>
 
 namespace logging {
 
+namespace {
+
+template <typename OutputIt>
+OutputIt format_record_to(OutputIt out, const log_record& record) {
+    return fmt::format_to(
+        out,
+        "{:%T} {} {}:{} - {}\n",
+        record.timestamp(),
+        record.level(),
+        record.source_file(),
+        record.location().line(),
+        record.message());
+}
+
+// Owns every log_module, and caches the mapping from source_location file
+// name pointers (one per translation unit and file) to modules in a small
+// lock-free open addressed table.
+class module_registry {
+public:
+    static module_registry& instance() {
+        static module_registry registry;
+        return registry;
+    }
+
+    log_module& lookup(const char* file) {
+        const auto start = slot_for(file);
+        for (std::size_t i = 0; i < cache_size; ++i) {
+            const auto& entry = cache_.at((start + i) & (cache_size - 1));
+            const auto* key = entry.file_.load(std::memory_order_acquire);
+            if (key == file) {
+                return *entry.module_.load(std::memory_order_relaxed);
+            }
+            if (key == nullptr) {
+                break;
+            }
+        }
+        return insert(file);
+    }
+
+    log_module& find_or_create(std::string_view name) {
+        std::lock_guard lock(mutex_);
+        return find_or_create_locked(name);
+    }
+
+private:
+    static constexpr std::size_t cache_size{256};
+
+    struct cache_entry {
+        std::atomic<const char*> file_{nullptr};
+        std::atomic<log_module*> module_{nullptr};
+    };
+
+    static std::size_t slot_for(const char* file) {
+        auto bits = reinterpret_cast<std::uintptr_t>(file); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+        return static_cast<std::size_t>((bits * 0x9E3779B97F4A7C15ULL) >> (64 - std::bit_width(cache_size - 1)));
+    }
+
+    static std::string_view module_name(std::string_view file) {
+        if (auto pos = file.find_last_of("/\\"); pos != std::string_view::npos) {
+            file.remove_prefix(pos + 1);
+        }
+        if (auto pos = file.find('.'); pos != std::string_view::npos) {
+            file = file.substr(0, pos);
+        }
+        return file;
+    }
+
+    log_module& find_or_create_locked(std::string_view name) {
+        auto it = modules_.find(name);
+        if (it == modules_.end()) {
+            it = modules_.emplace(std::string(name), std::make_unique<log_module>(std::string(name))).first;
+        }
+        return *it->second;
+    }
+
+    log_module& insert(const char* file) {
+        std::lock_guard lock(mutex_);
+        auto& module = find_or_create_locked(module_name(file));
+        const auto start = slot_for(file);
+        for (std::size_t i = 0; i < cache_size; ++i) {
+            auto& entry = cache_.at((start + i) & (cache_size - 1));
+            const auto* key = entry.file_.load(std::memory_order_relaxed);
+            if (key == file) {
+                break;
+            }
+            if (key == nullptr) {
+                entry.module_.store(&module, std::memory_order_relaxed);
+                entry.file_.store(file, std::memory_order_release);
+                break;
+            }
+        }
+        // A full cache only costs the lock on later lookups.
+        return module;
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<log_module>, std::less<>> modules_;
+    std::array<cache_entry, cache_size> cache_{};
+};
+
+}  // namespace
+
+std::optional<severity> parse_severity(std::string_view text) {
+    using enum severity;
+    if (text == "debug" || text == "DBG") {
+        return debug;
+    }
+    if (text == "info" || text == "INF") {
+        return info;
+    }
+    if (text == "warning" || text == "WRN") {
+        return warning;
+    }
+    if (text == "error" || text == "ERR") {
+        return error;
+    }
+    return std::nullopt;
+}
+
+log_module::log_module(std::string name)
+  : name_(std::move(name))
+{}
+
+std::string_view log_module::name() const {
+    return name_;
+}
+
+std::optional<severity> log_module::level() const {
+    auto value = override_.load(std::memory_order_relaxed);
+    if (value == no_override) {
+        return std::nullopt;
+    }
+    return static_cast<severity>(value);
+}
+
+void log_module::set_level(std::optional<severity> level) {
+    override_.store(level ? static_cast<uint8_t>(*level) : no_override, std::memory_order_relaxed);
+}
+
+void format_record(std::string& out, const log_record& record) {
+    format_record_to(std::back_inserter(out), record);
+}
+
 log_destination::~log_destination() = default;
 
+bool log_destination::defers_formatting() const {
+    return false;
+}
+
+void log_destination::emit_deferred(const deferred_record& record) {
+    thread_local std::string message;
+    message.clear();
+    record.format_message(message);
+    emit(log_record{record.level(), record.timestamp(), message, record.location()});
+}
+
+deferred_record::deferred_record(severity level,
+                                 std::string_view format,
+                                 deferred_formatter formatter,
+                                 std::span<const std::byte> args,
+                                 std::source_location location)
+  : level_(level)
+  , timestamp_(clock::now())
+  , format_(format)
+  , formatter_(formatter)
+  , args_(args)
+  , location_(location)
+{}
+
+severity deferred_record::level() const {
+    return level_;
+}
+
+clock::time_point deferred_record::timestamp() const {
+    return timestamp_;
+}
+
+std::string_view deferred_record::format() const {
+    return format_;
+}
+
+deferred_formatter deferred_record::formatter() const {
+    return formatter_;
+}
+
+std::span<const std::byte> deferred_record::args() const {
+    return args_;
+}
+
+const std::source_location& deferred_record::location() const {
+    return location_;
+}
+
+void deferred_record::format_message(std::string& out) const {
+    formatter_(out, format_, args_.data());
+}
+
 log_destination_ostream::log_destination_ostream(std::ostream& stream)
 : stream_(stream)
 {}
@@ -18,21 +219,21 @@ log_destination_ostream::log_destination_ostream(std::ostream& stream)
 void log_destination_ostream::emit(const log_record& record) {
     // use ostreambuf iterator to bypass the ostreams formatting,
     // which is slow and redundant
-    fmt::format_to(
-        std::ostreambuf_iterator<char>(stream_),
-        "{:%T} {} {}:{} - {}\n",
-        record.timestamp(),
-        record.level(),
-        record.source_file(),
-        record.location().line(),
-        record.message());
+    format_record_to(std::ostreambuf_iterator<char>(stream_), record);
 }
 
 log_record::log_record(severity level,
                        std::string_view message,
                        std::source_location location)
+  : log_record(level, clock::now(), message, location)
+{}
+
+log_record::log_record(severity level,
+                       clock::time_point timestamp,
+                       std::string_view message,
+                       std::source_location location)
   : level_(level)
-  , timestamp_(clock::now())
+  , timestamp_(timestamp)
   , message_(message)
   , location_(location)
 {}
@@ -70,21 +271,53 @@ thread_local std::string logger::buffer_ = [] {
 logger::logger(severity min_level,
     log_destination_ptr&& default_dest,
     std::initializer_list<std::pair<severity, log_destination_ptr>> level_dests)
+  : min_level_(min_level)
 {
+    // Every level gets a destination, even below min_level, so that module
+    // overrides can enable more verbose logging at runtime.
     destinations_.push_back(std::move(default_dest));
-    for (auto& dest : level_destinations_) {
-        const auto level = static_cast<severity>(
-            std::distance(level_destinations_.begin(), &dest));
-        if (level < min_level) {
-            continue;
-        }
-        dest = destinations_.back().get();
-    }
+    level_destinations_.fill(destinations_.back().get());
 
     for (auto&& [level, dest] : level_dests) {
         destinations_.push_back(dest);
         level_destinations_.at(static_cast<std::size_t>(level)) = destinations_.back().get();
     }
+
+    for (std::size_t i = 0; i < level_destinations_.size(); ++i) {
+        deferred_levels_.at(i) = level_destinations_.at(i) && level_destinations_.at(i)->defers_formatting();
+    }
+}
+
+logger::logger(const logger& other)
+  : min_level_(other.min_level())
+  , level_destinations_(other.level_destinations_)
+  , deferred_levels_(other.deferred_levels_)
+  , destinations_(other.destinations_)
+{}
+
+logger& logger::operator=(const logger& other) {
+    if (this != &other) {
+        set_min_level(other.min_level());
+        level_destinations_ = other.level_destinations_;
+        deferred_levels_ = other.deferred_levels_;
+        destinations_ = other.destinations_;
+    }
+    return *this;
+}
+
+logger::logger(logger&& other) noexcept
+  : min_level_(other.min_level())
+  , level_destinations_(other.level_destinations_)
+  , deferred_levels_(other.deferred_levels_)
+  , destinations_(std::move(other.destinations_))
+{}
+
+logger& logger::operator=(logger&& other) noexcept {
+    set_min_level(other.min_level());
+    level_destinations_ = other.level_destinations_;
+    deferred_levels_ = other.deferred_levels_;
+    destinations_ = std::move(other.destinations_);
+    return *this;
 }
 
 logger& logger::get_default() {
@@ -98,8 +331,52 @@ logger& logger::get_default() {
 }
 
 logger& logger::get_instance(const std::source_location& /*location*/) {
-    // TODO use location to create per-module loggers
+    // Modules share the default logger's destinations; per-module levels
+    // are applied through get_module().
     return get_default();
 }
 
+log_module& logger::get_module(const std::source_location& location) {
+    return module_registry::instance().lookup(location.file_name());
+}
+
+void logger::set_module_level(std::string_view name, std::optional<severity> level) {
+    module_registry::instance().find_or_create(name).set_level(level);
+}
+
+bool logger::apply_level_spec(std::string_view spec) {
+    struct item {
+        std::string_view module_;
+        std::optional<severity> level_;
+    };
+    std::vector<item> items;
+
+    while (!spec.empty()) {
+        auto comma = spec.find(',');
+        auto token = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view{} : spec.substr(comma + 1);
+        if (token.empty()) {
+            continue;
+        }
+
+        auto equals = token.find('=');
+        auto level_text = equals == std::string_view::npos ? token : token.substr(equals + 1);
+        auto module = equals == std::string_view::npos ? std::string_view{} : token.substr(0, equals);
+        auto level = parse_severity(level_text);
+        if (!level && (module.empty() || level_text != "default")) {
+            return false;
+        }
+        items.push_back({module, level});
+    }
+
+    for (const auto& [module, level] : items) {
+        if (module.empty()) {
+            get_default().set_min_level(*level);
+        } else {
+            set_module_level(module, level);
+        }
+    }
+    return true;
+}
+
 }  // namespace logging
@@ -3,13 +3,20 @@
 #include <fmt/core.h>
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <memory>
+#include <optional>
 #include <source_location>
 #include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -28,6 +35,18 @@ constexpr size_t max_enum_value(severity /*unused*/) {
     return static_cast<size_t>(severity::error);
 }
 
+#ifndef HEOS2MQTT_MIN_LOG_LEVEL
+#define HEOS2MQTT_MIN_LOG_LEVEL debug
+#endif
+
+// Log calls below this level are removed at compile time, set through the
+// HEOS2MQTT_MIN_LOG_LEVEL CMake option. Runtime levels only filter above it.
+inline constexpr severity compile_time_min_level = severity::HEOS2MQTT_MIN_LOG_LEVEL;
+
+// Accepts "debug", "info", "warning" and "error", or the three letter
+// abbreviations used in log output.
+std::optional<severity> parse_severity(std::string_view text);
+
 }
 namespace fmt {
 template <> struct formatter<logging::severity>: formatter<string_view> {
@@ -56,6 +75,11 @@ public:
         severity level,
         std::string_view message,
         std::source_location location);
+    log_record(
+        severity level,
+        clock::time_point timestamp,
+        std::string_view message,
+        std::source_location location);
 
     [[nodiscard]] severity level() const;
     [[nodiscard]] clock::time_point timestamp() const;
@@ -70,6 +94,113 @@ private:
     std::source_location location_;
 };
 
+// Appends the standard single-line rendering of record, including the
+// trailing newline, to out.
+void format_record(std::string& out, const log_record& record);
+
+// Argument types that a log call may capture by value and format later on a
+// destination's writer thread. Specialize for trivially copyable types that
+// do not refer to memory owned by the caller.
+template <typename T>
+struct is_deferrable : std::bool_constant<std::is_arithmetic_v<T> || std::is_enum_v<T>> {};
+
+// Upper bound on the serialized arguments of a deferred log call; larger
+// calls are formatted immediately instead.
+inline constexpr std::size_t max_deferred_args_size{480};
+
+using deferred_formatter = void (*)(std::string& out, std::string_view format, const std::byte* args);
+
+// A log call whose arguments were serialized rather than formatted. The
+// format string is the compile-time checked literal, so it outlives the call.
+class deferred_record {
+public:
+    deferred_record(
+        severity level,
+        std::string_view format,
+        deferred_formatter formatter,
+        std::span<const std::byte> args,
+        std::source_location location);
+
+    [[nodiscard]] severity level() const;
+    [[nodiscard]] clock::time_point timestamp() const;
+    [[nodiscard]] std::string_view format() const;
+    [[nodiscard]] deferred_formatter formatter() const;
+    [[nodiscard]] std::span<const std::byte> args() const;
+    [[nodiscard]] const std::source_location& location() const;
+
+    void format_message(std::string& out) const;
+
+private:
+    severity level_;
+    clock::time_point timestamp_;
+    std::string_view format_;
+    deferred_formatter formatter_;
+    std::span<const std::byte> args_;
+    std::source_location location_;
+};
+
+namespace detail {
+
+// Strings are copied into the record and come back as string_views into it.
+template <typename T>
+inline constexpr bool is_string_like_v = std::is_convertible_v<const T&, std::string_view>;
+
+template <typename T>
+concept deferrable_arg = is_string_like_v<T> ||
+    (is_deferrable<T>::value && std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+
+template <typename T>
+using stored_arg_t = std::conditional_t<is_string_like_v<T>, std::string_view, T>;
+
+template <typename T>
+std::size_t packed_size(const T& value) {
+    if constexpr (is_string_like_v<T>) {
+        return sizeof(std::size_t) + std::string_view(value).size();
+    } else {
+        return sizeof(T);
+    }
+}
+
+template <typename T>
+std::byte* pack_arg(std::byte* out, const T& value) {
+    if constexpr (is_string_like_v<T>) {
+        std::string_view text(value);
+        auto size = text.size();
+        std::memcpy(out, &size, sizeof(size));
+        std::memcpy(out + sizeof(size), text.data(), size);
+        return out + sizeof(size) + size;
+    } else {
+        std::memcpy(out, &value, sizeof(T));
+        return out + sizeof(T);
+    }
+}
+
+template <typename T>
+const std::byte* unpack_arg(const std::byte* in, stored_arg_t<T>& value) {
+    if constexpr (is_string_like_v<T>) {
+        std::size_t size = 0;
+        std::memcpy(&size, in, sizeof(size));
+        in += sizeof(size);
+        value = std::string_view(reinterpret_cast<const char*>(in), size); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+        return in + size;
+    } else {
+        std::memcpy(&value, in, sizeof(T));
+        return in + sizeof(T);
+    }
+}
+
+template <typename... Args>
+void format_packed(std::string& out, std::string_view format, const std::byte* in) {
+    std::tuple<stored_arg_t<Args>...> values;
+    std::apply([&](auto&... value) {
+        ((in = unpack_arg<Args>(in, value)), ...);
+        fmt::vformat_to(std::back_inserter(out), fmt::string_view(format.data(), format.size()),
+                        fmt::make_format_args(value...));
+    }, values);
+}
+
+}  // namespace detail
+
 class log_destination {
 public:
     log_destination() = default;
@@ -81,6 +212,13 @@ public:
 
     virtual ~log_destination();
     virtual void emit(const log_record& record) = 0;
+
+    // Destinations that format on another thread return true to receive
+    // emit_deferred() for calls whose arguments can all be captured.
+    [[nodiscard]] virtual bool defers_formatting() const;
+
+    // Default formats the message on the calling thread and calls emit().
+    virtual void emit_deferred(const deferred_record& record);
 };
 
 class log_destination_ostream final : public log_destination {
@@ -98,31 +236,110 @@ private:
     std::ostream& stream_;
 };
 
+// The log calls made from one source file. A module's name is the file's
+// base name without extension, e.g. "ssdp_resolver". Each module may override
+// the logger's minimum level at runtime.
+class log_module {
+public:
+    explicit log_module(std::string name);
+
+    log_module(const log_module&) = delete;
+    log_module& operator=(const log_module&) = delete;
+    log_module(log_module&&) = delete;
+    log_module& operator=(log_module&&) = delete;
+    ~log_module() = default;
+
+    [[nodiscard]] std::string_view name() const;
+
+    // The override for this module, or nullopt to follow the logger.
+    [[nodiscard]] std::optional<severity> level() const;
+    void set_level(std::optional<severity> level);
+
+    [[nodiscard]] bool enabled(severity level, severity logger_level) const {
+        auto override_level = override_.load(std::memory_order_relaxed);
+        auto threshold = override_level == no_override ? logger_level : static_cast<severity>(override_level);
+        return level >= threshold;
+    }
+
+private:
+    static constexpr uint8_t no_override{0xff};
+
+    std::string name_;
+    std::atomic<uint8_t> override_{no_override};
+};
+
 class logger {
 public:
     static logger& get_instance(const std::source_location& location);
 
     static logger& get_default();
 
+    // Returns the module for the call site's source file. The lookup is
+    // cached by file name pointer, so only the first call from each
+    // translation unit takes a lock.
+    static log_module& get_module(const std::source_location& location);
+
+    // Sets or clears (nullopt) the level override for the named module. The
+    // module need not have logged anything yet.
+    static void set_module_level(std::string_view name, std::optional<severity> level);
+
+    // Applies a comma separated list of "level" (the default logger's
+    // minimum level) and "module=level" items, where level may also be
+    // "default" to clear a module override. Returns false, changing nothing,
+    // if any item is malformed.
+    static bool apply_level_spec(std::string_view spec);
+
     using log_destination_ptr = std::shared_ptr<log_destination>;
 
     logger(severity min_level, log_destination_ptr&& default_dest,
         std::initializer_list<std::pair<severity, log_destination_ptr>> level_dests = {});
-    logger(const logger&) = default;
-    logger& operator=(const logger&) = default;
-    logger(logger&&) noexcept = default;
-    logger& operator=(logger&&) noexcept = default;
+    logger(const logger& other);
+    logger& operator=(const logger& other);
+    logger(logger&& other) noexcept;
+    logger& operator=(logger&& other) noexcept;
     ~logger() = default;
 
+    [[nodiscard]] severity min_level() const {
+        return min_level_.load(std::memory_order_relaxed);
+    }
+    void set_min_level(severity level) {
+        min_level_.store(level, std::memory_order_relaxed);
+    }
+
     template <severity Level, typename... Args>
     static void log(std::integral_constant<severity, Level> level, const std::source_location& location, fmt::format_string<Args...> format, Args&&... args) {
-        auto* dest = get_instance(location).get_destination_for_level(level);
-        if (!dest) {
-            return;
+        if constexpr (Level >= compile_time_min_level) {
+            auto& instance = get_instance(location);
+            if (!get_module(location).enabled(Level, instance.min_level())) {
+                return;
+            }
+            auto* dest = instance.get_destination_for_level(level);
+            if (!dest) {
+                return;
+            }
+            if constexpr ((detail::deferrable_arg<std::remove_cvref_t<Args>> && ...)) {
+                if (instance.deferred_levels_[static_cast<std::size_t>(Level)]) {
+                    const auto size = (std::size_t{0} + ... + detail::packed_size(args));
+                    if (size <= max_deferred_args_size) {
+                        std::array<std::byte, max_deferred_args_size> packed; // NOLINT(cppcoreguidelines-pro-type-member-init)
+                        [[maybe_unused]] auto* out = packed.data();
+                        ((out = detail::pack_arg(out, args)), ...);
+                        const fmt::string_view view = format;
+                        dest->emit_deferred(deferred_record{
+                            level,
+                            std::string_view(view.data(), view.size()),
+                            &detail::format_packed<std::remove_cvref_t<Args>...>,
+                            std::span<const std::byte>(packed.data(), size),
+                            location});
+                        return;
+                    }
+                }
+            }
+            buffer_.clear();
+            fmt::format_to(std::back_inserter(buffer_), format, std::forward<Args>(args)...);
+            log_record record {level, buffer_, location};
+            dest->emit(record);
         }
-        buffer_ = fmt::format(format, std::forward<Args>(args)...);
-        log_record record {level, buffer_, location};
-        dest->emit(record);
     }
 
     template <severity Level>
@@ -131,7 +348,9 @@ public:
     }
 
 private:
+    std::atomic<severity> min_level_;
     std::array<log_destination*, max_enum_value(severity{}) + 1> level_destinations_{};
+    std::array<bool, max_enum_value(severity{}) + 1> deferred_levels_{};
     std::vector<log_destination_ptr> destinations_;
     thread_local static std::string buffer_;
 };
@@ -1,14 +1,33 @@
+#include "cli_options.hpp"
 #include "heos_client.hpp"
+#include "heos_line.hpp"
+#include "line_capture.hpp"
+#include "logging/async_destination.hpp"
+#include "logging/logging.hpp"
+#include "metrics/metrics.hpp"
+#include "metrics_server.hpp"
 #include "mqtt_publisher.hpp"
+#include "mqtt_transport.hpp"
 
 #include <boost/asio.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <unistd.h>
+
+#include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
+#include <vector>
 
 namespace {
 
@@ -17,13 +36,39 @@ struct options {
     std::string heos_port{"1255"};
     std::string mqtt_host{"127.0.0.1"};
     std::string mqtt_port{"1883"};
+    std::string mqtt_transport{"tcp"};
+    std::string mqtt_ca{};
+    std::string mqtt_ws_path{"/mqtt"};
+    bool mqtt_insecure{false};
+    std::string mqtt_backlog{"10000"};
+    std::string mqtt_in_flight{"32"};
+    std::string client_id{};
+    std::string session_expiry{"3600"};
     std::string base_topic{"heos"};
+    std::string threads{"1"};
+    std::string log_overflow{"drop"};
+    std::string metrics_port{};
+    std::string metrics_interval{"60"};
+    std::string record{};
+    std::string replay{};
+    std::string speed{"1x"};
+    std::vector<std::string> drop{};
+    std::string max_line_size{};
+    std::vector<std::string> ssdp_interfaces{};
+    std::string probe_cidr{};
+    bool trace_property{false};
 };
 
 void print_usage(const char* name) {
     fmt::print(
-        "Usage: {} [--heos-host HOST] [--heos-port PORT] [--mqtt-host HOST] "
-        "[--mqtt-port PORT] [--base-topic TOPIC]\n",
+        "Usage: {} [--heos-host HOST] [--heos-port PORT] [--mqtt-host HOST[:PORT]|unix:///PATH[,...]] "
+        "[--mqtt-port PORT] [--mqtt-transport tcp|tls|ws|wss] [--mqtt-ca FILE] [--mqtt-insecure] "
+        "[--mqtt-ws-path PATH] [--mqtt-backlog LINES] [--mqtt-in-flight N] [--client-id ID] [--session-expiry SECONDS] "
+        "[--base-topic TOPIC] [--threads N] [--log-overflow drop|block] "
+        "[--metrics-port PORT] [--metrics-interval SECONDS] [--trace-property] "
+        "[--record FILE] [--replay FILE [--speed Nx|max]] [--drop COMMAND[@PID]]... "
+        "[--max-line-size BYTES] [--ssdp-interface NAME|all]... "
+        "[--probe-cidr CIDR]\n",
         name);
 }
 
@@ -47,8 +92,48 @@ options parse_args(int argc, char** argv) {
             pop_value(opts.mqtt_host);
         } else if (arg == "--mqtt-port") {
             pop_value(opts.mqtt_port);
+        } else if (arg == "--mqtt-transport") {
+            pop_value(opts.mqtt_transport);
+        } else if (arg == "--mqtt-ca") {
+            pop_value(opts.mqtt_ca);
+        } else if (arg == "--mqtt-ws-path") {
+            pop_value(opts.mqtt_ws_path);
+        } else if (arg == "--mqtt-insecure") {
+            opts.mqtt_insecure = true;
+        } else if (arg == "--mqtt-backlog") {
+            pop_value(opts.mqtt_backlog);
+        } else if (arg == "--mqtt-in-flight") {
+            pop_value(opts.mqtt_in_flight);
+        } else if (arg == "--client-id") {
+            pop_value(opts.client_id);
+        } else if (arg == "--session-expiry") {
+            pop_value(opts.session_expiry);
         } else if (arg == "--base-topic") {
             pop_value(opts.base_topic);
+        } else if (arg == "--threads") {
+            pop_value(opts.threads);
+        } else if (arg == "--log-overflow") {
+            pop_value(opts.log_overflow);
+        } else if (arg == "--metrics-port") {
+            pop_value(opts.metrics_port);
+        } else if (arg == "--metrics-interval") {
+            pop_value(opts.metrics_interval);
+        } else if (arg == "--record") {
+            pop_value(opts.record);
+        } else if (arg == "--replay") {
+            pop_value(opts.replay);
+        } else if (arg == "--speed") {
+            pop_value(opts.speed);
+        } else if (arg == "--max-line-size") {
+            pop_value(opts.max_line_size);
+        } else if (arg == "--ssdp-interface") {
+            pop_value(opts.ssdp_interfaces.emplace_back());
+        } else if (arg == "--probe-cidr") {
+            pop_value(opts.probe_cidr);
+        } else if (arg == "--drop") {
+            pop_value(opts.drop.emplace_back());
+        } else if (arg == "--trace-property") {
+            opts.trace_property = true;
         } else if (arg == "--help" || arg == "-h") {
             print_usage(argv[0]);
             std::exit(EXIT_SUCCESS);
@@ -65,33 +150,286 @@ options parse_args(int argc, char** argv) {
 
 int main(int argc, char** argv) {
     auto opts = parse_args(argc, argv);
+    auto replay_speed = heos2mqtt::detail::parse_replay_speed(opts.speed);
+    if (!replay_speed) {
+        fmt::print(stderr, "Invalid --speed '{}'\n", opts.speed);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::optional<unsigned long> max_line_size;
+    if (!opts.max_line_size.empty()) {
+        max_line_size = heos2mqtt::parse_count(opts.max_line_size, heos2mqtt::detail::min_max_line_size, 1UL << 30);
+        if (!max_line_size) {
+            fmt::print(stderr, "Invalid --max-line-size '{}', expected {} to {}\n", opts.max_line_size,
+                heos2mqtt::detail::min_max_line_size, 1UL << 30);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    auto mqtt_transport = heos2mqtt::parse_mqtt_transport(opts.mqtt_transport);
+    if (!mqtt_transport) {
+        fmt::print(stderr, "Invalid --mqtt-transport '{}'\n", opts.mqtt_transport);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts.log_overflow != "drop" && opts.log_overflow != "block") {
+        fmt::print(stderr, "Invalid --log-overflow '{}', expected drop or block\n", opts.log_overflow);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    auto metrics_interval = heos2mqtt::parse_count(opts.metrics_interval, 0, 86400);
+    if (!metrics_interval) {
+        fmt::print(stderr, "Invalid --metrics-interval '{}', expected 0 to 86400\n", opts.metrics_interval);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    auto mqtt_backlog = heos2mqtt::parse_count(opts.mqtt_backlog, 0, 10'000'000);
+    if (!mqtt_backlog) {
+        fmt::print(stderr, "Invalid --mqtt-backlog '{}', expected 0 to 10000000\n", opts.mqtt_backlog);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // Packet identifiers bound the publishes that can await PUBACK.
+    auto mqtt_in_flight = heos2mqtt::parse_count(opts.mqtt_in_flight, 1, 65535);
+    if (!mqtt_in_flight) {
+        fmt::print(stderr, "Invalid --mqtt-in-flight '{}', expected 1 to 65535\n", opts.mqtt_in_flight);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // The MQTT Session Expiry Interval is a four byte integer.
+    auto session_expiry = heos2mqtt::parse_count(opts.session_expiry, 0, UINT32_MAX);
+    if (!session_expiry) {
+        fmt::print(stderr, "Invalid --session-expiry '{}', expected 0 to {}\n", opts.session_expiry, UINT32_MAX);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::optional<unsigned long> metrics_port;
+    if (!opts.metrics_port.empty()) {
+        metrics_port = heos2mqtt::parse_count(opts.metrics_port, 1, 65535);
+        if (!metrics_port) {
+            fmt::print(stderr, "Invalid --metrics-port '{}', expected 1 to 65535\n", opts.metrics_port);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Log records are written by a background thread so a slow terminal or
+    // journald pipe cannot stall the event loop.
+    auto log_destination = std::make_shared<logging::log_destination_async>(
+        STDERR_FILENO,
+        logging::log_destination_async::options{
+            .overflow_ = opts.log_overflow == "block" ? logging::overflow_policy::block
+                                                      : logging::overflow_policy::drop});
+    logging::logger::get_default() = logging::logger(logging::severity::info, log_destination);
 
-    boost::asio::io_context io;
+    // Each device and the MQTT client run on their own strand, so any number
+    // of threads may service the io_context.
+    auto parsed_threads = heos2mqtt::parse_count(opts.threads, 1, heos2mqtt::max_thread_count());
+    if (!parsed_threads) {
+        fmt::print(stderr, "Invalid --threads '{}', expected 1 to {}\n", opts.threads, heos2mqtt::max_thread_count());
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const auto thread_count = *parsed_threads;
+    boost::asio::io_context io(static_cast<int>(thread_count));
     auto work_guard = boost::asio::make_work_guard(io);
 
-    heos2mqtt::mqtt_publisher publisher(io, opts.mqtt_host, opts.mqtt_port, opts.base_topic);
-    auto heos_port = static_cast<boost::asio::ip::port_type>(std::stoul(opts.heos_port));
-    heos2mqtt::heos_client client("HEOS",
-        io, opts.heos_host, heos_port,
-        [&publisher](std::string line) { publisher.publish_raw(std::move(line)); });
+    heos2mqtt::mqtt_transport_options transport;
+    transport.transport_ = *mqtt_transport;
+    transport.ca_file_ = opts.mqtt_ca;
+    transport.verify_peer_ = !opts.mqtt_insecure;
+    transport.websocket_path_ = opts.mqtt_ws_path;
+    heos2mqtt::mqtt_publisher publisher(io, opts.mqtt_host, opts.mqtt_port, opts.base_topic, transport);
+    publisher.set_metrics_interval(std::chrono::seconds(*metrics_interval));
+    publisher.set_trace_property(opts.trace_property);
+    publisher.set_backlog_limit(*mqtt_backlog);
+    publisher.set_in_flight_limit(*mqtt_in_flight);
+    if (!opts.client_id.empty()) {
+        publisher.set_client_id(opts.client_id);
+    }
+    publisher.set_session_expiry(std::chrono::seconds(*session_expiry));
+    publisher.set_control_handler([](std::string_view command, std::string_view payload) {
+        if (command == "log_level") {
+            if (logging::logger::apply_level_spec(payload)) {
+                logging::info("log levels set to '{}'", payload);
+                if (logging::compile_time_min_level > logging::severity::debug) {
+                    logging::warning("levels below {} are compiled out of this build",
+                        logging::compile_time_min_level);
+                }
+            } else {
+                logging::warning("ignoring malformed log level spec '{}'", payload);
+            }
+        }
+    });
+
+    heos2mqtt::command_counters command_counts;
+    heos2mqtt::line_filter filter;
+    try {
+        for (const auto& rule : opts.drop) {
+            filter.add_drop(rule);
+        }
+    } catch (const std::invalid_argument& e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::optional<heos2mqtt::line_recorder> recorder;
+    if (!opts.record.empty()) {
+        recorder.emplace(opts.record);
+    }
+    auto handle_line = [&publisher, &recorder, &command_counts, &filter](std::string line,
+                                                                         heos2mqtt::line_trace trace) {
+        if (recorder) {
+            recorder->record(line, trace);
+        }
+        // Pieces of an over-long line are neither counted nor filtered,
+        // so a line is never half dropped. They share one priority so they
+        // stay in order.
+        auto priority = heos2mqtt::publish_priority::metadata;
+        if (!trace.fragmented()) {
+            priority = heos2mqtt::command_priority(command_counts.count(line));
+            if (!filter.accepts(line)) {
+                return;
+            }
+        }
+        publisher.publish_raw(std::move(line), trace, priority);
+    };
+
+    // Lines come either from the HEOS device or from a capture file; both
+    // feed the same handler.
+    std::optional<heos2mqtt::heos_client> client;
+    std::optional<heos2mqtt::line_replayer> replayer;
+    // A replay starts once the broker is connected and counts as complete
+    // when the last line is acknowledged, so --speed max measures
+    // publishing rather than the hand-off to the publisher.
+    auto& published_total = metrics::registry::get_default().add_counter(
+        "mqtt_published_total", "Messages acknowledged by the broker");
+    std::uint64_t published_before = 0;
+    heos2mqtt::line_trace::clock::time_point replay_started;
+    if (opts.replay.empty()) {
+        auto heos_port = static_cast<boost::asio::ip::port_type>(std::stoul(opts.heos_port));
+        client.emplace("HEOS", io, opts.heos_host, heos_port, handle_line);
+        client->set_description_cache(std::make_shared<heos2mqtt::description_cache>(io));
+        if (max_line_size) {
+            client->set_max_line_size(*max_line_size);
+        }
+        if (!opts.ssdp_interfaces.empty()) {
+            auto interfaces = heos2mqtt::multicast_interfaces();
+            if (std::find(opts.ssdp_interfaces.begin(), opts.ssdp_interfaces.end(), "all") == opts.ssdp_interfaces.end()) {
+                std::erase_if(interfaces, [&](const heos2mqtt::ssdp_interface& iface) {
+                    return std::find(opts.ssdp_interfaces.begin(), opts.ssdp_interfaces.end(), iface.name_) ==
+                           opts.ssdp_interfaces.end();
+                });
+            }
+            if (interfaces.empty()) {
+                fmt::print(stderr, "No multicast interface matches --ssdp-interface\n");
+                return EXIT_FAILURE;
+            }
+            client->set_ssdp_interfaces(std::move(interfaces));
+        }
+        if (!opts.probe_cidr.empty()) {
+            auto hosts = heos2mqtt::detail::parse_cidr(opts.probe_cidr);
+            if (!hosts) {
+                fmt::print(stderr, "Invalid --probe-cidr '{}' (IPv4, /16 or smaller)\n", opts.probe_cidr);
+                return EXIT_FAILURE;
+            }
+            client->set_probe_fallback(std::move(*hosts));
+        }
+    } else {
+        replayer.emplace(io, opts.replay, *replay_speed, handle_line,
+            [&](std::size_t lines, heos2mqtt::line_trace::clock::duration /*elapsed*/) {
+                publisher.notify_when_idle([&, lines]() {
+                    const auto published = published_total.value() - published_before;
+                    auto seconds = std::chrono::duration<double>(
+                        heos2mqtt::line_trace::clock::now() - replay_started).count();
+                    fmt::print("Replay complete: {} of {} lines published in {:.3f}s ({:.0f} lines/s)\n",
+                               published, lines, seconds,
+                               seconds > 0 ? static_cast<double>(published) / seconds : 0.0);
+                });
+            });
+    }
+
+    // SIGUSR1 toggles debug logging for every module without an override.
+    boost::asio::signal_set level_signal(io, SIGUSR1);
+    std::function<void(const boost::system::error_code&, int)> toggle_debug =
+        [&](const boost::system::error_code& ec, int /*signal_number*/) {
+            if (ec) {
+                return;
+            }
+            auto& log = logging::logger::get_default();
+            auto level = log.min_level() == logging::severity::debug ? logging::severity::info
+                                                                     : logging::severity::debug;
+            log.set_min_level(level);
+            if (level < logging::compile_time_min_level) {
+                logging::warning("default log level is now {}, but this build compiles out levels below {}",
+                    level, logging::compile_time_min_level);
+            } else {
+                logging::warning("default log level is now {}", level);
+            }
+            level_signal.async_wait(toggle_debug);
+        };
+    level_signal.async_wait(toggle_debug);
+
+    std::optional<heos2mqtt::metrics_server> metrics_http;
+    if (metrics_port) {
+        metrics_http.emplace(io, boost::asio::ip::tcp::endpoint(
+            boost::asio::ip::tcp::v4(), static_cast<boost::asio::ip::port_type>(*metrics_port)));
+    }
 
     boost::asio::signal_set signals(io, SIGINT, SIGTERM);
     signals.async_wait([&](const boost::system::error_code& ec, int signal_number) {
         if (!ec) {
             fmt::print("Received signal {}. Shutting down...\n", signal_number);
-            client.stop();
+            if (client) {
+                client->stop();
+            }
+            if (replayer) {
+                replayer->stop();
+            }
             publisher.stop();
+            level_signal.cancel();
+            if (metrics_http) {
+                metrics_http->stop();
+            }
             work_guard.reset();
         }
     });
 
-    fmt::print("Starting heos2mqtt. HEOS {}:{} -> MQTT {}:{} (topic: {})\n", opts.heos_host,
-               opts.heos_port, opts.mqtt_host, opts.mqtt_port, opts.base_topic);
+    fmt::print("Starting heos2mqtt. HEOS {}:{} -> MQTT {}:{} (topic: {}, threads: {})\n",
+               opts.heos_host, opts.heos_port, opts.mqtt_host, opts.mqtt_port, opts.base_topic,
+               thread_count);
 
     publisher.start();
-    client.start();
+    if (client) {
+        client->start();
+    }
+    if (replayer) {
+        publisher.notify_when_connected([&]() {
+            published_before = published_total.value();
+            replay_started = heos2mqtt::line_trace::clock::now();
+            replayer->start();
+        });
+    }
+    if (metrics_http) {
+        metrics_http->start();
+    }
 
+    std::vector<std::thread> pool;
+    pool.reserve(thread_count - 1);
+    for (unsigned long i = 1; i < thread_count; ++i) {
+        pool.emplace_back([&io]() { io.run(); });
+    }
     io.run();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (recorder) {
+        recorder->flush();
+    }
+    log_destination->flush();
+    if (auto dropped = log_destination->dropped()) {
+        fmt::print(stderr, "Dropped {} log records\n", dropped);
+    }
     fmt::print("Clean shutdown complete.\n");
     return 0;
 }
@@ -0,0 +1,162 @@
+#include "metrics/metrics.hpp"
+
+#include <fmt/core.h>
+
+#include <iterator>
+#include <stdexcept>
+
+namespace metrics {
+
+namespace {
+
+constexpr std::array<std::string_view, 3> type_names{"counter", "gauge", "histogram"};
+
+// Prometheus and JSON both want the shortest round-tripping rendering.
+std::string format_number(double value) {
+    return fmt::format("{}", value);
+}
+
+std::string series_name(std::string_view name, std::string_view labels) {
+    if (labels.empty()) {
+        return std::string(name);
+    }
+    return fmt::format("{}{{{}}}", name, labels);
+}
+
+std::string bucket_labels(std::string_view labels, std::string_view le) {
+    if (labels.empty()) {
+        return fmt::format("le=\"{}\"", le);
+    }
+    return fmt::format("{},le=\"{}\"", labels, le);
+}
+
+}  // namespace
+
+std::string escape(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        default: out.push_back(c); break;
+        }
+    }
+    return out;
+}
+
+histogram::histogram(std::span<const double> bounds)
+  : bounds_(bounds.begin(), bounds.end())
+  , buckets_(std::make_unique<std::atomic<std::uint64_t>[]>(bounds_.size() + 1)) // NOLINT(cppcoreguidelines-avoid-c-arrays)
+{}
+
+histogram::snapshot histogram::collect() const {
+    snapshot result;
+    result.bounds_ = bounds_;
+    result.counts_.reserve(bounds_.size() + 1);
+    for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+        auto count = buckets_[i].load(std::memory_order_relaxed);
+        result.counts_.push_back(count);
+        result.count_ += count;
+    }
+    result.sum_ = sum_.load(std::memory_order_relaxed);
+    return result;
+}
+
+registry& registry::get_default() {
+    static registry instance;
+    return instance;
+}
+
+template <typename T, typename... Args>
+T& registry::add(std::string_view name, std::string_view help, std::string_view labels, Args&&... args) {
+    const auto type = metric(std::unique_ptr<T>{}).index();
+
+    std::lock_guard lock(mutex_);
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(std::string(name), family{std::string(help), type, {}}).first;
+    } else if (it->second.type_ != type) {
+        throw std::invalid_argument(fmt::format("metric '{}' is already registered as a {}",
+            name, type_names.at(it->second.type_)));
+    }
+
+    auto& series = it->second.series_;
+    auto existing = series.find(labels);
+    if (existing == series.end()) {
+        existing = series.emplace(std::string(labels), std::make_unique<T>(std::forward<Args>(args)...)).first;
+    }
+    return *std::get<std::unique_ptr<T>>(existing->second);
+}
+
+counter& registry::add_counter(std::string_view name, std::string_view help, std::string_view labels) {
+    return add<counter>(name, help, labels);
+}
+
+gauge& registry::add_gauge(std::string_view name, std::string_view help, std::string_view labels) {
+    return add<gauge>(name, help, labels);
+}
+
+histogram& registry::add_histogram(std::string_view name, std::string_view help,
+    std::span<const double> bounds, std::string_view labels) {
+    return add<histogram>(name, help, labels, bounds);
+}
+
+void registry::render_prometheus(std::string& out) const {
+    auto it = std::back_inserter(out);
+    std::lock_guard lock(mutex_);
+    for (const auto& [name, family] : families_) {
+        fmt::format_to(it, "# HELP {} {}\n# TYPE {} {}\n", name, family.help_, name, type_names.at(family.type_));
+        for (const auto& [labels, value] : family.series_) {
+            if (const auto* c = std::get_if<std::unique_ptr<counter>>(&value)) {
+                fmt::format_to(it, "{} {}\n", series_name(name, labels), (*c)->value());
+            } else if (const auto* g = std::get_if<std::unique_ptr<gauge>>(&value)) {
+                fmt::format_to(it, "{} {}\n", series_name(name, labels), (*g)->value());
+            } else {
+                auto snapshot = std::get<std::unique_ptr<histogram>>(value)->collect();
+                std::uint64_t cumulative = 0;
+                for (std::size_t i = 0; i < snapshot.counts_.size(); ++i) {
+                    cumulative += snapshot.counts_[i];
+                    auto le = i < snapshot.bounds_.size() ? format_number(snapshot.bounds_[i]) : "+Inf";
+                    fmt::format_to(it, "{}_bucket{{{}}} {}\n", name, bucket_labels(labels, le), cumulative);
+                }
+                fmt::format_to(it, "{} {}\n", series_name(fmt::format("{}_sum", name), labels),
+                    format_number(snapshot.sum_));
+                fmt::format_to(it, "{} {}\n", series_name(fmt::format("{}_count", name), labels), snapshot.count_);
+            }
+        }
+    }
+}
+
+void registry::render_json(std::string& out) const {
+    auto it = std::back_inserter(out);
+    std::lock_guard lock(mutex_);
+    out.push_back('{');
+    bool first = true;
+    for (const auto& [name, family] : families_) {
+        for (const auto& [labels, value] : family.series_) {
+            fmt::format_to(it, "{}\"{}\":", first ? "" : ",", escape(series_name(name, labels)));
+            first = false;
+            if (const auto* c = std::get_if<std::unique_ptr<counter>>(&value)) {
+                fmt::format_to(it, "{}", (*c)->value());
+            } else if (const auto* g = std::get_if<std::unique_ptr<gauge>>(&value)) {
+                fmt::format_to(it, "{}", (*g)->value());
+            } else {
+                auto snapshot = std::get<std::unique_ptr<histogram>>(value)->collect();
+                fmt::format_to(it, "{{\"count\":{},\"sum\":{},\"buckets\":{{", snapshot.count_,
+                    format_number(snapshot.sum_));
+                std::uint64_t cumulative = 0;
+                for (std::size_t i = 0; i < snapshot.counts_.size(); ++i) {
+                    cumulative += snapshot.counts_[i];
+                    auto le = i < snapshot.bounds_.size() ? format_number(snapshot.bounds_[i]) : "+Inf";
+                    fmt::format_to(it, "{}\"{}\":{}", i == 0 ? "" : ",", le, cumulative);
+                }
+                out.append("}}");
+            }
+        }
+    }
+    out.push_back('}');
+}
+
+}  // namespace metrics
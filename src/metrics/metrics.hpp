@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace metrics {
+
+// Monotonically increasing count. Updates are relaxed atomics and safe from
+// any thread.
+class counter {
+public:
+    void inc(std::uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+// Value that may go up and down, such as a queue depth or connection state.
+class gauge {
+public:
+    void set(std::int64_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+    void add(std::int64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+    void sub(std::int64_t n = 1) {
+        value_.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::int64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::int64_t> value_{0};
+};
+
+// Upper bounds, in seconds, suited to network and queueing latencies.
+inline constexpr std::array<double, 12> default_latency_buckets{
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 1.0, 10.0};
+
+// Distribution of observations over fixed buckets. Bucket counts are not
+// cumulative here; rendering accumulates them as Prometheus expects.
+class histogram {
+public:
+    explicit histogram(std::span<const double> bounds);
+
+    void observe(double value) {
+        std::size_t bucket = 0;
+        while (bucket < bounds_.size() && value > bounds_[bucket]) {
+            ++bucket;
+        }
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    template <typename Rep, typename Period>
+    void observe(std::chrono::duration<Rep, Period> elapsed) {
+        observe(std::chrono::duration<double>(elapsed).count());
+    }
+
+    struct snapshot {
+        std::vector<double> bounds_;
+        // One entry per bound plus the +Inf bucket.
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t count_{0};
+        double sum_{0};
+    };
+
+    [[nodiscard]] snapshot collect() const;
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> buckets_; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+    std::atomic<double> sum_{0};
+};
+
+// Owns every metric in the process. Registration takes a lock and is meant
+// for construction time; the returned references stay valid for the life of
+// the registry and are updated without locking.
+class registry {
+public:
+    static registry& get_default();
+
+    // Registering the same name and labels again returns the existing
+    // metric. labels is the Prometheus label list without braces, e.g.
+    // R"(device="kitchen")". Throws std::invalid_argument if the name is
+    // already registered as a different type.
+    counter& add_counter(std::string_view name, std::string_view help, std::string_view labels = {});
+    gauge& add_gauge(std::string_view name, std::string_view help, std::string_view labels = {});
+    histogram& add_histogram(std::string_view name, std::string_view help,
+        std::span<const double> bounds = default_latency_buckets, std::string_view labels = {});
+
+    // Prometheus text exposition format, version 0.0.4.
+    void render_prometheus(std::string& out) const;
+
+    // A JSON object keyed by metric name (with labels, if any). Histograms
+    // become objects holding count, sum and cumulative buckets.
+    void render_json(std::string& out) const;
+
+private:
+    using metric = std::variant<std::unique_ptr<counter>, std::unique_ptr<gauge>, std::unique_ptr<histogram>>;
+
+    struct family {
+        std::string help_;
+        std::size_t type_;
+        std::map<std::string, metric, std::less<>> series_;
+    };
+
+    template <typename T, typename... Args>
+    T& add(std::string_view name, std::string_view help, std::string_view labels, Args&&... args);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, family, std::less<>> families_;
+};
+
+// Escapes text for use inside a JSON or Prometheus label string.
+std::string escape(std::string_view text);
+
+}  // namespace metrics
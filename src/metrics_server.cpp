@@ -0,0 +1,100 @@
+#include "metrics_server.hpp"
+#include "logging/logging.hpp"
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http.hpp>
+
+#include <chrono>
+#include <string>
+#include <tuple>
+
+namespace heos2mqtt {
+
+namespace net = boost::asio;
+namespace http = boost::beast::http;
+using namespace logging;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto use_nothrow = net::as_tuple(net::use_awaitable);
+
+constexpr auto request_timeout = 5s;
+
+}  // namespace
+
+metrics_server::metrics_server(net::io_context& io, const tcp::endpoint& endpoint,
+                               metrics::registry& registry)
+  : strand_(net::make_strand(io))
+  , acceptor_(strand_, endpoint)
+  , registry_(registry)
+{}
+
+void metrics_server::start() {
+    info("metrics: listening on port {}", acceptor_.local_endpoint().port());
+    net::co_spawn(strand_, accept_loop(), net::detached);
+}
+
+void metrics_server::stop() {
+    net::dispatch(strand_, [this]() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    });
+}
+
+metrics_server::tcp::endpoint metrics_server::local_endpoint() const {
+    return acceptor_.local_endpoint();
+}
+
+net::awaitable<void> metrics_server::accept_loop() {
+    for (;;) {
+        // Each connection runs on its own strand so a slow scraper cannot
+        // hold up the acceptor.
+        auto executor = net::make_strand(strand_.get_inner_executor());
+        auto [ec, socket] = co_await acceptor_.async_accept(executor, use_nothrow);
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                warning("metrics: accept error: {}", ec.message());
+            }
+            co_return;
+        }
+        net::co_spawn(executor, serve(std::move(socket)), net::detached);
+    }
+}
+
+net::awaitable<void> metrics_server::serve(tcp::socket socket) {
+    boost::beast::flat_buffer buffer;
+    http::request<http::empty_body> request;
+
+    // One deadline for the whole exchange; the stream closes the socket
+    // when it passes, failing the pending read or write with a timeout.
+    boost::beast::tcp_stream stream(std::move(socket));
+    stream.expires_after(request_timeout);
+
+    auto [read_ec, bytes] = co_await http::async_read(stream, buffer, request, use_nothrow);
+    if (read_ec) {
+        co_return;
+    }
+
+    http::response<http::string_body> response;
+    response.version(request.version());
+    response.keep_alive(false);
+    if (request.method() != http::verb::get) {
+        response.result(http::status::method_not_allowed);
+        response.set(http::field::allow, "GET");
+    } else if (request.target() != "/metrics") {
+        response.result(http::status::not_found);
+    } else {
+        response.result(http::status::ok);
+        response.set(http::field::content_type, "text/plain; version=0.0.4");
+        registry_.render_prometheus(response.body());
+    }
+    response.prepare_payload();
+
+    std::ignore = co_await http::async_write(stream, response, use_nothrow);
+    boost::system::error_code ignored;
+    stream.socket().shutdown(tcp::socket::shutdown_send, ignored);
+}
+
+}  // namespace heos2mqtt
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "metrics/metrics.hpp"
+
+#include <boost/asio.hpp>
+
+namespace heos2mqtt {
+
+// Minimal HTTP server answering GET /metrics with the registry rendered in
+// Prometheus text format. One request per connection.
+class metrics_server {
+public:
+    using tcp = boost::asio::ip::tcp;
+
+    metrics_server(boost::asio::io_context& io, const tcp::endpoint& endpoint,
+                   metrics::registry& registry = metrics::registry::get_default());
+
+    void start();
+    void stop();
+
+    // The bound endpoint; useful when constructed with port 0.
+    [[nodiscard]] tcp::endpoint local_endpoint() const;
+
+private:
+    boost::asio::awaitable<void> accept_loop();
+    boost::asio::awaitable<void> serve(tcp::socket socket);
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    tcp::acceptor acceptor_;
+    metrics::registry& registry_;
+};
+
+}  // namespace heos2mqtt
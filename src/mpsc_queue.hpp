@@ -0,0 +1,129 @@
+#pragma once
+
+#include <boost/asio/post.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace heos2mqtt {
+
+// Unbounded multi-producer, single-consumer queue after Vyukov's node-based
+// design. push() is wait-free and may be called from any thread; try_pop()
+// must only ever be called by one consumer at a time.
+template <typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() = default;
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+    mpsc_queue(mpsc_queue&&) = delete;
+    mpsc_queue& operator=(mpsc_queue&&) = delete;
+
+    ~mpsc_queue() {
+        while (try_pop()) {
+        }
+    }
+
+    void push(T value) {
+        push_node(new node{std::move(value)});
+    }
+
+    // Returns nullopt when the queue is empty, or when a producer is midway
+    // through a push; in the latter case the producer is responsible for
+    // waking the consumer again (see handoff_queue).
+    std::optional<T> try_pop() {
+        node* tail = tail_;
+        node* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr) {
+                return std::nullopt;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            tail_ = next;
+            return take(tail);
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        push_node(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return take(tail);
+        }
+        return std::nullopt;
+    }
+
+private:
+    struct node {
+        node() = default;
+        explicit node(T value) : value_(std::move(value)) {}
+
+        std::atomic<node*> next_{nullptr};
+        std::optional<T> value_;
+    };
+
+    void push_node(node* item) {
+        item->next_.store(nullptr, std::memory_order_relaxed);
+        node* prev = head_.exchange(item, std::memory_order_acq_rel);
+        prev->next_.store(item, std::memory_order_release);
+    }
+
+    static std::optional<T> take(node* item) {
+        std::optional<T> value = std::move(item->value_);
+        delete item;
+        return value;
+    }
+
+    static constexpr std::size_t cache_line{64};
+
+    node stub_;
+    alignas(cache_line) std::atomic<node*> head_{&stub_};
+    alignas(cache_line) node* tail_{&stub_};
+};
+
+// Hands values from any number of producer threads to a consumer running on
+// a single executor (typically a strand). Producers only touch the lock-free
+// queue; at most one drain is queued on the executor at any time, so a burst
+// of pushes costs one post rather than one contended strand dispatch each.
+template <typename T, typename Executor>
+class handoff_queue {
+public:
+    using consumer_type = std::function<void(T)>;
+
+    handoff_queue(Executor executor, consumer_type consumer)
+      : executor_(std::move(executor))
+      , consumer_(std::move(consumer))
+    {}
+
+    void push(T value) {
+        queue_.push(std::move(value));
+        if (!drain_scheduled_.exchange(true)) {
+            boost::asio::post(executor_, [this]() { drain(); });
+        }
+    }
+
+private:
+    void drain() {
+        // Clear the flag before popping: a producer that pushes after this
+        // point will schedule another drain rather than relying on this one.
+        drain_scheduled_.store(false);
+        while (auto value = queue_.try_pop()) {
+            consumer_(std::move(*value));
+        }
+    }
+
+    Executor executor_;
+    consumer_type consumer_;
+    mpsc_queue<T> queue_;
+    std::atomic<bool> drain_scheduled_{false};
+};
+
+}  // namespace heos2mqtt
@@ -2,12 +2,18 @@
 
 #include <fmt/core.h>
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <chrono>
 #include <ctime>
+#include <iterator>
 #include <limits>
 #include <random>
 #include <sstream>
+#include <vector>
 
 namespace heos2mqtt {
 
@@ -15,6 +21,27 @@ using namespace std::chrono_literals;
 
 namespace {
 
+constexpr std::string_view latency_help = "Latency of each stage from HEOS read to PUBACK";
+
+// Unix socket brokers, if any are listed, decide the transport.
+mqtt_transport_options for_brokers(mqtt_transport_options options,
+                                   const std::vector<detail::broker_health>& brokers) {
+    if (std::any_of(brokers.begin(), brokers.end(),
+                    [](const detail::broker_health& broker) { return !broker.unix_path_.empty(); })) {
+        options.transport_ = mqtt_transport::unix_socket;
+    }
+    return options;
+}
+
+std::array<metrics::counter*, publish_priority_count> dropped_counters(metrics::registry& registry) {
+    std::array<metrics::counter*, publish_priority_count> counters{};
+    for (std::size_t i = 0; i < counters.size(); ++i) {
+        counters[i] = &registry.add_counter("mqtt_dropped_total", "Lines dropped from a full backlog",
+            fmt::format("priority=\"{}\"", to_string(static_cast<publish_priority>(i))));
+    }
+    return counters;
+}
+
 std::string random_id() {
     std::mt19937 rng{std::random_device{}()};
     std::uniform_int_distribution<int> dist(0, 15);
@@ -25,7 +52,17 @@ std::string random_id() {
     return oss.str();
 }
 
-std::string current_iso_timestamp() {
+}  // namespace
+
+std::string detail::default_client_id() {
+    std::array<char, 256> hostname{};
+    if (gethostname(hostname.data(), hostname.size() - 1) != 0 || hostname.front() == '\0') {
+        return fmt::format("heos2mqtt-{}", random_id());
+    }
+    return fmt::format("heos2mqtt-{}", hostname.data());
+}
+
+std::string detail::current_iso_timestamp() {
     auto now = std::chrono::system_clock::now();
     std::time_t t = std::chrono::system_clock::to_time_t(now);
     std::tm tm{};
@@ -35,7 +72,157 @@ std::string current_iso_timestamp() {
     return buffer.data();
 }
 
-}  // namespace
+std::string detail::build_payload(std::string_view line, std::string_view timestamp, const line_trace& trace) {
+    boost::json::object payload{
+        {"raw", line},
+        {"ts", timestamp},
+    };
+    if (trace.fragmented()) {
+        payload["part"] = trace.fragment_;
+        payload["more"] = trace.continued_;
+    }
+    return boost::json::serialize(payload);
+}
+
+std::string detail::build_topic(std::string_view base, std::string_view suffix) {
+    if (base.empty()) {
+        return std::string(suffix);
+    }
+    return fmt::format("{}/{}", base, suffix);
+}
+
+std::string detail::broker_health::name() const {
+    if (!unix_path_.empty()) {
+        return fmt::format("{}{}", unix_scheme, unix_path_);
+    }
+    return fmt::format("{}:{}", host_, port_);
+}
+
+void detail::broker_health::record_success(clock::duration latency) {
+    // Weight the newest sample by a quarter so one slow handshake does not
+    // reorder the brokers.
+    connect_latency_ = connect_latency_ ? (*connect_latency_ * 3 + latency) / 4 : latency;
+    failures_ = 0;
+}
+
+void detail::broker_health::record_failure(clock::time_point now) {
+    ++failures_;
+    last_failure_ = now;
+}
+
+detail::broker_health::clock::duration detail::broker_health::score(clock::time_point now) const {
+    auto result = connect_latency_.value_or(untried_latency);
+    if (failures_ > 0 && now - last_failure_ < failure_memory) {
+        result += failure_penalty * static_cast<clock::rep>(failures_);
+    }
+    return result;
+}
+
+std::vector<detail::broker_health> detail::parse_brokers(std::string_view list, std::uint16_t default_port) {
+    std::vector<broker_health> brokers;
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto entry = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        while (!entry.empty() && entry.front() == ' ') {
+            entry.remove_prefix(1);
+        }
+        while (!entry.empty() && entry.back() == ' ') {
+            entry.remove_suffix(1);
+        }
+        if (entry.empty()) {
+            continue;
+        }
+
+        broker_health broker;
+        broker.port_ = default_port;
+        if (entry.starts_with(unix_scheme)) {
+            broker.unix_path_ = std::string(entry.substr(unix_scheme.size()));
+            if (!broker.unix_path_.empty()) {
+                broker.host_ = "127.0.0.1";
+                broker.port_ = register_unix_socket(broker.unix_path_);
+                brokers.push_back(std::move(broker));
+            }
+            continue;
+        }
+        std::string_view port;
+        if (entry.front() == '[') {
+            auto bracket = entry.find(']');
+            broker.host_ = std::string(entry.substr(1, bracket == std::string_view::npos ? entry.npos : bracket - 1));
+            if (bracket != std::string_view::npos && entry.substr(bracket + 1).starts_with(':')) {
+                port = entry.substr(bracket + 2);
+            }
+        } else if (auto colon = entry.find(':'); colon != std::string_view::npos && entry.rfind(':') == colon) {
+            broker.host_ = std::string(entry.substr(0, colon));
+            port = entry.substr(colon + 1);
+        } else {
+            // A bare host, or an unbracketed IPv6 address.
+            broker.host_ = std::string(entry);
+        }
+        unsigned value = 0;
+        auto [end, ec] = std::from_chars(port.data(), port.data() + port.size(), value);
+        if (!port.empty() && ec == std::errc{} && end == port.data() + port.size() &&
+            value <= std::numeric_limits<std::uint16_t>::max()) {
+            broker.port_ = static_cast<std::uint16_t>(value);
+        }
+        if (!broker.host_.empty()) {
+            brokers.push_back(std::move(broker));
+        }
+    }
+    return brokers;
+}
+
+std::string detail::rank_brokers(std::vector<broker_health>& brokers,
+                                 broker_health::clock::time_point now,
+                                 std::string_view path) {
+    std::stable_sort(brokers.begin(), brokers.end(), [now](const broker_health& a, const broker_health& b) {
+        return a.score(now) < b.score(now);
+    });
+    std::string list;
+    for (const auto& broker : brokers) {
+        if (!list.empty()) {
+            list += ',';
+        }
+        if (broker.host_.find(':') != std::string::npos) {
+            fmt::format_to(std::back_inserter(list), "[{}]:{}{}", broker.host_, broker.port_, path);
+        } else {
+            fmt::format_to(std::back_inserter(list), "{}:{}{}", broker.host_, broker.port_, path);
+        }
+    }
+    return list;
+}
+
+void detail::mqtt_logger::at_resolve(mqtt::error_code ec,
+                                     std::string_view host,
+                                     std::string_view port,
+                                     const boost::asio::ip::tcp::resolver::results_type& /*endpoints*/) {
+    if (owner_) {
+        owner_->handle_resolve(host, port);
+        if (ec) {
+            owner_->handle_tcp_connect(ec);
+        }
+    }
+}
+
+void detail::mqtt_logger::at_tcp_connect(mqtt::error_code ec, boost::asio::ip::tcp::endpoint /*endpoint*/) {
+    if (owner_ && ec) {
+        owner_->handle_tcp_connect(ec);
+    }
+}
+
+void detail::mqtt_logger::at_tls_handshake(mqtt::error_code ec, boost::asio::ip::tcp::endpoint /*endpoint*/) {
+    if (owner_ && ec) {
+        fmt::print(stderr, "MQTT: TLS handshake error: {}\n", ec.message());
+        owner_->handle_tcp_connect(ec);
+    }
+}
+
+void detail::mqtt_logger::at_ws_handshake(mqtt::error_code ec, boost::asio::ip::tcp::endpoint /*endpoint*/) {
+    if (owner_ && ec) {
+        fmt::print(stderr, "MQTT: WebSocket handshake error: {}\n", ec.message());
+        owner_->handle_tcp_connect(ec);
+    }
+}
 
 void detail::mqtt_logger::at_connack(mqtt::reason_code rc,
                                      bool session_present,
@@ -58,18 +245,94 @@ void detail::mqtt_logger::at_transport_error(mqtt::error_code ec) {
     }
 }
 
+detail::publisher_metrics::publisher_metrics(metrics::registry& registry)
+    : published_(registry.add_counter("mqtt_published_total", "Messages acknowledged by the broker")),
+      publish_errors_(registry.add_counter("mqtt_publish_errors_total", "Publishes that failed or were rejected")),
+      dropped_(dropped_counters(registry)),
+      connects_(registry.add_counter("mqtt_connects_total", "Successful broker connections")),
+      sessions_resumed_(registry.add_counter("mqtt_sessions_resumed_total", "Connections that resumed a broker session")),
+      connected_(registry.add_gauge("mqtt_connected", "1 while connected to the broker")),
+      queued_(registry.add_gauge("mqtt_queued", "Lines waiting for the publisher strand")),
+      backlog_(registry.add_gauge("mqtt_backlog", "Lines waiting for the broker connection or a publish slot")),
+      in_flight_(registry.add_gauge("mqtt_in_flight", "Publishes awaiting PUBACK")),
+      failovers_(registry.add_counter("mqtt_failovers_total", "Immediate switches to another broker")),
+      read_to_dispatch_(registry.add_histogram("bridge_latency_seconds", latency_help, metrics::default_latency_buckets,
+          R"(stage="read_to_dispatch")")),
+      dispatch_to_publish_(registry.add_histogram("bridge_latency_seconds", latency_help, metrics::default_latency_buckets,
+          R"(stage="dispatch_to_publish")")),
+      publish_to_puback_(registry.add_histogram("bridge_latency_seconds", latency_help, metrics::default_latency_buckets,
+          R"(stage="publish_to_puback")")),
+      read_to_puback_(registry.add_histogram("bridge_latency_seconds", latency_help, metrics::default_latency_buckets,
+          R"(stage="read_to_puback")"))
+{}
+
 mqtt_publisher::mqtt_publisher(boost::asio::io_context& io,
                                std::string host,
                                std::string port,
-                               std::string base_topic)
+                               std::string base_topic,
+                               mqtt_transport_options transport)
     : strand_(boost::asio::make_strand(io)),
       host_(std::move(host)),
       port_(std::move(port)),
+      brokers_(detail::parse_brokers(host_, default_port())),
       base_topic_(std::move(base_topic)),
-      client_id_(fmt::format("heos2mqtt-{}", random_id())),
-      reconnect_timer_(io),
-      client_(io, std::monostate{}, detail::mqtt_logger(*this))
-{}
+      client_id_(detail::default_client_id()),
+      reconnect_timer_(strand_),
+      metrics_timer_(strand_),
+      transport_(for_brokers(std::move(transport), brokers_)),
+      client_(make_client(strand_, transport_, tls_sessions_, *this)),
+      pending_(strand_, [this](queued_line line) {
+          metrics_.queued_.sub();
+          ++received_;
+          line.sequence_ = ++last_sequence_;
+          if (line.trace_.fragmented()) {
+              if (line.trace_.fragment_ == 0) {
+                  ++last_fragmented_line_;
+              }
+              line.line_ = last_fragmented_line_;
+          }
+          enqueue_backlog(std::move(line));
+          drain_backlog();
+          check_idle();
+      })
+{
+    // One client type serves all brokers, so a Unix socket transport rules
+    // out TCP brokers and vice versa.
+    const bool unix_socket = transport_.transport_ == mqtt_transport::unix_socket;
+    std::erase_if(brokers_, [&](const detail::broker_health& broker) {
+        const bool mismatch = broker.unix_path_.empty() == unix_socket;
+        if (mismatch) {
+            fmt::print(stderr, "MQTT: ignoring broker {}, not reachable over {}\n", broker.name(),
+                to_string(transport_.transport_));
+        }
+        return mismatch;
+    });
+}
+
+mqtt_publisher::client_type mqtt_publisher::make_client(const strand_type& strand,
+                                                       const mqtt_transport_options& options,
+                                                       tls_session_cache& sessions,
+                                                       mqtt_publisher& owner) {
+    using tls_client = std::variant_alternative_t<1, client_type>;
+    using ws_client = std::variant_alternative_t<2, client_type>;
+    using wss_client = std::variant_alternative_t<3, client_type>;
+    using unix_client = std::variant_alternative_t<4, client_type>;
+    switch (options.transport_) {
+    case mqtt_transport::tls:
+        return client_type(std::in_place_type<tls_client>, strand, make_tls_context(options, sessions),
+            detail::mqtt_logger(owner));
+    case mqtt_transport::websocket:
+        return client_type(std::in_place_type<ws_client>, strand, std::monostate{}, detail::mqtt_logger(owner));
+    case mqtt_transport::websocket_tls:
+        return client_type(std::in_place_type<wss_client>, strand, make_tls_context(options, sessions),
+            detail::mqtt_logger(owner));
+    case mqtt_transport::unix_socket:
+        return client_type(std::in_place_type<unix_client>, strand, std::monostate{}, detail::mqtt_logger(owner));
+    case mqtt_transport::tcp:
+        break;
+    }
+    return client_type(std::in_place_index<0>, strand, std::monostate{}, detail::mqtt_logger(owner));
+}
 
 void mqtt_publisher::start() {
     boost::asio::dispatch(strand_, [this]() {
@@ -82,6 +345,7 @@ void mqtt_publisher::start() {
         reconnect_timer_.cancel();
         ensure_client();
         run_client();
+        schedule_metrics();
     });
 }
 
@@ -90,56 +354,276 @@ void mqtt_publisher::stop() {
         stopping_ = true;
         running_ = false;
         reconnect_timer_.cancel();
+        metrics_timer_.cancel();
         connected_ = false;
-        client_.async_disconnect(
-            mqtt::disconnect_rc_e::normal_disconnection,
-            mqtt::disconnect_props{},
-            boost::asio::bind_executor(
-                strand_, [](mqtt::error_code ec) {
-                if (ec && ec != boost::asio::error::operation_aborted) {
-                    fmt::print(stderr, "MQTT: disconnect error: {}\n", ec.message());
-                }
-            }));
+        metrics_.connected_.set(0);
+        with_client([this](auto& client) {
+            client.async_disconnect(
+                mqtt::disconnect_rc_e::normal_disconnection,
+                mqtt::disconnect_props{},
+                boost::asio::bind_executor(
+                    strand_, [](mqtt::error_code ec) {
+                    if (ec && ec != boost::asio::error::operation_aborted) {
+                        fmt::print(stderr, "MQTT: disconnect error: {}\n", ec.message());
+                    }
+                }));
+        });
+    });
+}
+
+void mqtt_publisher::publish_raw(std::string line, line_trace trace, publish_priority priority) {
+    metrics_.queued_.add();
+    submitted_.fetch_add(1, std::memory_order_release);
+    pending_.push(queued_line{std::move(line), trace, priority});
+}
+
+void mqtt_publisher::notify_when_connected(std::function<void()> handler) {
+    boost::asio::dispatch(strand_, [this, handler = std::move(handler)]() mutable {
+        if (connected_) {
+            handler();
+        } else {
+            connected_waiters_.push_back(std::move(handler));
+        }
+    });
+}
+
+void mqtt_publisher::notify_when_idle(std::function<void()> handler) {
+    boost::asio::dispatch(strand_, [this, handler = std::move(handler)]() mutable {
+        idle_waiters_.push_back(std::move(handler));
+        check_idle();
+    });
+}
+
+void mqtt_publisher::check_idle() {
+    if (idle_waiters_.empty() || in_flight_ != 0 || !backlog_.empty() ||
+        received_ != submitted_.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto waiters = std::move(idle_waiters_);
+    idle_waiters_.clear();
+    for (auto& waiter : waiters) {
+        waiter();
+    }
+}
+
+void mqtt_publisher::set_control_handler(control_handler handler) {
+    control_handler_ = std::move(handler);
+}
+
+void mqtt_publisher::set_metrics_interval(std::chrono::steady_clock::duration interval) {
+    metrics_interval_ = interval;
+}
+
+void mqtt_publisher::set_trace_property(bool enabled) {
+    trace_property_ = enabled;
+}
+
+void mqtt_publisher::set_client_id(std::string client_id) {
+    client_id_ = std::move(client_id);
+}
+
+void mqtt_publisher::set_session_expiry(std::chrono::seconds expiry) {
+    session_expiry_ = std::max(expiry, std::chrono::seconds::zero());
+}
+
+void mqtt_publisher::set_backlog_limit(std::size_t limit) {
+    backlog_.set_limit(limit);
+}
+
+void mqtt_publisher::set_in_flight_limit(std::size_t limit) {
+    in_flight_limit_ = std::max<std::size_t>(limit, 1);
+}
+
+void mqtt_publisher::enqueue_backlog(queued_line line) {
+    const auto priority = line.priority_;
+    const auto id = line.line_;
+    const bool last = !line.trace_.continued_;
+    const auto before = backlog_.size();
+    if (auto shed = backlog_.push(priority, std::move(line), id, last)) {
+        metrics_.dropped_[static_cast<std::size_t>(*shed)]->inc();
+    }
+    // A shed fragmented line may take several queued pieces with it.
+    metrics_.backlog_.add(static_cast<std::int64_t>(backlog_.size()) - static_cast<std::int64_t>(before));
+}
+
+void mqtt_publisher::requeue_aborted() {
+    std::sort(aborted_.begin(), aborted_.end(), [](const queued_line& a, const queued_line& b) {
+        return a.sequence_ < b.sequence_;
     });
+    const auto before = backlog_.size();
+    for (auto& line : aborted_) {
+        const auto priority = line.priority_;
+        const auto id = line.line_;
+        const bool last = !line.trace_.continued_;
+        if (auto shed = backlog_.requeue_front(priority, std::move(line), id, last)) {
+            metrics_.dropped_[static_cast<std::size_t>(*shed)]->inc();
+        }
+    }
+    aborted_.clear();
+    metrics_.backlog_.add(static_cast<std::int64_t>(backlog_.size()) - static_cast<std::int64_t>(before));
 }
 
-void mqtt_publisher::publish_raw(std::string line) {
-    boost::asio::dispatch(strand_, [this, line = std::move(line)]() {
-        if (!connected_) {
+void mqtt_publisher::drain_backlog() {
+    while (connected_ && in_flight_ < in_flight_limit_) {
+        auto line = backlog_.pop();
+        if (!line) {
             return;
         }
-        boost::json::object payload{
-            {"raw", line},
-            {"ts", current_iso_timestamp()},
-        };
-        auto serialized = boost::json::serialize(payload);
-        mqtt::publish_props props;
-        client_.async_publish<mqtt::qos_e::at_least_once>(
+        metrics_.backlog_.sub();
+        publish_line(std::move(*line));
+    }
+}
+
+void mqtt_publisher::publish_line(queued_line line) {
+    auto serialized = detail::build_payload(line.text_, detail::current_iso_timestamp(), line.trace_);
+    mqtt::publish_props props;
+
+    const auto& trace = line.trace_;
+    const auto published = line_trace::clock::now();
+    if (trace.traced()) {
+        metrics_.read_to_dispatch_.observe(trace.dispatched_ - trace.read_);
+        metrics_.dispatch_to_publish_.observe(published - trace.dispatched_);
+        if (trace_property_) {
+            // Translate the monotonic read time to wall clock for consumers
+            // on other hosts.
+            auto read_wall = std::chrono::system_clock::now() - (published - trace.read_);
+            auto read_us = std::chrono::duration_cast<std::chrono::microseconds>(read_wall.time_since_epoch());
+            props[mqtt::prop::user_property].emplace_back("heos_read_us", std::to_string(read_us.count()));
+        }
+    }
+    ++in_flight_;
+    metrics_.in_flight_.add();
+    auto on_puback = [this, line = std::move(line), published](mqtt::error_code ec, mqtt::reason_code rc,
+                                                               mqtt::puback_props) mutable {
+        --in_flight_;
+        metrics_.in_flight_.sub();
+        const auto trace = line.trace_;
+        if (ec == boost::asio::error::operation_aborted && !stopping_) {
+            // Cancelled by a failover; send it to the next broker ahead of
+            // the lines that arrived since.
+            aborted_.push_back(std::move(line));
+        } else if (ec || rc.is_error()) {
+            metrics_.publish_errors_.inc();
+            fmt::print(stderr, "MQTT: publish error: {} ({})\n", ec.message(), rc.message());
+        } else {
+            metrics_.published_.inc();
+            if (trace.traced()) {
+                auto acked = line_trace::clock::now();
+                metrics_.publish_to_puback_.observe(acked - published);
+                metrics_.read_to_puback_.observe(acked - trace.read_);
+            }
+        }
+        if (in_flight_ == 0) {
+            requeue_aborted();
+        }
+        drain_backlog();
+        check_idle();
+    };
+    with_client([&](auto& client) {
+        client.template async_publish<mqtt::qos_e::at_least_once>(
             build_topic("raw"), std::move(serialized), mqtt::retain_e::no, props,
+            boost::asio::bind_executor(strand_, std::move(on_puback)));
+    });
+}
+
+void mqtt_publisher::ensure_client() {
+    const bool websocket = transport_.transport_ == mqtt_transport::websocket ||
+                           transport_.transport_ == mqtt_transport::websocket_tls;
+    auto brokers = detail::rank_brokers(brokers_, std::chrono::steady_clock::now(),
+        websocket ? std::string_view(transport_.websocket_path_) : std::string_view{});
+    with_client([&](auto& client) {
+        client.brokers(brokers, default_port());
+        client.credentials(client_id_);
+        client.keep_alive(30);
+        // The client always connects with Clean Start off; the expiry
+        // decides whether the broker keeps the session between connections.
+        client.connect_property(mqtt::prop::session_expiry_interval,
+            static_cast<std::uint32_t>(std::min<std::chrono::seconds::rep>(
+                session_expiry_.count(), std::numeric_limits<std::uint32_t>::max())));
+    });
+}
+
+void mqtt_publisher::run_client() {
+    fmt::print("MQTT: starting client run to {} (port {}, {})\n", host_, port_, to_string(transport_.transport_));
+    with_client([this](auto& client) {
+        client.async_run(boost::asio::bind_executor(
+            strand_, [this](mqtt::error_code ec) { handle_run_complete(ec); }));
+    });
+    if (control_handler_) {
+        receive_control();
+    }
+}
+
+void mqtt_publisher::schedule_metrics() {
+    if (metrics_interval_ <= std::chrono::steady_clock::duration::zero()) {
+        return;
+    }
+    metrics_timer_.expires_after(metrics_interval_);
+    metrics_timer_.async_wait(boost::asio::bind_executor(
+        strand_, [this](const boost::system::error_code& ec) {
+            if (ec || !running_) {
+                return;
+            }
+            publish_metrics();
+            schedule_metrics();
+        }));
+}
+
+void mqtt_publisher::publish_metrics() {
+    if (!connected_) {
+        return;
+    }
+    std::string payload;
+    metrics::registry::get_default().render_json(payload);
+    with_client([&](auto& client) {
+        client.template async_publish<mqtt::qos_e::at_most_once>(
+            build_topic("$metrics"), std::move(payload), mqtt::retain_e::no, mqtt::publish_props{},
+            boost::asio::bind_executor(strand_, [](mqtt::error_code ec) {
+                if (ec) {
+                    fmt::print(stderr, "MQTT: metrics publish error: {}\n", ec.message());
+                }
+            }));
+    });
+}
+
+void mqtt_publisher::subscribe_control() {
+    mqtt::subscribe_topic topic{build_topic("control/+"), mqtt::subscribe_options{}};
+    with_client([&](auto& client) {
+        client.async_subscribe(
+            topic, mqtt::subscribe_props{},
             boost::asio::bind_executor(
                 strand_,
-                [](mqtt::error_code ec, mqtt::reason_code rc, mqtt::puback_props) {
+                [](mqtt::error_code ec, std::vector<mqtt::reason_code> rcs, mqtt::suback_props) {
                     if (ec) {
-                        fmt::print(stderr, "MQTT: publish error: {} ({})\n", ec.message(), rc.message());
+                        fmt::print(stderr, "MQTT: control subscribe error: {}\n", ec.message());
+                    } else if (!rcs.empty() && rcs.front().is_error()) {
+                        fmt::print(stderr, "MQTT: control subscribe rejected: {}\n", rcs.front().message());
                     }
                 }));
     });
 }
 
-void mqtt_publisher::ensure_client() {
-    client_.brokers(fmt::format("{}:{}", host_, port_), default_port());
-    client_.credentials(client_id_);
-    client_.keep_alive(30);
-}
-
-void mqtt_publisher::run_client() {
-    fmt::print("MQTT: starting client run to {}:{}\n", host_, port_);
-    client_.async_run(boost::asio::bind_executor(
-        strand_, [this](mqtt::error_code ec) { handle_run_complete(ec); }));
+void mqtt_publisher::receive_control() {
+    with_client([this](auto& client) {
+        client.async_receive(boost::asio::bind_executor(
+            strand_,
+            [this](mqtt::error_code ec, std::string topic, std::string payload, mqtt::publish_props) {
+                if (ec) {
+                    // Cancelled along with async_run; run_client() starts a new loop.
+                    return;
+                }
+                const auto prefix = build_topic("control/");
+                if (control_handler_ && std::string_view(topic).starts_with(prefix)) {
+                    control_handler_(std::string_view(topic).substr(prefix.size()), payload);
+                }
+                receive_control();
+            }));
+    });
 }
 
 void mqtt_publisher::handle_run_complete(mqtt::error_code ec) {
     connected_ = false;
+    metrics_.connected_.set(0);
     if (stopping_) {
         if (ec && ec != boost::asio::error::operation_aborted) {
             fmt::print(stderr, "MQTT: run stopped ({})\n", ec.message());
@@ -147,6 +631,16 @@ void mqtt_publisher::handle_run_complete(mqtt::error_code ec) {
         reconnect_attempts_ = 0;
         return;
     }
+    if (failing_over_) {
+        failing_over_ = false;
+        current_broker_.reset();
+        ++reconnect_attempts_;
+        metrics_.failovers_.inc();
+        fmt::print("MQTT: failing over to the next broker\n");
+        ensure_client();
+        run_client();
+        return;
+    }
     fmt::print(stderr, "MQTT: client run ended ({})\n", ec.message());
     schedule_restart();
 }
@@ -169,18 +663,44 @@ void mqtt_publisher::schedule_restart() {
 }
 
 void mqtt_publisher::handle_connack(mqtt::reason_code rc,
-                                    bool /*session_present*/,
+                                    bool session_present,
                                     const mqtt::connack_props& /*props*/) {
-    boost::asio::dispatch(strand_, [this, rc]() {
+    boost::asio::dispatch(strand_, [this, rc, session_present]() {
         if (!running_) {
             return;
         }
         if (rc == mqtt::reason_codes::success) {
-            fmt::print("MQTT: connected\n");
+            if (auto* broker = current_broker()) {
+                broker->record_success(std::chrono::steady_clock::now() - broker->attempt_started_);
+                fmt::print("MQTT: connected to {}\n", broker->name());
+            } else {
+                fmt::print("MQTT: connected\n");
+            }
+            if (session_present) {
+                metrics_.sessions_resumed_.inc();
+                fmt::print("MQTT: resumed session '{}'\n", client_id_);
+            }
             connected_ = true;
             reconnect_attempts_ = 0;
+            metrics_.connects_.inc();
+            metrics_.connected_.set(1);
+            if (control_handler_) {
+                subscribe_control();
+            }
+            if (!backlog_.empty()) {
+                fmt::print("MQTT: publishing {} lines kept while disconnected\n", backlog_.size());
+            }
+            drain_backlog();
+            auto waiters = std::move(connected_waiters_);
+            connected_waiters_.clear();
+            for (auto& waiter : waiters) {
+                waiter();
+            }
         } else {
             fmt::print(stderr, "MQTT: connack error: {}\n", rc.message());
+            if (auto* broker = current_broker()) {
+                broker->record_failure(std::chrono::steady_clock::now());
+            }
         }
     });
 }
@@ -192,6 +712,7 @@ void mqtt_publisher::handle_disconnect_notice(mqtt::reason_code rc,
             return;
         }
         connected_ = false;
+        metrics_.connected_.set(0);
         fmt::print(stderr, "MQTT: disconnected ({})\n", rc.message());
     });
 }
@@ -202,10 +723,68 @@ void mqtt_publisher::handle_transport_error(mqtt::error_code ec) {
             return;
         }
         connected_ = false;
+        metrics_.connected_.set(0);
         fmt::print(stderr, "MQTT: transport error: {}\n", ec.message());
+        if (session_expiry_ > std::chrono::seconds::zero() && !healthy_alternative()) {
+            // With nowhere better to go, let the client reconnect and resume
+            // the session so that publishes in flight keep their packet ids.
+            // If that connect fails, handle_tcp_connect() fails over.
+            if (auto* broker = current_broker()) {
+                broker->record_failure(std::chrono::steady_clock::now());
+            }
+            return;
+        }
+        handle_tcp_connect(ec);
+    });
+}
+
+void mqtt_publisher::handle_resolve(std::string_view host, std::string_view port) {
+    // Each connection attempt starts with a resolve of the broker it is for.
+    std::string key(host);
+    std::string number(port);
+    boost::asio::dispatch(strand_, [this, key = std::move(key), number = std::move(number)]() {
+        current_broker_.reset();
+        for (std::size_t i = 0; i < brokers_.size(); ++i) {
+            if (brokers_[i].host_ == key && std::to_string(brokers_[i].port_) == number) {
+                current_broker_ = i;
+                brokers_[i].attempt_started_ = std::chrono::steady_clock::now();
+                break;
+            }
+        }
+    });
+}
+
+void mqtt_publisher::handle_tcp_connect(mqtt::error_code ec) {
+    boost::asio::dispatch(strand_, [this, ec]() {
+        if (stopping_ || !running_ || failing_over_) {
+            return;
+        }
+        if (auto* broker = current_broker()) {
+            broker->record_failure(std::chrono::steady_clock::now());
+            fmt::print(stderr, "MQTT: broker {} failed: {}\n", broker->name(), ec.message());
+        }
+        // With a choice of brokers, switch now rather than waiting for the
+        // client's own retry. After each broker has had its turn, leave
+        // the retries to the client and its backoff.
+        if (brokers_.size() > 1 && reconnect_attempts_ < brokers_.size()) {
+            failing_over_ = true;
+            with_client([](auto& client) { client.cancel(); });
+        }
     });
 }
 
+bool mqtt_publisher::healthy_alternative() const {
+    const auto now = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < brokers_.size(); ++i) {
+        const auto& broker = brokers_[i];
+        if (i != current_broker_ &&
+            (broker.failures_ == 0 || now - broker.last_failure_ >= detail::broker_health::failure_memory)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::uint16_t mqtt_publisher::default_port() const {
     auto value = std::stoi(port_);
     if (value >= 0 && value <= std::numeric_limits<std::uint16_t>::max()) {
@@ -214,11 +793,15 @@ std::uint16_t mqtt_publisher::default_port() const {
     return 1883;
 }
 
-std::string mqtt_publisher::build_topic(const std::string& suffix) const {
-    if (base_topic_.empty()) {
-        return suffix;
+detail::broker_health* mqtt_publisher::current_broker() {
+    if (!current_broker_ || *current_broker_ >= brokers_.size()) {
+        return nullptr;
     }
-    return fmt::format("{}/{}", base_topic_, suffix);
+    return &brokers_[*current_broker_];
+}
+
+std::string mqtt_publisher::build_topic(const std::string& suffix) const {
+    return detail::build_topic(base_topic_, suffix);
 }
 
 }  // namespace heos2mqtt
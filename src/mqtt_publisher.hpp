@@ -1,11 +1,28 @@
 #pragma once
 
+#include "heos_command.hpp"
+#include "line_trace.hpp"
+#include "metrics/metrics.hpp"
+#include "mpsc_queue.hpp"
+#include "mqtt_transport.hpp"
+
 #include <boost/asio.hpp>
 #include <boost/json.hpp>
 #include <boost/mqtt5/mqtt_client.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
 
 namespace heos2mqtt {
 
@@ -19,6 +36,13 @@ class mqtt_logger {
 public:
     explicit mqtt_logger(mqtt_publisher& owner) : owner_(&owner) {}
 
+    void at_resolve(mqtt::error_code ec,
+                    std::string_view host,
+                    std::string_view port,
+                    const boost::asio::ip::tcp::resolver::results_type& endpoints);
+    void at_tcp_connect(mqtt::error_code ec, boost::asio::ip::tcp::endpoint endpoint);
+    void at_tls_handshake(mqtt::error_code ec, boost::asio::ip::tcp::endpoint endpoint);
+    void at_ws_handshake(mqtt::error_code ec, boost::asio::ip::tcp::endpoint endpoint);
     void at_connack(mqtt::reason_code rc,
                     bool session_present,
                     const mqtt::connack_props& props);
@@ -29,45 +53,376 @@ private:
     mqtt_publisher* owner_{nullptr};
 };
 
+// "heos2mqtt-<hostname>", so restarts resume the same broker session.
+std::string default_client_id();
+
+// UTC time of day in ISO 8601, e.g. "2024-04-01T12:00:00Z".
+std::string current_iso_timestamp();
+
+// The JSON object published for one HEOS line. Pieces of a fragmented line
+// also carry "part" (from 0) and "more" (false on the last piece).
+std::string build_payload(std::string_view line, std::string_view timestamp, const line_trace& trace = {});
+
+// base/suffix, or just suffix when base is empty.
+std::string build_topic(std::string_view base, std::string_view suffix);
+
+// Connection history of one broker, used to try the healthiest first.
+struct broker_health {
+    using clock = std::chrono::steady_clock;
+
+    // Score of a broker that has never connected.
+    static constexpr clock::duration untried_latency = std::chrono::milliseconds(100);
+    // Added per consecutive failure, until failure_memory has passed.
+    static constexpr clock::duration failure_penalty = std::chrono::seconds(5);
+    static constexpr clock::duration failure_memory = std::chrono::seconds(60);
+
+    std::string host_;
+    std::uint16_t port_{1883};
+    // Set for a unix:// broker, whose host_ and port_ are its placeholder
+    // from register_unix_socket().
+    std::string unix_path_;
+    // Moving average of the time from resolve to CONNACK.
+    std::optional<clock::duration> connect_latency_;
+    std::size_t failures_{0};
+    clock::time_point last_failure_;
+    clock::time_point attempt_started_;
+
+    // host:port, or the unix:// address.
+    [[nodiscard]] std::string name() const;
+    void record_success(clock::duration latency);
+    void record_failure(clock::time_point now);
+    // Lower is better.
+    [[nodiscard]] clock::duration score(clock::time_point now) const;
+};
+
+// Parses "host[:port][,host[:port]...]"; IPv6 hosts are bracketed and
+// unix:///path entries name Unix domain sockets.
+std::vector<broker_health> parse_brokers(std::string_view list, std::uint16_t default_port);
+
+// Orders brokers healthiest first, keeping the configured order between
+// equals, and returns them as a broker list for the MQTT client, with path
+// (the WebSocket request path) appended to each.
+std::string rank_brokers(std::vector<broker_health>& brokers,
+                         broker_health::clock::time_point now,
+                         std::string_view path = {});
+
+// Lines waiting for the broker, one FIFO per priority. pop() serves the
+// most urgent priority first. A push beyond the limit sheds the oldest line
+// of the least urgent priority present, which may be the new line itself.
+//
+// The pieces of an over-long line are pushed with one priority and a
+// shared non-zero line id, the final piece with last set, and are shed
+// together: all of them that are queued go at once and the rest are
+// dropped as they arrive. A line whose first piece has already been popped
+// is passed over while there is anything else to shed.
+template <typename T>
+class priority_backlog {
+public:
+    explicit priority_backlog(std::size_t limit) : limit_(limit) {}
+
+    void set_limit(std::size_t limit) {
+        limit_ = limit;
+    }
+
+    // Returns the priority of the line shed to make room, if any.
+    std::optional<publish_priority> push(publish_priority priority, T value, std::uint64_t line = 0,
+                                         bool last = true) {
+        if (line != 0 && std::erase(discarding_, line) != 0) {
+            if (!last) {
+                discarding_.push_back(line);
+            }
+            return std::nullopt;
+        }
+        queues_[static_cast<std::size_t>(priority)].push_back({std::move(value), line, last});
+        ++size_;
+        return shed();
+    }
+
+    // Puts back a line that was popped but could not be delivered, ahead of
+    // everything queued since. Lines put back one after another are served
+    // in the order they were put back, so requeue them oldest first.
+    std::optional<publish_priority> requeue_front(publish_priority priority, T value, std::uint64_t line = 0,
+                                                  bool last = true) {
+        auto& queue = queues_[static_cast<std::size_t>(priority)];
+        auto position = std::find_if(queue.begin(), queue.end(), [](const entry& candidate) {
+            return !candidate.requeued_;
+        });
+        queue.insert(position, {std::move(value), line, last, true});
+        ++size_;
+        return shed();
+    }
+
+    std::optional<T> pop() {
+        for (auto& queue : queues_) {
+            if (!queue.empty()) {
+                auto front = std::move(queue.front());
+                queue.pop_front();
+                --size_;
+                if (front.line_ != 0) {
+                    std::erase(started_, front.line_);
+                    if (!front.last_) {
+                        started_.push_back(front.line_);
+                    }
+                }
+                return std::move(front.value_);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return size_;
+    }
+
+    [[nodiscard]] std::size_t size(publish_priority priority) const {
+        return queues_[static_cast<std::size_t>(priority)].size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    struct entry {
+        T value_;
+        std::uint64_t line_;
+        bool last_;
+        bool requeued_{false};
+    };
+
+    // Sheds a line if the backlog is over its limit.
+    std::optional<publish_priority> shed() {
+        if (size_ <= limit_) {
+            return std::nullopt;
+        }
+        for (const bool spare_started : {true, false}) {
+            for (auto i = queues_.size(); i-- > 0;) {
+                if (shed_from(queues_[i], spare_started)) {
+                    return static_cast<publish_priority>(i);
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] bool started(std::uint64_t line) const {
+        return line != 0 && std::find(started_.begin(), started_.end(), line) != started_.end();
+    }
+
+    // Removes the oldest line in queue, with all of its queued pieces.
+    bool shed_from(std::deque<entry>& queue, bool spare_started) {
+        auto victim = std::find_if(queue.begin(), queue.end(), [&](const entry& candidate) {
+            return !spare_started || !started(candidate.line_);
+        });
+        if (victim == queue.end()) {
+            return false;
+        }
+        const auto line = victim->line_;
+        if (line == 0) {
+            queue.erase(victim);
+            --size_;
+            return true;
+        }
+        bool ended = false;
+        size_ -= std::erase_if(queue, [&](const entry& candidate) {
+            ended = ended || (candidate.line_ == line && candidate.last_);
+            return candidate.line_ == line;
+        });
+        std::erase(started_, line);
+        if (!ended) {
+            discarding_.push_back(line);
+        }
+        return true;
+    }
+
+    std::array<std::deque<entry>, publish_priority_count> queues_;
+    std::size_t size_{0};
+    std::size_t limit_;
+    // Fragmented lines partly popped, and partly shed; rarely more than one.
+    std::vector<std::uint64_t> started_;
+    std::vector<std::uint64_t> discarding_;
+};
+
+struct publisher_metrics {
+    explicit publisher_metrics(metrics::registry& registry = metrics::registry::get_default());
+
+    metrics::counter& published_;
+    metrics::counter& publish_errors_;
+    // Lines shed from a full backlog, by priority.
+    std::array<metrics::counter*, publish_priority_count> dropped_;
+    metrics::counter& connects_;
+    metrics::counter& sessions_resumed_;
+    metrics::gauge& connected_;
+    metrics::gauge& queued_;
+    metrics::gauge& backlog_;
+    metrics::gauge& in_flight_;
+    metrics::counter& failovers_;
+    // Latency of each stage of a traced line.
+    metrics::histogram& read_to_dispatch_;
+    metrics::histogram& dispatch_to_publish_;
+    metrics::histogram& publish_to_puback_;
+    metrics::histogram& read_to_puback_;
+};
+
 }  // namespace detail
 
 class mqtt_publisher {
     friend class detail::mqtt_logger;
 
 public:
+    // Receives messages published to <base>/control/<command>, on the
+    // publisher's strand.
+    using control_handler = std::function<void(std::string_view command, std::string_view payload)>;
+
+    // host may list several brokers, "host[:port],host[:port],...", with
+    // port as the default. The healthiest is tried first and a transport
+    // error fails over to the next at once. "unix:///path" entries select a
+    // Unix domain socket connection to a co-located broker instead, and TCP
+    // entries beside them are ignored. The transport is fixed for the
+    // publisher's lifetime; a TLS context that cannot be set up throws.
     mqtt_publisher(boost::asio::io_context& io,
                    std::string host,
                    std::string port,
-                   std::string base_topic);
+                   std::string base_topic,
+                   mqtt_transport_options transport = {});
 
     void start();
     void stop();
-    void publish_raw(std::string line);
+    // Safe to call from any thread: lines are handed to the publisher's
+    // strand through a lock-free queue. A traced line feeds the per-stage
+    // latency histograms once the broker acknowledges it. When publishes
+    // back up, lines of a more urgent priority overtake the rest.
+    void publish_raw(std::string line, line_trace trace = {},
+                     publish_priority priority = publish_priority::metadata);
+    // Must be set before start().
+    void set_control_handler(control_handler handler);
+    // Calls handler on the publisher's strand after the next CONNACK, or
+    // right away if connected.
+    void notify_when_connected(std::function<void()> handler);
+    // Calls handler on the publisher's strand once every line handed to
+    // publish_raw() so far has been acknowledged or dropped.
+    void notify_when_idle(std::function<void()> handler);
+    // Publishes the metrics registry as JSON to <base>/$metrics at this
+    // interval while connected. Zero disables. Must be set before start().
+    void set_metrics_interval(std::chrono::steady_clock::duration interval);
+    // Adds the wall clock time the line was read, in microseconds since the
+    // epoch, to each publish as the MQTT v5 user property "heos_read_us".
+    void set_trace_property(bool enabled);
+    // Lines waiting for the connection or for a publish slot, and publishes
+    // aborted by a reconnect, are kept up to this many; beyond it the oldest
+    // line of the least urgent priority is dropped. Must be set before
+    // start().
+    void set_backlog_limit(std::size_t limit);
+    // Publishes awaiting PUBACK at once. Further lines wait in the backlog,
+    // where they are ordered by priority, rather than in the client's FIFO.
+    // Below the limit a line is published as soon as it arrives, but the
+    // limit does cap throughput at about that many lines per round trip to
+    // the broker. Must be set before start().
+    void set_in_flight_limit(std::size_t limit);
+    // MQTT client id; defaults to detail::default_client_id(). Must be
+    // unique per broker and set before start().
+    void set_client_id(std::string client_id);
+    // How long the broker keeps the session after the connection drops.
+    // With a session and no healthy broker to fail over to, publishes
+    // awaiting PUBACK when the connection is lost are resent under their
+    // packet ids once the client reconnects, instead of being lost or
+    // published again as new messages. Zero ends the session with the
+    // connection. Must be set before start().
+    void set_session_expiry(std::chrono::seconds expiry);
 
 private:
-    using client_type =
-        mqtt::mqtt_client<boost::asio::ip::tcp::socket, std::monostate, detail::mqtt_logger>;
+    using strand_type = boost::asio::strand<boost::asio::io_context::executor_type>;
+    using tcp_stream = boost::asio::ip::tcp::socket;
+    using tls_stream = boost::asio::ssl::stream<tcp_stream>;
+    using client_type = std::variant<
+        mqtt::mqtt_client<tcp_stream, std::monostate, detail::mqtt_logger>,
+        mqtt::mqtt_client<tls_stream, boost::asio::ssl::context, detail::mqtt_logger>,
+        mqtt::mqtt_client<boost::beast::websocket::stream<tcp_stream>, std::monostate, detail::mqtt_logger>,
+        mqtt::mqtt_client<boost::beast::websocket::stream<tls_stream>, boost::asio::ssl::context, detail::mqtt_logger>,
+        mqtt::mqtt_client<unix_stream, std::monostate, detail::mqtt_logger>>;
+
+    struct queued_line {
+        std::string text_;
+        line_trace trace_;
+        publish_priority priority_{publish_priority::metadata};
+        // Shared by the pieces of a fragmented line, 0 for a whole line.
+        std::uint64_t line_{0};
+        // Arrival order, which aborted publishes are put back in.
+        std::uint64_t sequence_{0};
+    };
+
+    static client_type make_client(const strand_type& strand,
+                                   const mqtt_transport_options& options,
+                                   tls_session_cache& sessions,
+                                   mqtt_publisher& owner);
+    // Calls function with the client of whichever transport is in use.
+    template <typename Function>
+    decltype(auto) with_client(Function&& function) {
+        return std::visit(std::forward<Function>(function), client_);
+    }
 
+    void publish_line(queued_line line);
+    void check_idle();
+    void enqueue_backlog(queued_line line);
+    // Publishes backlog lines, most urgent first, while connected and
+    // below the in-flight limit.
+    void drain_backlog();
+    // Returns publishes aborted by a failover to the front of the backlog,
+    // in the order they arrived, once none is left in flight.
+    void requeue_aborted();
     void ensure_client();
     void run_client();
     void handle_run_complete(mqtt::error_code ec);
+    void schedule_metrics();
+    void publish_metrics();
+    void subscribe_control();
+    void receive_control();
     void schedule_restart();
+    void handle_resolve(std::string_view host, std::string_view port);
+    void handle_tcp_connect(mqtt::error_code ec);
     void handle_connack(mqtt::reason_code rc, bool session_present, const mqtt::connack_props& props);
     void handle_disconnect_notice(mqtt::reason_code rc, const mqtt::disconnect_props& props);
     void handle_transport_error(mqtt::error_code ec);
+    // Whether a broker other than the current one has no recent failure.
+    [[nodiscard]] bool healthy_alternative() const;
     [[nodiscard]] std::uint16_t default_port() const;
+    [[nodiscard]] detail::broker_health* current_broker();
     [[nodiscard]] std::string build_topic(const std::string& suffix) const;
 
-    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    strand_type strand_;
     std::string host_;
     std::string port_;
+    std::vector<detail::broker_health> brokers_;
+    std::optional<std::size_t> current_broker_;
     std::string base_topic_;
     std::string client_id_;
+    std::chrono::seconds session_expiry_{3600};
     boost::asio::steady_timer reconnect_timer_;
+    boost::asio::steady_timer metrics_timer_;
+    std::chrono::steady_clock::duration metrics_interval_{};
+    detail::publisher_metrics metrics_;
+    mqtt_transport_options transport_;
+    // Referenced from the client's SSL context, so it must outlive client_.
+    tls_session_cache tls_sessions_;
     client_type client_;
+    handoff_queue<queued_line, strand_type> pending_;
+    // Lines passed to publish_raw(), and those of them taken off pending_.
+    std::atomic<std::size_t> submitted_{0};
+    std::size_t received_{0};
+    std::vector<std::function<void()>> connected_waiters_;
+    std::vector<std::function<void()>> idle_waiters_;
+    detail::priority_backlog<queued_line> backlog_{10000};
+    std::size_t in_flight_limit_{32};
+    std::size_t in_flight_{0};
+    std::uint64_t last_fragmented_line_{0};
+    std::uint64_t last_sequence_{0};
+    std::vector<queued_line> aborted_;
+    control_handler control_handler_;
+    bool trace_property_{false};
     bool running_{false};
     bool connected_{false};
     bool stopping_{false};
+    bool failing_over_{false};
     std::size_t reconnect_attempts_{0};
 };
 
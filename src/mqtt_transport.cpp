@@ -0,0 +1,212 @@
+#include "mqtt_transport.hpp"
+
+#include "logging/logging.hpp"
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace heos2mqtt {
+
+using namespace logging;
+
+namespace {
+
+constexpr std::array<std::pair<std::string_view, mqtt_transport>, 4> transport_names{{
+    {"tcp", mqtt_transport::tcp},
+    {"tls", mqtt_transport::tls},
+    {"ws", mqtt_transport::websocket},
+    {"wss", mqtt_transport::websocket_tls},
+}};
+
+// Slot of the owning tls_session_cache in an SSL_CTX.
+int cache_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// Slot of the host a connection was prepared for in an SSL, which keys its
+// sessions; SNI cannot, as IP literals go without it.
+int host_index() {
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+        [](void* /*parent*/, void* host, CRYPTO_EX_DATA* /*data*/, int /*index*/, long /*argl*/, void* /*argp*/) {
+            delete static_cast<std::string*>(host); // NOLINT(cppcoreguidelines-owning-memory)
+        });
+    return index;
+}
+
+bool is_ip_literal(const std::string& host) {
+    boost::system::error_code ec;
+    boost::asio::ip::make_address(host, ec);
+    return !ec;
+}
+
+struct unix_socket_registry {
+    std::mutex mutex_;
+    std::map<std::uint16_t, std::string> paths_;
+};
+
+unix_socket_registry& unix_sockets() {
+    static unix_socket_registry registry;
+    return registry;
+}
+
+}  // namespace
+
+std::uint16_t detail::register_unix_socket(const std::string& path) {
+    auto& registry = unix_sockets();
+    std::lock_guard lock(registry.mutex_);
+    for (const auto& [port, registered] : registry.paths_) {
+        if (registered == path) {
+            return port;
+        }
+    }
+    // Port 0 means "any"; start from 1. Nothing ever listens on these, they
+    // only name paths.
+    auto port = static_cast<std::uint16_t>(registry.paths_.size() + 1);
+    registry.paths_.emplace(port, path);
+    return port;
+}
+
+std::optional<std::string> detail::unix_socket_path(std::uint16_t port) {
+    auto& registry = unix_sockets();
+    std::lock_guard lock(registry.mutex_);
+    auto it = registry.paths_.find(port);
+    if (it == registry.paths_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::optional<mqtt_transport> parse_mqtt_transport(std::string_view name) {
+    for (const auto& [text, transport] : transport_names) {
+        if (text == name) {
+            return transport;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view to_string(mqtt_transport transport) {
+    if (transport == mqtt_transport::unix_socket) {
+        return "unix";
+    }
+    for (const auto& [text, value] : transport_names) {
+        if (value == transport) {
+            return text;
+        }
+    }
+    return "tcp";
+}
+
+tls_session_cache::tls_session_cache(metrics::registry& registry)
+  : handshakes_(registry.add_counter("mqtt_tls_handshakes_total", "TLS handshakes with the broker"))
+  , resumed_(registry.add_counter("mqtt_tls_resumed_total", "TLS handshakes that resumed a cached session"))
+{}
+
+void tls_session_cache::attach(boost::asio::ssl::context& context, bool resume) {
+    auto* ctx = context.native_handle();
+    resume_ = resume;
+    SSL_CTX_set_ex_data(ctx, cache_index(), this);
+    // OpenSSL's own cache is server side only; keep client sessions here.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &tls_session_cache::on_new_session);
+    SSL_CTX_set_info_callback(ctx, &tls_session_cache::on_info);
+}
+
+void tls_session_cache::prepare(SSL* ssl, const std::string& host) {
+    const bool verify = SSL_get_verify_mode(ssl) != SSL_VERIFY_NONE;
+    if (is_ip_literal(host)) {
+        // SNI must not carry an address; match the certificate's IP SAN.
+        if (verify) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str());
+        }
+    } else {
+        SSL_set_tlsext_host_name(ssl, host.c_str());
+        if (verify) {
+            SSL_set1_host(ssl, host.c_str());
+        }
+    }
+    auto* cache = from(ssl);
+    if (cache == nullptr) {
+        return;
+    }
+    delete static_cast<std::string*>(SSL_get_ex_data(ssl, host_index())); // NOLINT(cppcoreguidelines-owning-memory)
+    SSL_set_ex_data(ssl, host_index(), new std::string(host)); // NOLINT(cppcoreguidelines-owning-memory)
+    cache->pending_ = ssl;
+    auto it = cache->sessions_.find(host);
+    if (!cache->resume_ || it == cache->sessions_.end()) {
+        return;
+    }
+    const unsigned char* data = it->second.data();
+    SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &data, static_cast<long>(it->second.size()));
+    if (session == nullptr) {
+        cache->sessions_.erase(it);
+        return;
+    }
+    SSL_set_session(ssl, session);
+    SSL_SESSION_free(session);
+}
+
+int tls_session_cache::on_new_session(SSL* ssl, SSL_SESSION* session) {
+    auto* cache = from(ssl);
+    const auto* host = static_cast<const std::string*>(SSL_get_ex_data(ssl, host_index()));
+    if (cache == nullptr || !cache->resume_ || host == nullptr || SSL_SESSION_is_resumable(session) == 0) {
+        return 0;
+    }
+    const int length = i2d_SSL_SESSION(session, nullptr);
+    if (length <= 0) {
+        return 0;
+    }
+    std::vector<unsigned char> encoded(static_cast<std::size_t>(length));
+    unsigned char* out = encoded.data();
+    i2d_SSL_SESSION(session, &out);
+    debug("MQTT: cached TLS session for {}", *host);
+    cache->sessions_.insert_or_assign(*host, std::move(encoded));
+    // The session was copied, OpenSSL keeps ownership.
+    return 0;
+}
+
+void tls_session_cache::on_info(const SSL* ssl, int where, int /*ret*/) {
+    if ((where & SSL_CB_HANDSHAKE_DONE) == 0) {
+        return;
+    }
+    // TLS 1.3 reports another HANDSHAKE_DONE for each ticket; count the
+    // handshake of each prepared connection once.
+    auto* cache = from(ssl);
+    if (cache == nullptr || cache->pending_ != ssl) {
+        return;
+    }
+    cache->pending_ = nullptr;
+    cache->handshakes_.inc();
+    if (SSL_session_reused(ssl) != 0) {
+        cache->resumed_.inc();
+    }
+}
+
+tls_session_cache* tls_session_cache::from(const SSL* ssl) {
+    return static_cast<tls_session_cache*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), cache_index()));
+}
+
+boost::asio::ssl::context make_tls_context(const mqtt_transport_options& options, tls_session_cache& cache) {
+    boost::asio::ssl::context context(boost::asio::ssl::context::tls_client);
+    context.set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 |
+                        boost::asio::ssl::context::no_sslv3 | boost::asio::ssl::context::no_tlsv1 |
+                        boost::asio::ssl::context::no_tlsv1_1);
+    if (options.verify_peer_) {
+        if (options.ca_file_.empty()) {
+            context.set_default_verify_paths();
+        } else {
+            context.load_verify_file(options.ca_file_);
+        }
+        context.set_verify_mode(boost::asio::ssl::verify_peer);
+    } else {
+        warning("MQTT: broker certificate is not verified");
+        context.set_verify_mode(boost::asio::ssl::verify_none);
+    }
+    cache.attach(context, options.resume_sessions_);
+    return context;
+}
+
+}  // namespace heos2mqtt
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "metrics/metrics.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/mqtt5/mqtt_client.hpp>
+#include <boost/mqtt5/websocket.hpp>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace heos2mqtt {
+
+// How mqtt_publisher reaches its brokers.
+enum class mqtt_transport {
+    tcp,
+    tls,
+    websocket,
+    websocket_tls,
+    // Chosen by a unix:///path broker address rather than by name.
+    unix_socket,
+};
+
+// "tcp", "tls", "ws" or "wss".
+std::optional<mqtt_transport> parse_mqtt_transport(std::string_view name);
+std::string_view to_string(mqtt_transport transport);
+
+struct mqtt_transport_options {
+    mqtt_transport transport_{mqtt_transport::tcp};
+    // PEM bundle of CAs to verify the broker with; empty uses the system's.
+    std::string ca_file_;
+    bool verify_peer_{true};
+    // Offer the last TLS session on reconnect for an abbreviated handshake.
+    bool resume_sessions_{true};
+    // Request path of the WebSocket upgrade.
+    std::string websocket_path_{"/mqtt"};
+};
+
+// Client side TLS session cache. Once attached to an SSL context, every
+// session the context establishes (including TLS 1.3 tickets, which arrive
+// after the handshake) is kept per server name, and prepare() offers it to
+// the next connection to that server so a reconnect skips the certificate
+// exchange and key agreement. Sessions are kept serialized, so a connection
+// that drops without a TLS shutdown does not spoil them. Not thread safe:
+// connections through an attached context must share a strand.
+class tls_session_cache {
+public:
+    explicit tls_session_cache(metrics::registry& registry = metrics::registry::get_default());
+
+    tls_session_cache(const tls_session_cache&) = delete;
+    tls_session_cache& operator=(const tls_session_cache&) = delete;
+
+    // Counts the handshakes made through context; with resume, also keeps
+    // and offers their sessions.
+    void attach(boost::asio::ssl::context& context, bool resume = true);
+    // Sets SNI to host and, when verifying, checks the certificate against
+    // it; an IP literal is matched against the certificate's IP addresses
+    // and sent without SNI. Then offers the session cached for host, if
+    // any. Connections through contexts without a cache skip the latter.
+    static void prepare(SSL* ssl, const std::string& host);
+
+    [[nodiscard]] std::size_t size() const {
+        return sessions_.size();
+    }
+
+private:
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+    static void on_info(const SSL* ssl, int where, int ret);
+    static tls_session_cache* from(const SSL* ssl);
+
+    std::map<std::string, std::vector<unsigned char>, std::less<>> sessions_;
+    const SSL* pending_{nullptr};
+    bool resume_{true};
+    metrics::counter& handshakes_;
+    metrics::counter& resumed_;
+};
+
+namespace detail {
+
+inline constexpr std::string_view unix_scheme = "unix://";
+
+// Boost.MQTT5 resolves and connects brokers as TCP endpoints. A Unix socket
+// path is registered under a placeholder port, the broker is given to the
+// client as 127.0.0.1:<port>, and unix_stream connects to the path that
+// port stands for instead. Registering a path again returns its port.
+std::uint16_t register_unix_socket(const std::string& path);
+// The path registered under port, or nullopt.
+std::optional<std::string> unix_socket_path(std::uint16_t port);
+
+}  // namespace detail
+
+// A Unix domain stream socket that Boost.MQTT5 can drive as if it were a TCP
+// socket: TCP socket options are ignored and a connect to a placeholder
+// endpoint from detail::register_unix_socket() goes to its path.
+class unix_stream {
+public:
+    using protocol_type = boost::asio::local::stream_protocol;
+    using executor_type = boost::asio::any_io_executor;
+
+    explicit unix_stream(const executor_type& executor) : socket_(executor) {}
+
+    executor_type get_executor() noexcept {
+        return socket_.get_executor();
+    }
+
+    [[nodiscard]] bool is_open() const {
+        return socket_.is_open();
+    }
+
+    void open(const boost::asio::ip::tcp& /*protocol*/, boost::system::error_code& ec) {
+        socket_.open(protocol_type{}, ec);
+    }
+
+    template <typename Option>
+    void set_option(const Option& /*option*/, boost::system::error_code& ec) {
+        ec = {};
+    }
+
+    void close(boost::system::error_code& ec) {
+        socket_.close(ec);
+    }
+
+    void shutdown(boost::asio::socket_base::shutdown_type what, boost::system::error_code& ec) {
+        socket_.shutdown(what, ec);
+    }
+
+    void cancel(boost::system::error_code& ec) {
+        socket_.cancel(ec);
+    }
+
+    // An unregistered port connects to an empty path, which fails.
+    template <typename CompletionToken>
+    auto async_connect(const boost::asio::ip::tcp::endpoint& endpoint, CompletionToken&& token) {
+        return socket_.async_connect(protocol_type::endpoint(detail::unix_socket_path(endpoint.port()).value_or("")),
+            std::forward<CompletionToken>(token));
+    }
+
+    template <typename MutableBufferSequence, typename CompletionToken>
+    auto async_read_some(const MutableBufferSequence& buffers, CompletionToken&& token) {
+        return socket_.async_read_some(buffers, std::forward<CompletionToken>(token));
+    }
+
+    template <typename ConstBufferSequence, typename CompletionToken>
+    auto async_write_some(const ConstBufferSequence& buffers, CompletionToken&& token) {
+        return socket_.async_write_some(buffers, std::forward<CompletionToken>(token));
+    }
+
+private:
+    protocol_type::socket socket_;
+};
+
+// The SSL context mqtt_publisher connects with, attached to cache. Throws
+// boost::system::system_error if the CA file cannot be loaded.
+boost::asio::ssl::context make_tls_context(const mqtt_transport_options& options, tls_session_cache& cache);
+
+}  // namespace heos2mqtt
+
+// Lets Boost.MQTT5 run the TLS handshake of asio::ssl streams, with SNI and
+// session resumption.
+namespace boost::mqtt5 {
+
+template <typename StreamBase>
+struct tls_handshake_type<boost::asio::ssl::stream<StreamBase>> {
+    static constexpr auto client = boost::asio::ssl::stream_base::client;
+    static constexpr auto server = boost::asio::ssl::stream_base::server;
+};
+
+template <typename StreamBase>
+void assign_tls_sni(const authority_path& ap,
+                    boost::asio::ssl::context& /*context*/,
+                    boost::asio::ssl::stream<StreamBase>& stream) {
+    heos2mqtt::tls_session_cache::prepare(stream.native_handle(), ap.host);
+}
+
+}  // namespace boost::mqtt5
@@ -0,0 +1,266 @@
+#include "probe_sweep.hpp"
+
+#include "heos_line.hpp"
+#include "logging/logging.hpp"
+#include "ssdp_resolver.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <string>
+
+namespace heos2mqtt {
+
+using namespace logging;
+
+namespace net = boost::asio;
+
+namespace {
+
+constexpr std::string_view probe_command = "heos://player/get_players\r\n";
+
+// Room for the get_players reply of a large system. A host that sends more
+// without a newline is not a HEOS device, and is not buffered further.
+constexpr std::size_t max_response_size = 16 * 1024;
+
+struct attempt {
+    explicit attempt(const net::strand<net::io_context::executor_type>& strand, net::ip::address_v4 host)
+      : socket_(strand)
+      , timer_(strand)
+      , response_(max_response_size)
+      , host_(host)
+    {}
+
+    net::ip::tcp::socket socket_;
+    net::steady_timer timer_;
+    net::streambuf response_;
+    net::ip::address_v4 host_;
+};
+
+}  // namespace
+
+std::optional<std::vector<net::ip::address_v4>> detail::parse_cidr(std::string_view text, std::size_t max_hosts) {
+    auto slash = text.find('/');
+    if (slash == std::string_view::npos) {
+        return std::nullopt;
+    }
+    boost::system::error_code ec;
+    auto network = net::ip::make_address_v4(std::string(text.substr(0, slash)), ec);
+    unsigned prefix = 0;
+    auto bits = text.substr(slash + 1);
+    auto [end, parse_ec] = std::from_chars(bits.data(), bits.data() + bits.size(), prefix);
+    if (ec || bits.empty() || parse_ec != std::errc{} || end != bits.data() + bits.size() || prefix > 32) {
+        return std::nullopt;
+    }
+
+    const std::uint64_t size = std::uint64_t{1} << (32 - prefix);
+    const auto mask = static_cast<std::uint32_t>(~(size - 1));
+    const auto first = network.to_uint() & mask;
+    std::uint64_t begin = first;
+    std::uint64_t end_address = first + size;
+    if (size > 2) {
+        // Skip the network and broadcast addresses.
+        ++begin;
+        --end_address;
+    }
+    if (end_address - begin > max_hosts) {
+        return std::nullopt;
+    }
+
+    std::vector<net::ip::address_v4> hosts;
+    hosts.reserve(static_cast<std::size_t>(end_address - begin));
+    for (auto address = begin; address < end_address; ++address) {
+        hosts.emplace_back(static_cast<std::uint32_t>(address));
+    }
+    return hosts;
+}
+
+struct probe_sweep::state : std::enable_shared_from_this<state> {
+    state(net::io_context& io,
+          std::vector<net::ip::address_v4> hosts,
+          net::ip::port_type port,
+          options opts,
+          metrics::registry& registry)
+      : strand_(net::make_strand(io))
+      , hosts_(std::move(hosts))
+      , port_(port)
+      , options_(opts)
+      , probes_(registry.add_counter("heos_probes_total", "TCP connects attempted by the discovery sweep"))
+      , found_(registry.add_counter("heos_probe_found_total", "HEOS devices found by the discovery sweep"))
+      , sweep_seconds_(registry.add_histogram("heos_probe_seconds", "Time from the start of a sweep to its result"))
+    {
+        options_.concurrency_ = std::max<std::size_t>(options_.concurrency_, 1);
+    }
+
+    void begin(completion_handler_type handler);
+    void launch();
+    void start_attempt(net::ip::address_v4 host);
+    void handle_connect(const std::shared_ptr<attempt>& probe, const boost::system::error_code& ec);
+    void handle_response(const std::shared_ptr<attempt>& probe, const boost::system::error_code& ec);
+    void end_attempt(const std::shared_ptr<attempt>& probe);
+    void finish(const boost::system::error_code& ec, net::ip::address address);
+
+    net::strand<net::io_context::executor_type> strand_;
+    const std::vector<net::ip::address_v4> hosts_;
+    net::ip::port_type port_;
+    options options_;
+    completion_handler_type handler_;
+    std::vector<std::shared_ptr<attempt>> active_;
+    std::size_t next_host_{0};
+    std::chrono::steady_clock::time_point started_;
+    metrics::counter& probes_;
+    metrics::counter& found_;
+    metrics::histogram& sweep_seconds_;
+};
+
+probe_sweep::probe_sweep(net::io_context& io,
+                         std::vector<net::ip::address_v4> hosts,
+                         net::ip::port_type port,
+                         options opts,
+                         metrics::registry& registry)
+  : state_(std::make_shared<state>(io, std::move(hosts), port, opts, registry))
+{}
+
+probe_sweep::~probe_sweep() {
+    // The sweep state lives on until its operations have seen their sockets
+    // close.
+    auto strand = state_->strand_;
+    net::dispatch(strand, [self = std::move(state_)]() {
+        self->finish(net::error::operation_aborted, {});
+    });
+}
+
+std::size_t probe_sweep::host_count() const {
+    return state_->hosts_.size();
+}
+
+void probe_sweep::begin_probe(completion_handler_type handler) {
+    state_->begin(std::move(handler));
+}
+
+void probe_sweep::state::begin(completion_handler_type handler) {
+    net::dispatch(strand_, [self = shared_from_this(), handler = std::move(handler)]() mutable {
+        if (self->handler_) {
+            net::post(self->strand_, net::append(std::move(handler),
+                make_error_code(boost::system::errc::operation_in_progress), net::ip::address{}));
+            return;
+        }
+        self->handler_ = std::move(handler);
+        self->next_host_ = 0;
+        self->started_ = std::chrono::steady_clock::now();
+        info("probe: sweeping {} hosts on port {}", self->hosts_.size(), self->port_);
+        self->launch();
+        if (self->active_.empty()) {
+            self->finish(net::error::host_not_found, {});
+        }
+    });
+}
+
+void probe_sweep::state::launch() {
+    while (handler_ && active_.size() < options_.concurrency_ && next_host_ < hosts_.size()) {
+        start_attempt(hosts_[next_host_++]);
+    }
+}
+
+void probe_sweep::state::start_attempt(net::ip::address_v4 host) {
+    auto probe = std::make_shared<attempt>(strand_, host);
+    active_.push_back(probe);
+    probes_.inc();
+
+    // The timer bounds the connect and then the verification; closing the
+    // socket fails whichever operation is pending.
+    probe->timer_.expires_after(options_.connect_timeout_);
+    probe->timer_.async_wait([probe](const boost::system::error_code& ec) {
+        if (!ec) {
+            boost::system::error_code ignored;
+            probe->socket_.close(ignored);
+        }
+    });
+    probe->socket_.async_connect(net::ip::tcp::endpoint(host, port_),
+        [self = shared_from_this(), probe](const boost::system::error_code& ec) {
+            self->handle_connect(probe, ec);
+        });
+}
+
+void probe_sweep::state::handle_connect(const std::shared_ptr<attempt>& probe, const boost::system::error_code& ec) {
+    if (ec || !handler_) {
+        end_attempt(probe);
+        return;
+    }
+    debug("probe: {} accepted, verifying", detail::log_address(probe->host_));
+    probe->timer_.expires_after(options_.verify_timeout_);
+    probe->timer_.async_wait([probe](const boost::system::error_code& timer_ec) {
+        if (!timer_ec) {
+            boost::system::error_code ignored;
+            probe->socket_.close(ignored);
+        }
+    });
+    net::async_write(probe->socket_, net::buffer(probe_command),
+        [self = shared_from_this(), probe](const boost::system::error_code& write_ec, std::size_t /*bytes*/) {
+            if (write_ec) {
+                self->end_attempt(probe);
+                return;
+            }
+            net::async_read_until(probe->socket_, probe->response_, '\n',
+                [self, probe](const boost::system::error_code& read_ec, std::size_t /*bytes*/) {
+                    self->handle_response(probe, read_ec);
+                });
+        });
+}
+
+void probe_sweep::state::handle_response(const std::shared_ptr<attempt>& probe, const boost::system::error_code& ec) {
+    if (ec == net::error::not_found) {
+        debug("probe: {} sent no line within {} bytes", detail::log_address(probe->host_), max_response_size);
+    }
+    if (ec || !handler_) {
+        end_attempt(probe);
+        return;
+    }
+    auto data = probe->response_.data();
+    std::string line(net::buffers_begin(data), net::buffers_end(data));
+    if (scan_heos_line(line).command_ != "player/get_players") {
+        debug("probe: {} is not a HEOS device", detail::log_address(probe->host_));
+        end_attempt(probe);
+        return;
+    }
+    info("probe: found HEOS device at {}", detail::log_address(probe->host_));
+    found_.inc();
+    auto host = probe->host_;
+    end_attempt(probe);
+    finish({}, host);
+}
+
+void probe_sweep::state::end_attempt(const std::shared_ptr<attempt>& probe) {
+    probe->timer_.cancel();
+    boost::system::error_code ignored;
+    probe->socket_.close(ignored);
+    // An attempt abandoned by finish() must not count against a later sweep.
+    if (std::erase(active_, probe) == 0 || !handler_) {
+        return;
+    }
+    launch();
+    if (active_.empty()) {
+        warning("probe: no HEOS device among {} hosts", hosts_.size());
+        finish(net::error::host_not_found, {});
+    }
+}
+
+void probe_sweep::state::finish(const boost::system::error_code& ec, net::ip::address address) {
+    // Abandon the rest of the sweep; the attempts end as their operations
+    // fail.
+    for (const auto& probe : active_) {
+        boost::system::error_code ignored;
+        probe->socket_.close(ignored);
+        probe->timer_.cancel();
+    }
+    active_.clear();
+    if (!handler_) {
+        return;
+    }
+    sweep_seconds_.observe(std::chrono::steady_clock::now() - started_);
+    auto handler = std::move(handler_);
+    handler_ = {};
+    // Runs the handler on its own executor, not the sweep's strand.
+    net::post(strand_, net::append(std::move(handler), ec, address));
+}
+
+}  // namespace heos2mqtt
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "metrics/metrics.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/asio/any_completion_handler.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace heos2mqtt {
+
+namespace detail {
+
+// The host addresses of an IPv4 CIDR block such as "192.168.1.0/24", in
+// order and without the network and broadcast addresses for prefixes
+// shorter than /31. Returns nullopt if text is not a valid block or it
+// holds more than max_hosts addresses.
+std::optional<std::vector<boost::asio::ip::address_v4>> parse_cidr(std::string_view text,
+                                                                   std::size_t max_hosts = 65536);
+
+}  // namespace detail
+
+// Discovery for networks that filter multicast: connects to the HEOS CLI
+// port of every address in a list, a bounded number at a time, and
+// completes with the first one that answers heos://player/get_players like
+// a HEOS device. Completes with host_not_found once every address has
+// failed, and with operation_aborted if it is destroyed mid-sweep.
+class probe_sweep {
+public:
+    using completion_handler_type =
+        boost::asio::any_completion_handler<void(boost::system::error_code, boost::asio::ip::address)>;
+
+    struct options {
+        std::size_t concurrency_{128};
+        // Limits the connect; a host that accepts then gets verify_timeout_
+        // to answer.
+        std::chrono::steady_clock::duration connect_timeout_{std::chrono::milliseconds(250)};
+        std::chrono::steady_clock::duration verify_timeout_{std::chrono::milliseconds(500)};
+    };
+
+    probe_sweep(boost::asio::io_context& io,
+                std::vector<boost::asio::ip::address_v4> hosts,
+                boost::asio::ip::port_type port,
+                options opts,
+                metrics::registry& registry = metrics::registry::get_default());
+    probe_sweep(boost::asio::io_context& io,
+                std::vector<boost::asio::ip::address_v4> hosts,
+                boost::asio::ip::port_type port)
+      : probe_sweep(io, std::move(hosts), port, options{})
+    {}
+    ~probe_sweep();
+
+    probe_sweep(const probe_sweep&) = delete;
+    probe_sweep& operator=(const probe_sweep&) = delete;
+
+    // One sweep at a time: a second call while one is running completes
+    // with operation_in_progress.
+    template <boost::asio::completion_token_for<void(boost::system::error_code, boost::asio::ip::address)> CompletionToken>
+    auto async_probe(CompletionToken&& token) // NOLINT(cppcoreguidelines-missing-std-forward)
+    {
+        auto initiation = [this](auto&& handler) {
+            this->begin_probe(completion_handler_type(std::forward<decltype(handler)>(handler)));
+        };
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, boost::asio::ip::address)>(
+            initiation, token);
+    }
+
+    [[nodiscard]] std::size_t host_count() const;
+
+private:
+    struct state;
+
+    void begin_probe(completion_handler_type handler);
+
+    // Held by every pending operation as well, so that their handlers stay
+    // valid after this object is destroyed or replaced.
+    std::shared_ptr<state> state_;
+};
+
+}  // namespace heos2mqtt
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "logging/logging.hpp"
+#include "metrics/metrics.hpp"
 
 #include <boost/asio/any_completion_handler.hpp>
+#include <boost/asio/associated_cancellation_slot.hpp>
+#include <boost/asio/associated_executor.hpp>
 #include <boost/asio/async_result.hpp>
 #include <boost/asio/bind_allocator.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/cancellation_signal.hpp>
 #include <boost/asio/ip/address.hpp>
 #include <boost/asio/ip/multicast.hpp>
 #include <boost/asio/ip/udp.hpp>
@@ -13,14 +17,28 @@
 #include <boost/asio/strand.hpp>
 #include <boost/beast/http.hpp>
 
-#include <fmt/ostream.h>
+#include <fmt/core.h>
 
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
+#include <variant>
+#include <vector>
 
 namespace heos2mqtt {
 
@@ -28,21 +46,148 @@ namespace net = boost::asio;
 namespace http = boost::beast::http;
 using namespace logging;
 
+namespace detail {
+
+// Trivially copyable snapshot of an IP address, so that log calls can
+// capture it by value and format it on the logging thread.
+struct log_address {
+    log_address() = default;
+    explicit log_address(const net::ip::address& address)
+      : v6_(address.is_v6())
+    {
+        if (v6_) {
+            bytes_ = address.to_v6().to_bytes();
+        } else {
+            auto v4 = address.to_v4().to_bytes();
+            std::copy(v4.begin(), v4.end(), bytes_.begin());
+        }
+    }
+
+    [[nodiscard]] net::ip::address to_address() const {
+        if (v6_) {
+            return net::ip::address_v6(bytes_);
+        }
+        return net::ip::address_v4({bytes_[0], bytes_[1], bytes_[2], bytes_[3]});
+    }
+
+    net::ip::address_v6::bytes_type bytes_{};
+    bool v6_{false};
+};
+
+}  // namespace detail
+}  // namespace heos2mqtt
+
+namespace logging {
+template <> struct is_deferrable<heos2mqtt::detail::log_address> : std::true_type {};
+}
+
+namespace fmt {
+template <> struct formatter<heos2mqtt::detail::log_address> : formatter<std::string_view> {
+    auto format(const heos2mqtt::detail::log_address& address, format_context& ctx) const
+    -> format_context::iterator {
+        return formatter<std::string_view>::format(address.to_address().to_string(), ctx);
+    }
+};
+}
+
+namespace heos2mqtt {
+
+// A device that answered a search, as described by its SSDP response.
+struct ssdp_device {
+    // The UPnP default when a response has no usable CACHE-CONTROL.
+    static constexpr std::chrono::seconds default_max_age{1800};
+
+    net::ip::address address_;
+    std::string search_target_;
+    // Unique service name, stable for the lifetime of the device.
+    std::string usn_;
+    // URL of the UPnP device description.
+    std::string location_;
+    // How long the response, and what it points to, stays valid.
+    std::chrono::seconds max_age_{default_max_age};
+};
+
+namespace detail {
+
+// The ST, USN, LOCATION and CACHE-CONTROL max-age of payload if it is a
+// 200 OK SSDP response with an ST header. The address is left empty.
+inline std::optional<ssdp_device> parse_ssdp_response(std::string_view payload);
+
+// True if payload is a 200 OK SSDP response whose ST header equals
+// search_target.
+inline bool ssdp_response_matches(std::string_view payload, std::string_view search_target);
+
+// Process-wide SSDP metrics, registered on first use.
+struct ssdp_metrics {
+    static ssdp_metrics& get() {
+        static ssdp_metrics instance(metrics::registry::get_default());
+        return instance;
+    }
+
+    explicit ssdp_metrics(metrics::registry& registry)
+      : searches_(registry.add_counter("ssdp_searches_total", "M-SEARCH requests sent"))
+      , coalesced_(registry.add_counter("ssdp_coalesced_total", "Resolves that joined a search already in progress"))
+      , responses_(registry.add_counter("ssdp_responses_total", "SSDP responses received"))
+      , mismatches_(registry.add_counter("ssdp_mismatches_total", "SSDP responses for another search target"))
+      , timeouts_(registry.add_counter("ssdp_timeouts_total", "Searches that timed out without a match"))
+      , errors_(registry.add_counter("ssdp_errors_total", "Searches that failed with a socket error"))
+      , resolve_seconds_(registry.add_histogram("ssdp_resolve_seconds", "Time from M-SEARCH to a matching response"))
+    {}
+
+    metrics::counter& searches_;
+    metrics::counter& coalesced_;
+    metrics::counter& responses_;
+    metrics::counter& mismatches_;
+    metrics::counter& timeouts_;
+    metrics::counter& errors_;
+    metrics::histogram& resolve_seconds_;
+};
+
+}  // namespace detail
+
 inline const net::ip::udp::endpoint default_ssdp_endpoint(
     net::ip::make_address("239.255.255.250"), static_cast<net::ip::port_type>(1900));
 
+// The IPv6 link-local SSDP multicast group.
+inline const net::ip::udp::endpoint default_ssdp_endpoint_v6(
+    net::ip::make_address("ff02::c"), static_cast<net::ip::port_type>(1900));
+
+// A local address to search from.
+struct ssdp_interface {
+    std::string name_;
+    net::ip::address address_;
+    unsigned int index_{0};
+};
+
+// The IPv4 addresses and IPv6 link-local addresses of every interface that
+// is up, multicast capable and not a loopback.
+inline std::vector<ssdp_interface> multicast_interfaces();
+
+// Resolves SSDP search targets to the address of the first device that
+// answers. Any number of resolves may be outstanding at once, each with its
+// own search target and timeout: they share one socket per interface, a
+// single M-SEARCH is sent per distinct search target on every interface at
+// once, and every resolve whose target a response matches completes with
+// that response, whichever interface it arrived on. A resolve whose
+// cancellation slot is emitted completes with operation_aborted, leaving
+// the others running.
 class ssdp_resolver {
 public:
     using udp = net::ip::udp;
     using completion_handler_type =
         net::any_completion_handler<void(boost::system::error_code, net::ip::address)>;
+    using device_handler_type =
+        net::any_completion_handler<void(boost::system::error_code, ssdp_device)>;
 
     static constexpr std::chrono::seconds default_timeout {3};
+    // The MX value of each M-SEARCH. A resolve joins a search for the same
+    // target sent within this window; after it, devices will have answered
+    // already, so the search is repeated.
+    static constexpr std::chrono::seconds search_window {2};
 
     ssdp_resolver(net::io_context& io, udp::endpoint endpoint = default_ssdp_endpoint)
       : strand_(net::make_strand(io))
-      , socket_(io)
-      , timer_(io)
+      , timer_(strand_)
       , target_endpoint_(std::move(endpoint))
     {}
 
@@ -50,6 +195,17 @@ public:
         outbound_interface_ = std::move(iface);
     }
 
+    // Searches from each of these addresses in parallel, instead of from
+    // one socket bound to any address. IPv4 addresses search the resolver's
+    // endpoint; IPv6 addresses search it if it is IPv6, otherwise
+    // v6_endpoint scoped to their interface. Must be called while no
+    // resolve is in progress.
+    void set_interfaces(std::vector<ssdp_interface> interfaces,
+                        udp::endpoint v6_endpoint = default_ssdp_endpoint_v6) {
+        interfaces_ = std::move(interfaces);
+        v6_endpoint_ = std::move(v6_endpoint);
+    }
+
     template <net::completion_token_for<void(boost::system::error_code, net::ip::address)> CompletionToken>
     auto async_resolve(std::string_view search_target,
         std::chrono::steady_clock::duration timeout,
@@ -66,158 +222,472 @@ public:
       return async_resolve(search_target, default_timeout, std::forward<CompletionToken>(token));
     }
 
+    // As async_resolve, but completes with everything the response says
+    // about the device, not just its address.
+    template <net::completion_token_for<void(boost::system::error_code, ssdp_device)> CompletionToken>
+    auto async_resolve_device(std::string_view search_target,
+        std::chrono::steady_clock::duration timeout,
+        CompletionToken&& token) // NOLINT(cppcoreguidelines-missing-std-forward)
+    {
+        auto initiation = [this, search_target = std::string(search_target), timeout](auto&& handler) mutable {
+          this->begin_resolve(std::move(search_target), timeout,
+              device_handler_type(std::forward<decltype(handler)>(handler)));
+        };
+        return net::async_initiate<CompletionToken, void(boost::system::error_code, ssdp_device)>(initiation, token);
+    }
+
+    template <net::completion_token_for<void(boost::system::error_code, ssdp_device)> CompletionToken>
+    auto async_resolve_device(std::string_view search_target, CompletionToken&& token) {
+      return async_resolve_device(search_target, default_timeout, std::forward<CompletionToken>(token));
+    }
+
 private:
+    using clock = std::chrono::steady_clock;
+
+    struct waiter {
+        std::uint64_t id_{0};
+        std::string search_target_;
+        clock::time_point started_;
+        clock::time_point deadline_;
+        std::variant<completion_handler_type, device_handler_type> handler_;
+        // Cleared on the handler's executor just before it is called, so
+        // that a late cancellation cannot reach a completed resolve.
+        net::cancellation_slot slot_;
+    };
+
+    struct search {
+        std::string search_target_;
+        clock::time_point sent_;
+        std::size_t failed_sends_{0};
+    };
+
+    // One socket and the endpoint it searches.
+    struct channel {
+        explicit channel(const net::strand<net::io_context::executor_type>& strand)
+          : socket_(strand)
+        {}
+
+        udp::socket socket_;
+        udp::endpoint target_;
+        udp::endpoint sender_;
+        std::array<char, 2048> buffer_{};
+    };
+
     template <typename Handler>
     void begin_resolve(std::string&& search_target,
                        std::chrono::steady_clock::duration timeout,
                        Handler&& handler);
 
-    void schedule_receive();
-    void handle_receive(const boost::system::error_code& ec, std::size_t bytes);
+    bool open_channels();
+    bool open_channel(const std::optional<ssdp_interface>& iface, boost::system::error_code& ec);
+    void close_channels();
+    void send_search(const std::string& search_target);
+    void handle_send(const boost::system::error_code& ec, const std::string& search_target, std::uint64_t generation);
+    [[nodiscard]] static std::string build_request(const udp::endpoint& target, std::string_view search_target);
+    void schedule_receive(std::shared_ptr<channel> receiver);
+    void handle_receive(const boost::system::error_code& ec, std::size_t bytes, channel& receiver);
+    void arm_timer();
     void handle_timeout(const boost::system::error_code& ec);
-    void finish(const boost::system::error_code& ec, net::ip::address address);
-    [[nodiscard]] bool response_matches(std::string_view payload) const;
+    void handle_cancel(std::uint64_t id);
+    // Completes and removes the waiters for which predicate is true, then
+    // drops searches nobody waits for and closes the sockets once idle.
+    template <typename Predicate>
+    std::size_t complete_if(Predicate predicate, const boost::system::error_code& ec, const ssdp_device& device);
 
     net::strand<net::io_context::executor_type> strand_;
-    udp::socket socket_;
     net::steady_timer timer_;
-    udp::endpoint sender_;
-    std::array<char, 2048> buffer_{};
-    completion_handler_type handler_;
-    std::chrono::steady_clock::duration timeout_{std::chrono::seconds(3)};
-    std::string request_;
-    std::string search_target_;
+    // Shared with their pending receives, which may outlive a close.
+    std::vector<std::shared_ptr<channel>> channels_;
+    std::vector<waiter> waiters_;
+    std::vector<search> searches_;
     udp::endpoint target_endpoint_;
+    udp::endpoint v6_endpoint_{default_ssdp_endpoint_v6};
     std::optional<net::ip::address_v4> outbound_interface_;
-    bool resolving_{false};
+    std::vector<ssdp_interface> interfaces_;
+    // Bumped whenever the sockets close, so that completions of operations
+    // on previous sockets are ignored.
+    std::uint64_t generation_{0};
+    // Identifies waiters to their cancellation handlers, which may run on
+    // any thread.
+    std::atomic<std::uint64_t> next_waiter_id_{0};
 };
 
 template <typename Handler>
 void ssdp_resolver::begin_resolve(std::string&& search_target,
                                   std::chrono::steady_clock::duration timeout,
                                   Handler&& handler) {
-    completion_handler_type completion(std::forward<Handler>(handler));
+    // The slot belongs to the caller's thread, so it is connected here
+    // rather than on the strand.
+    auto slot = net::get_associated_cancellation_slot(handler);
+    auto id = ++next_waiter_id_;
+    if (slot.is_connected()) {
+        slot.assign([this, id](net::cancellation_type /*type*/) {
+            net::dispatch(strand_, [this, id]() { handle_cancel(id); });
+        });
+    }
+    std::variant<completion_handler_type, device_handler_type> completion;
+    if constexpr (std::is_same_v<std::decay_t<Handler>, device_handler_type>) {
+        completion = std::forward<Handler>(handler);
+    } else {
+        completion = completion_handler_type(std::forward<Handler>(handler));
+    }
     net::dispatch(
-        strand_, [this, search_target = std::move(search_target), timeout,
-                  completion = std::move(completion)]() mutable {
-            if (resolving_) {
-                auto ec = make_error_code(boost::system::errc::operation_in_progress);
-                auto handler = std::move(completion);
-                net::post(strand_, [handler = std::move(handler), ec]() mutable {
-                    if (handler) {
-                        handler(ec, net::ip::address{});
-                    }
-                });
+        strand_, [this, id, search_target = std::move(search_target), timeout,
+                  completion = std::move(completion), slot]() mutable {
+            auto now = clock::now();
+            waiters_.push_back({id, std::move(search_target), now, now + timeout, std::move(completion), slot});
+            if (channels_.empty() && !open_channels()) {
                 return;
             }
+            send_search(waiters_.back().search_target_);
+            arm_timer();
+        });
+}
 
-            resolving_ = true;
-            handler_ = std::move(completion);
-            timeout_ = timeout;
-            search_target_ = std::move(search_target);
-
-            request_.clear();
-            request_.reserve(256);
-            request_.append("M-SEARCH * HTTP/1.1\r\nHOST: ");
-            auto target_addr = target_endpoint_.address();
-            if (target_addr.is_v6()) {
-                request_.push_back('[');
-                request_.append(target_addr.to_string());
-                request_.push_back(']');
-            } else {
-                request_.append(target_addr.to_string());
-            }
-            request_.push_back(':');
-            request_.append(std::to_string(target_endpoint_.port()));
-            request_.append("\r\nMAN: \"ssdp:discover\"\r\nMX: 2\r\nST: ");
-            request_.append(search_target_);
-            request_.append("\r\n\r\n");
-
-            debug("SSDP: sending search to {}:{} (ST: {})",
-                target_endpoint_.address().to_string(),
-                target_endpoint_.port(),
-                search_target_);
-
-            socket_.open(target_endpoint_.protocol());
-            socket_.set_option(net::socket_base::reuse_address(true));
-            socket_.bind(udp::endpoint(target_endpoint_.protocol(), 0));
-            if (target_endpoint_.address().is_multicast() && target_endpoint_.protocol() == udp::v4() && outbound_interface_) {
-                socket_.set_option(
-                    net::ip::multicast::outbound_interface(outbound_interface_->to_uint()));
-            }
+inline bool ssdp_resolver::open_channels() {
+    boost::system::error_code ec;
+    if (interfaces_.empty()) {
+        open_channel(std::nullopt, ec);
+    }
+    for (const auto& iface : interfaces_) {
+        if (!open_channel(iface, ec)) {
+            warning("SSDP: cannot search from {} ({}): {}", iface.name_, detail::log_address(iface.address_), ec.message());
+        }
+    }
+    if (channels_.empty()) {
+        if (!ec) {
+            ec = make_error_code(boost::system::errc::address_family_not_supported);
+        }
+        warning("SSDP: cannot open socket: {}", ec.message());
+        detail::ssdp_metrics::get().errors_.inc();
+        complete_if([](const waiter&) { return true; }, ec, {});
+        return false;
+    }
+    for (const auto& opened : channels_) {
+        schedule_receive(opened);
+    }
+    return true;
+}
 
-            socket_.async_send_to(
-                net::buffer(request_), target_endpoint_,
-                net::bind_executor(
-                    strand_, [this](const boost::system::error_code& send_ec, std::size_t /*bytes*/) {
-                        if (send_ec) {
-                            finish(send_ec, {});
-                            return;
-                        }
-                        timer_.expires_after(timeout_);
-                        timer_.async_wait(net::bind_executor(
-                            strand_, [this](const boost::system::error_code& timer_ec) {
-                                handle_timeout(timer_ec);
-                            }));
-                        schedule_receive();
-                    }));
-        });
+inline bool ssdp_resolver::open_channel(const std::optional<ssdp_interface>& iface, boost::system::error_code& ec) {
+    auto opened = std::make_shared<channel>(strand_);
+    opened->target_ = target_endpoint_;
+    udp::endpoint local(target_endpoint_.protocol(), 0);
+    if (iface) {
+        if (iface->address_.is_v6() && target_endpoint_.protocol() == udp::v4()) {
+            opened->target_ = v6_endpoint_;
+        } else if (iface->address_.is_v4() != (target_endpoint_.protocol() == udp::v4())) {
+            // Nothing to search for from this address.
+            return true;
+        }
+        local = udp::endpoint(iface->address_, 0);
+        auto target_address = opened->target_.address();
+        if (target_address.is_v6() && target_address.to_v6().is_multicast_link_local()) {
+            auto scoped = target_address.to_v6();
+            scoped.scope_id(iface->index_);
+            opened->target_.address(scoped);
+        }
+    }
+
+    auto& socket = opened->socket_;
+    socket.open(opened->target_.protocol(), ec);
+    if (!ec) {
+        socket.set_option(net::socket_base::reuse_address(true), ec);
+    }
+    if (!ec) {
+        socket.bind(local, ec);
+    }
+    if (!ec && opened->target_.address().is_multicast()) {
+        if (iface && iface->address_.is_v6()) {
+            socket.set_option(net::ip::multicast::outbound_interface(iface->index_), ec);
+        } else if (iface) {
+            socket.set_option(net::ip::multicast::outbound_interface(iface->address_.to_v4()), ec);
+        } else if (opened->target_.protocol() == udp::v4() && outbound_interface_) {
+            socket.set_option(net::ip::multicast::outbound_interface(*outbound_interface_), ec);
+        }
+    }
+    if (ec) {
+        return false;
+    }
+    channels_.push_back(std::move(opened));
+    return true;
 }
 
-inline void ssdp_resolver::schedule_receive() {
-    socket_.async_receive_from(
-        net::buffer(buffer_), sender_,
+inline void ssdp_resolver::close_channels() {
+    ++generation_;
+    timer_.cancel();
+    searches_.clear();
+    for (const auto& closing : channels_) {
+        boost::system::error_code ignored;
+        closing->socket_.close(ignored);
+    }
+    channels_.clear();
+}
+
+inline void ssdp_resolver::send_search(const std::string& search_target) {
+    auto& stats = detail::ssdp_metrics::get();
+    auto now = clock::now();
+    auto it = std::find_if(searches_.begin(), searches_.end(), [&](const search& candidate) {
+        return candidate.search_target_ == search_target;
+    });
+    if (it != searches_.end() && now - it->sent_ < search_window) {
+        debug("SSDP: joining search in progress (ST: {})", search_target);
+        stats.coalesced_.inc();
+        return;
+    }
+    if (it == searches_.end()) {
+        searches_.push_back({search_target, now});
+    } else {
+        it->sent_ = now;
+        it->failed_sends_ = 0;
+    }
+
+    for (const auto& sender : channels_) {
+        if (!sender->socket_.is_open()) {
+            continue;
+        }
+        debug("SSDP: sending search to {}:{} (ST: {})",
+            detail::log_address(sender->target_.address()),
+            sender->target_.port(),
+            search_target);
+
+        stats.searches_.inc();
+        auto request = std::make_shared<const std::string>(build_request(sender->target_, search_target));
+        sender->socket_.async_send_to(
+            net::buffer(*request), sender->target_,
+            net::bind_executor(
+                strand_, [this, request, search_target, generation = generation_](
+                             const boost::system::error_code& send_ec, std::size_t /*bytes*/) {
+                    handle_send(send_ec, search_target, generation);
+                }));
+    }
+}
+
+inline void ssdp_resolver::handle_send(const boost::system::error_code& ec,
+                                       const std::string& search_target,
+                                       std::uint64_t generation) {
+    if (!ec || generation != generation_) {
+        return;
+    }
+    warning("SSDP: send error: {}", ec.message());
+    detail::ssdp_metrics::get().errors_.inc();
+    auto it = std::find_if(searches_.begin(), searches_.end(), [&](const search& candidate) {
+        return candidate.search_target_ == search_target;
+    });
+    // Fail the search only once it has failed on every interface.
+    if (it == searches_.end() || ++it->failed_sends_ < channels_.size()) {
+        return;
+    }
+    complete_if([&](const waiter& candidate) { return candidate.search_target_ == search_target; }, ec, {});
+}
+
+inline std::string ssdp_resolver::build_request(const udp::endpoint& target, std::string_view search_target) {
+    std::string request;
+    request.reserve(256);
+    request.append("M-SEARCH * HTTP/1.1\r\nHOST: ");
+    auto target_addr = target.address();
+    if (target_addr.is_v6()) {
+        // The HOST header carries the group without a zone index.
+        auto unscoped = target_addr.to_v6();
+        unscoped.scope_id(0);
+        request.push_back('[');
+        request.append(unscoped.to_string());
+        request.push_back(']');
+    } else {
+        request.append(target_addr.to_string());
+    }
+    request.push_back(':');
+    request.append(std::to_string(target.port()));
+    request.append("\r\nMAN: \"ssdp:discover\"\r\nMX: ");
+    request.append(std::to_string(search_window.count()));
+    request.append("\r\nST: ");
+    request.append(search_target);
+    request.append("\r\n\r\n");
+    return request;
+}
+
+inline void ssdp_resolver::schedule_receive(std::shared_ptr<channel> receiver) {
+    auto& socket = receiver->socket_;
+    auto& buffer = receiver->buffer_;
+    auto& sender = receiver->sender_;
+    socket.async_receive_from(
+        net::buffer(buffer), sender,
         net::bind_executor(
-            strand_, [this](const boost::system::error_code& ec, std::size_t bytes) {
-                handle_receive(ec, bytes);
+            strand_, [this, receiver = std::move(receiver), generation = generation_](
+                         const boost::system::error_code& ec, std::size_t bytes) mutable {
+                if (generation != generation_) {
+                    return;
+                }
+                handle_receive(ec, bytes, *receiver);
+                if (generation == generation_ && receiver->socket_.is_open()) {
+                    schedule_receive(std::move(receiver));
+                }
             }));
 }
 
-inline void ssdp_resolver::handle_receive(const boost::system::error_code& ec, std::size_t bytes) {
+inline void ssdp_resolver::handle_receive(const boost::system::error_code& ec, std::size_t bytes, channel& receiver) {
+    auto& stats = detail::ssdp_metrics::get();
     if (ec) {
+        if (ec != net::error::operation_aborted) {
+            stats.errors_.inc();
+        }
         logging::warning("SSDP: receive error: {}", ec.message());
-        finish(ec, {});
+        boost::system::error_code ignored;
+        receiver.socket_.close(ignored);
+        // Carry on while any interface is still listening.
+        if (std::none_of(channels_.begin(), channels_.end(), [](const auto& candidate) {
+                return candidate->socket_.is_open();
+            })) {
+            complete_if([](const waiter&) { return true; }, ec, {});
+        }
         return;
     }
 
-    std::string_view payload(buffer_.data(), bytes);
-    debug("SSDP: received {} bytes from {}", bytes, fmt::streamed(sender_.address()));
-    if (response_matches(payload)) {
-        info("SSDP: matched response from {}", fmt::streamed(sender_.address()));
-        finish({}, sender_.address());
+    std::string_view payload(receiver.buffer_.data(), bytes);
+    auto sender = receiver.sender_.address();
+    stats.responses_.inc();
+    debug("SSDP: received {} bytes from {}", bytes, detail::log_address(sender));
+    auto device = detail::parse_ssdp_response(payload);
+    std::size_t matched = 0;
+    if (device) {
+        device->address_ = sender;
+        matched = complete_if([&](const waiter& candidate) { return candidate.search_target_ == device->search_target_; },
+            {}, *device);
+    }
+    if (matched != 0) {
+        info("SSDP: matched response from {} for {} resolve(s)", detail::log_address(sender), matched);
+    } else {
+        stats.mismatches_.inc();
+        debug("SSDP: response did not match a search in progress");
+    }
+}
+
+inline void ssdp_resolver::arm_timer() {
+    if (waiters_.empty()) {
         return;
     }
-    debug("SSDP: response did not match search target");
-    schedule_receive();
+    auto earliest = std::min_element(waiters_.begin(), waiters_.end(), [](const waiter& a, const waiter& b) {
+        return a.deadline_ < b.deadline_;
+    });
+    timer_.expires_at(earliest->deadline_);
+    timer_.async_wait(net::bind_executor(
+        strand_, [this](const boost::system::error_code& timer_ec) {
+            handle_timeout(timer_ec);
+        }));
 }
 
 inline void ssdp_resolver::handle_timeout(const boost::system::error_code& ec) {
     if (ec == net::error::operation_aborted) {
         return;
     }
-    warning("SSDP: discovery timed out");
-    finish(make_error_code(net::error::timed_out), {});
+    auto now = clock::now();
+    auto expired = complete_if([&](const waiter& candidate) {
+            if (candidate.deadline_ > now) {
+                return false;
+            }
+            warning("SSDP: discovery timed out (ST: {})", candidate.search_target_);
+            return true;
+        },
+        make_error_code(net::error::timed_out), {});
+    detail::ssdp_metrics::get().timeouts_.inc(expired);
 }
 
-inline void ssdp_resolver::finish(const boost::system::error_code& ec, net::ip::address address) {
-    if (!resolving_) {
-        return;
+inline void ssdp_resolver::handle_cancel(std::uint64_t id) {
+    auto cancelled = complete_if([&](const waiter& candidate) { return candidate.id_ == id; },
+        make_error_code(net::error::operation_aborted), {});
+    if (cancelled != 0) {
+        debug("SSDP: resolve cancelled");
     }
-    resolving_ = false;
-    timer_.cancel();
-    boost::system::error_code ignored;
-    socket_.close(ignored);
-
-    auto handler = std::move(handler_);
-    handler_ = {};
-    net::post(strand_, [handler = std::move(handler), ec, address]() mutable {
-        if (handler) {
-            handler(ec, address);
+}
+
+template <typename Predicate>
+std::size_t ssdp_resolver::complete_if(Predicate predicate, const boost::system::error_code& ec, const ssdp_device& device) {
+    auto now = clock::now();
+    std::size_t completed = 0;
+    auto remaining = waiters_.begin();
+    for (auto& candidate : waiters_) {
+        if (!predicate(candidate)) {
+            if (&*remaining != &candidate) {
+                *remaining = std::move(candidate);
+            }
+            ++remaining;
+            continue;
         }
+        if (!ec) {
+            detail::ssdp_metrics::get().resolve_seconds_.observe(now - candidate.started_);
+        }
+        // The handler runs on its own executor, not on the resolver's
+        // strand. So does clearing its cancellation slot, which the caller
+        // may be emitting there.
+        std::visit([&](auto& handler) {
+            if (!handler) {
+                return;
+            }
+            auto executor = net::get_associated_executor(handler, strand_);
+            net::post(strand_, net::bind_executor(executor,
+                [handler = std::move(handler), slot = candidate.slot_, ec, device]() mutable {
+                    if (slot.is_connected()) {
+                        slot.clear();
+                    }
+                    if constexpr (std::is_same_v<std::decay_t<decltype(handler)>, device_handler_type>) {
+                        handler(ec, std::move(device));
+                    } else {
+                        handler(ec, device.address_);
+                    }
+                }));
+        }, candidate.handler_);
+        ++completed;
+    }
+    waiters_.erase(remaining, waiters_.end());
+
+    std::erase_if(searches_, [&](const search& candidate) {
+        return std::none_of(waiters_.begin(), waiters_.end(), [&](const waiter& pending) {
+            return pending.search_target_ == candidate.search_target_;
+        });
     });
+    if (waiters_.empty()) {
+        close_channels();
+    } else if (completed != 0) {
+        arm_timer();
+    }
+    return completed;
+}
+
+inline std::vector<ssdp_interface> multicast_interfaces() {
+    std::vector<ssdp_interface> interfaces;
+    ifaddrs* addresses = nullptr;
+    if (::getifaddrs(&addresses) != 0) {
+        warning("SSDP: cannot list interfaces");
+        return interfaces;
+    }
+    for (auto* entry = addresses; entry != nullptr; entry = entry->ifa_next) {
+        if (entry->ifa_addr == nullptr || (entry->ifa_flags & IFF_UP) == 0 ||
+            (entry->ifa_flags & IFF_MULTICAST) == 0 || (entry->ifa_flags & IFF_LOOPBACK) != 0) {
+            continue;
+        }
+        ssdp_interface iface{entry->ifa_name, {}, ::if_nametoindex(entry->ifa_name)};
+        if (entry->ifa_addr->sa_family == AF_INET) {
+            const auto* in = reinterpret_cast<const sockaddr_in*>(entry->ifa_addr); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            iface.address_ = net::ip::address_v4(ntohl(in->sin_addr.s_addr));
+        } else if (entry->ifa_addr->sa_family == AF_INET6) {
+            const auto* in6 = reinterpret_cast<const sockaddr_in6*>(entry->ifa_addr); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+            net::ip::address_v6::bytes_type bytes{};
+            std::memcpy(bytes.data(), &in6->sin6_addr, bytes.size());
+            net::ip::address_v6 address(bytes, iface.index_);
+            if (!address.is_link_local()) {
+                continue;
+            }
+            iface.address_ = address;
+        } else {
+            continue;
+        }
+        interfaces.push_back(std::move(iface));
+    }
+    ::freeifaddrs(addresses);
+    return interfaces;
 }
 
-inline bool ssdp_resolver::response_matches(std::string_view payload) const {
+inline std::optional<ssdp_device> detail::parse_ssdp_response(std::string_view payload) {
     http::response_parser<http::string_body> parser;
     parser.eager(true);
     parser.skip(true);
@@ -226,27 +696,56 @@ inline bool ssdp_resolver::response_matches(std::string_view payload) const {
     parser.put(net::buffer(payload.data(), payload.size()), ec);
     if (ec && ec != http::error::need_more) {
         debug("SSDP: parse error: {}", ec.message());
-        return false;
+        return std::nullopt;
     }
     if (!parser.is_header_done()) {
         debug("SSDP: incomplete response headers");
-        return false;
+        return std::nullopt;
     }
 
     const auto& response = parser.get();
     if (response.result() != http::status::ok) {
         debug("SSDP: non-OK response {}", response.result_int());
-        return false;
+        return std::nullopt;
     }
 
     auto st = response.find("ST");
     if (st == response.end()) {
         debug("SSDP: missing ST header");
-        return false;
+        return std::nullopt;
     }
 
-    if (st->value() != search_target_) {
-        debug("SSDP: ST mismatch (got '{}')", st->value());
+    ssdp_device device;
+    device.search_target_ = std::string(st->value());
+    if (auto usn = response.find("USN"); usn != response.end()) {
+        device.usn_ = std::string(usn->value());
+    }
+    if (auto location = response.find(http::field::location); location != response.end()) {
+        device.location_ = std::string(location->value());
+    }
+    if (auto cache_control = response.find(http::field::cache_control); cache_control != response.end()) {
+        std::string_view value(cache_control->value().data(), cache_control->value().size());
+        constexpr std::string_view key = "max-age";
+        if (auto pos = value.find(key); pos != std::string_view::npos) {
+            auto rest = value.substr(pos + key.size());
+            rest.remove_prefix(std::min(rest.find_first_not_of(" ="), rest.size()));
+            long seconds = 0;
+            auto [end, parse_ec] = std::from_chars(rest.data(), rest.data() + rest.size(), seconds);
+            if (parse_ec == std::errc{} && end != rest.data() && seconds >= 0) {
+                device.max_age_ = std::chrono::seconds(seconds);
+            }
+        }
+    }
+    return device;
+}
+
+inline bool detail::ssdp_response_matches(std::string_view payload, std::string_view search_target) {
+    auto device = parse_ssdp_response(payload);
+    if (!device) {
+        return false;
+    }
+    if (device->search_target_ != search_target) {
+        debug("SSDP: ST mismatch (got '{}')", device->search_target_);
         return false;
     }
     return true;
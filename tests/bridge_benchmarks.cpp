@@ -0,0 +1,434 @@
+#include "heos_client.hpp"
+#include "heos_command.hpp"
+#include "heos_line.hpp"
+#include "logging/logging.hpp"
+#include "mqtt_publisher.hpp"
+#include "mqtt_transport.hpp"
+#include "ssdp_resolver.hpp"
+
+#include "fake_mqtt_broker.hpp"
+#include "mock_heos_server.hpp"
+#include "run_until.hpp"
+#include "ssdp_responder.hpp"
+#include "tls_test_server.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <boost/json.hpp>
+
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Counts every heap allocation in the process so benchmarks can report
+// allocations per event.
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) { // NOLINT(cppcoreguidelines-no-malloc)
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept {
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+namespace {
+
+constexpr std::string_view sample_event =
+    R"({"heos": {"command": "event/player_volume_changed", "message": "pid=-1467659498&level=23&mute=off"}})";
+
+constexpr std::string_view heos_ssdp_response =
+    "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n";
+
+constexpr std::string_view full_ssdp_response =
+    "HTTP/1.1 200 OK\r\n"
+    "CACHE-CONTROL: max-age=180\r\n"
+    "EXT:\r\n"
+    "LOCATION: http://192.168.1.50:60006/upnp/desc/aios_device/aios_device.xml\r\n"
+    "SERVER: LINUX UPnP/1.0 Denon-Heos/149200\r\n"
+    "ST: urn:schemas-denon-com:device:ACT-Denon:1\r\n"
+    "USN: uuid:5e0b9e6d-1234-5678-9abc-000000000000::urn:schemas-denon-com:device:ACT-Denon:1\r\n"
+    "\r\n";
+
+class null_destination final : public logging::log_destination {
+public:
+    void emit(const logging::log_record& record) override {
+        benchmark::DoNotOptimize(record.message().data());
+    }
+};
+
+void take_line(benchmark::State& state) {
+    boost::asio::streambuf buffer;
+    std::string framed(sample_event);
+    framed.append("\r\n");
+    for (auto _ : state) {
+        auto n = boost::asio::buffer_copy(buffer.prepare(framed.size()), boost::asio::buffer(framed));
+        buffer.commit(n);
+        auto line = heos2mqtt::detail::take_line(buffer, n);
+        benchmark::DoNotOptimize(line);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * framed.size()));
+}
+BENCHMARK(take_line);
+
+void ssdp_response_matches(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(heos2mqtt::detail::ssdp_response_matches(
+            full_ssdp_response, heos2mqtt::detail::heos_search_target));
+    }
+}
+BENCHMARK(ssdp_response_matches);
+
+// A mix of the commands seen in real traffic, plus one unknown name.
+constexpr std::array<std::string_view, 6> command_mix{
+    "event/player_now_playing_progress",
+    "event/player_volume_changed",
+    "event/player_state_changed",
+    "player/get_players",
+    "system/heart_beat",
+    "event/undocumented",
+};
+
+void classify_command(benchmark::State& state) {
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(heos2mqtt::classify_command(command_mix[i++ % command_mix.size()]));
+    }
+}
+BENCHMARK(classify_command);
+
+// Baseline for classify_command.
+void classify_command_unordered_map(benchmark::State& state) {
+    std::unordered_map<std::string, heos2mqtt::heos_command> commands;
+    for (std::size_t c = 1; c < heos2mqtt::heos_command_count; ++c) {
+        auto command = static_cast<heos2mqtt::heos_command>(c);
+        commands.emplace(heos2mqtt::to_string(command), command);
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto it = commands.find(std::string(command_mix[i++ % command_mix.size()]));
+        benchmark::DoNotOptimize(it == commands.end() ? heos2mqtt::heos_command::unknown : it->second);
+    }
+}
+BENCHMARK(classify_command_unordered_map);
+
+// HEOS traffic for the scanner benchmarks: the "line" of every record in
+// the capture named by HEOS2MQTT_BENCH_CAPTURE (see --record), or a
+// built-in mix of events and responses.
+const std::vector<std::string>& traffic() {
+    static const std::vector<std::string> lines = []() {
+        std::vector<std::string> result;
+        if (const char* path = std::getenv("HEOS2MQTT_BENCH_CAPTURE")) {
+            std::ifstream in(path);
+            std::string record;
+            while (std::getline(in, record)) {
+                boost::system::error_code ec;
+                auto value = boost::json::parse(record, ec);
+                if (!ec && value.is_object() && value.as_object().contains("line")) {
+                    const auto& line = value.as_object().at("line").as_string();
+                    result.emplace_back(line.data(), line.size());
+                }
+            }
+        }
+        if (result.empty()) {
+            result = {
+                std::string(sample_event),
+                R"({"heos": {"command": "event/player_now_playing_progress", "message": "pid=-1467659498&cur_pos=113000&duration=215000"}})",
+                R"({"heos": {"command": "event/player_state_changed", "message": "pid=-1467659498&state=play"}})",
+                R"({"heos": {"command": "system/heart_beat", "result": "success", "message": ""}})",
+                R"({"heos": {"command": "player/get_now_playing_media", "result": "success", "message": "pid=-1467659498"}, )"
+                R"("payload": {"type": "song", "song": "Paranoid Android", "album": "OK Computer", "artist": "Radiohead", )"
+                R"("image_url": "http://example.invalid/cover.jpg", "album_id": "1", "mid": "1", "qid": 12, "sid": 1}, )"
+                R"("options": []})",
+            };
+        }
+        return result;
+    }();
+    return lines;
+}
+
+void scan_heos_line(benchmark::State& state) {
+    const auto& lines = traffic();
+    std::size_t i = 0;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        const auto& line = lines[i++ % lines.size()];
+        auto fields = heos2mqtt::scan_heos_line(line);
+        benchmark::DoNotOptimize(fields);
+        bytes += line.size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+BENCHMARK(scan_heos_line);
+
+// Baseline for scan_heos_line: a full parse to reach the same fields.
+void scan_heos_line_boost_json(benchmark::State& state) {
+    const auto& lines = traffic();
+    std::size_t i = 0;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        const auto& line = lines[i++ % lines.size()];
+        boost::system::error_code ec;
+        auto value = boost::json::parse(line, ec);
+        const auto* heos = ec || !value.is_object() ? nullptr : value.as_object().if_contains("heos");
+        const auto* command = heos && heos->is_object() ? heos->as_object().if_contains("command") : nullptr;
+        benchmark::DoNotOptimize(command);
+        bytes += line.size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+BENCHMARK(scan_heos_line_boost_json);
+
+void build_payload(benchmark::State& state) {
+    const auto timestamp = heos2mqtt::detail::current_iso_timestamp();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(heos2mqtt::detail::build_payload(sample_event, timestamp));
+    }
+}
+BENCHMARK(build_payload);
+
+void current_iso_timestamp(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(heos2mqtt::detail::current_iso_timestamp());
+    }
+}
+BENCHMARK(current_iso_timestamp);
+
+void build_topic(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(heos2mqtt::detail::build_topic("heos", "raw"));
+    }
+}
+BENCHMARK(build_topic);
+
+// Arg 0 logs a deferrable call, arg 1 one that must be formatted eagerly.
+void log_call(benchmark::State& state) {
+    auto saved = logging::logger::get_default();
+    logging::logger::get_default() = logging::logger(logging::severity::info, std::make_shared<null_destination>());
+    int value = 42;
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            logging::info("[{}]: value {}", "bench", value);
+        } else {
+            logging::info("[{}]: pointer {}", "bench", static_cast<const void*>(&value));
+        }
+    }
+    logging::logger::get_default() = saved;
+}
+BENCHMARK(log_call)->Arg(0)->Arg(1);
+
+// One mock HEOS device streaming into heos_client, handing lines to
+// mqtt_publisher connected to an in-process broker, everything on one
+// io_context thread. Reports events/s and heap allocations per event.
+void pipeline(benchmark::State& state) {
+    const auto lines = static_cast<std::size_t>(state.range(0));
+    std::string stream;
+    for (std::size_t i = 0; i < lines; ++i) {
+        stream.append(sample_event);
+        if (i + 1 < lines) {
+            stream.append("\r\n");
+        }
+    }
+
+    std::size_t events = 0;
+    std::size_t allocations = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        boost::asio::io_context io;
+        test::fake_mqtt_broker broker(io);
+        broker.start();
+        heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+        publisher.start();
+        test::run_until(io, [&]() { return broker.connections() == 1; });
+        test::run_for(io, 20ms);
+
+        test::mock_heos_server server(io, 0);
+        server.enqueue({{stream}, false});
+        server.start();
+        test::ssdp_responder responder(io);
+        heos2mqtt::heos_client client("bench", io, "device", server.port(),
+            [&publisher](std::string line, heos2mqtt::line_trace trace) {
+                publisher.publish_raw(std::move(line), trace);
+            },
+            responder.endpoint());
+        client.start();
+        auto request = responder.expect_request();
+        const auto allocations_before = allocation_count.load(std::memory_order_relaxed);
+        state.ResumeTiming();
+
+        responder.send_response(heos_ssdp_response, request.sender_);
+        test::run_until(io, [&]() { return broker.published() >= lines; }, 60s);
+
+        state.PauseTiming();
+        allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        events += lines;
+        client.stop();
+        publisher.stop();
+        server.stop();
+        broker.stop();
+        test::run_for(io, 20ms);
+        state.ResumeTiming();
+    }
+
+    state.counters["events_per_second"] = benchmark::Counter(static_cast<double>(events), benchmark::Counter::kIsRate);
+    state.counters["allocations_per_event"] =
+        events == 0 ? 0.0 : static_cast<double>(allocations) / static_cast<double>(events);
+}
+BENCHMARK(pipeline)->Arg(10000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Reconnects to a local TLS server the way mqtt_publisher does: TCP
+// connect, handshake and first read. Arg 0 does a full handshake each time,
+// arg 1 resumes the cached session.
+void tls_reconnect(benchmark::State& state) {
+    boost::asio::io_context io;
+    test::tls_test_server server(io);
+    heos2mqtt::tls_session_cache cache;
+    heos2mqtt::mqtt_transport_options options;
+    options.transport_ = heos2mqtt::mqtt_transport::tls;
+    options.verify_peer_ = false;
+    options.resume_sessions_ = state.range(0) != 0;
+    auto context = heos2mqtt::make_tls_context(options, cache);
+
+    auto reconnect = [&]() {
+        std::optional<boost::system::error_code> result;
+        test::tls_connect_once(io, context, server.port(),
+            [](SSL* ssl) { heos2mqtt::tls_session_cache::prepare(ssl, "localhost"); },
+            [&](boost::system::error_code ec) { result = ec; });
+        // run_until() naps between polls, which would swamp a handshake.
+        while (!result && io.run_one() > 0) {
+        }
+        return result && !*result;
+    };
+    // The first connection has no session to resume.
+    if (!reconnect()) {
+        state.SkipWithError("TLS connect failed");
+        return;
+    }
+    const auto resumed_before = server.resumed();
+    for (auto _ : state) {
+        if (!reconnect()) {
+            state.SkipWithError("TLS connect failed");
+            break;
+        }
+    }
+    state.counters["resumed"] = static_cast<double>(server.resumed() - resumed_before);
+    server.stop();
+    test::run_for(io, 20ms);
+}
+BENCHMARK(tls_reconnect)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Publishes batches of lines to an in-process broker and waits for all of
+// them to arrive. Arg 0 connects over loopback TCP, arg 1 over a Unix
+// domain socket.
+template <typename Broker>
+void publish_batches(benchmark::State& state, boost::asio::io_context& io, Broker& broker, const std::string& host,
+                     const std::string& port) {
+    constexpr std::size_t batch = 1000;
+    heos2mqtt::mqtt_publisher publisher(io, host, port, "heos");
+    publisher.start();
+    test::run_until(io, [&]() { return broker.connections() == 1; });
+    test::run_for(io, 20ms);
+
+    std::size_t published = 0;
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < batch; ++i) {
+            publisher.publish_raw(std::string(sample_event));
+        }
+        published += batch;
+        test::run_until(io, [&]() { return broker.published() >= published; }, 60s);
+    }
+    state.counters["lines_per_second"] =
+        benchmark::Counter(static_cast<double>(published), benchmark::Counter::kIsRate);
+    publisher.stop();
+    broker.stop();
+    test::run_for(io, 20ms);
+}
+
+void publish_throughput(benchmark::State& state) {
+    boost::asio::io_context io;
+    if (state.range(0) == 0) {
+        test::fake_mqtt_broker broker(io);
+        broker.start();
+        publish_batches(state, io, broker, "127.0.0.1", std::to_string(broker.port()));
+    } else {
+        const auto path = "/tmp/heos2mqtt-bench-" + std::to_string(::getpid()) + ".sock";
+        test::fake_mqtt_unix_broker broker(io, path);
+        broker.start();
+        publish_batches(state, io, broker, "unix://" + path, "1883");
+    }
+}
+BENCHMARK(publish_throughput)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Publishes batches to a broker that acknowledges each publish 5 ms after
+// it arrives, like one across a WAN, and waits for the last PUBACK. The arg
+// is the in-flight limit, which caps throughput at about that many lines
+// per round trip.
+void publish_in_flight(benchmark::State& state) {
+    constexpr std::size_t batch = 200;
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_ack_delay(5ms);
+    broker.start();
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    publisher.set_in_flight_limit(static_cast<std::size_t>(state.range(0)));
+    publisher.start();
+    test::run_until(io, [&]() { return broker.connections() == 1; });
+    test::run_for(io, 20ms);
+
+    std::size_t published = 0;
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < batch; ++i) {
+            publisher.publish_raw(std::string(sample_event));
+        }
+        bool idle = false;
+        publisher.notify_when_idle([&idle]() { idle = true; });
+        test::run_until(io, [&]() { return idle; }, 60s);
+        published += batch;
+    }
+    state.counters["lines_per_second"] =
+        benchmark::Counter(static_cast<double>(published), benchmark::Counter::kIsRate);
+    publisher.stop();
+    broker.stop();
+    test::run_for(io, 20ms);
+}
+BENCHMARK(publish_in_flight)->Arg(1)->Arg(32)->Arg(1024)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // Keep the clients' connection chatter out of the measurements.
+    logging::logger::get_default().set_min_level(logging::severity::error);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "cli_options.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <limits>
+#include <string>
+
+TEST_CASE("parse_count accepts counts in range and rejects the rest", "[cli-options]") {
+    using heos2mqtt::parse_count;
+    CHECK(parse_count("1", 1, 8) == 1UL);
+    CHECK(parse_count("8", 1, 8) == 8UL);
+    CHECK_FALSE(parse_count("0", 1, 8));
+    CHECK_FALSE(parse_count("9", 1, 8));
+    // stoul would wrap these to ULONG_MAX.
+    CHECK_FALSE(parse_count("-1", 1, 8));
+    CHECK_FALSE(parse_count("+1", 1, 8));
+    CHECK_FALSE(parse_count("4x", 1, 8));
+    CHECK_FALSE(parse_count("four", 1, 8));
+    CHECK_FALSE(parse_count("", 1, 8));
+    CHECK_FALSE(parse_count(std::to_string(std::numeric_limits<unsigned long>::max()) + "0", 0,
+        std::numeric_limits<unsigned long>::max()));
+}
+
+TEST_CASE("--threads is bounded by the hardware", "[cli-options]") {
+    const auto limit = heos2mqtt::max_thread_count();
+    CHECK(limit >= 4);
+    CHECK(heos2mqtt::parse_count(std::to_string(limit), 1, limit) == limit);
+    CHECK_FALSE(heos2mqtt::parse_count(std::to_string(limit + 1), 1, limit));
+}
@@ -0,0 +1,170 @@
+#include "device_description.hpp"
+
+#include "run_until.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <optional>
+#include <string>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr std::string_view description_xml = R"(<?xml version="1.0"?>
+<root xmlns="urn:schemas-upnp-org:device-1-0">
+  <device>
+    <deviceType>urn:schemas-denon-com:device:ACT-Denon:1</deviceType>
+    <friendlyName>Kitchen &amp; Dining</friendlyName>
+    <manufacturer>Denon</manufacturer>
+    <modelName>HEOS 5</modelName>
+    <serialNumber>AMG12345678</serialNumber>
+    <deviceList>
+      <device><friendlyName>Embedded</friendlyName></device>
+    </deviceList>
+  </device>
+</root>
+)";
+
+// Serves description_xml to every request and counts them.
+class description_server {
+public:
+    explicit description_server(boost::asio::io_context& io)
+      : acceptor_(io, {boost::asio::ip::make_address("127.0.0.1"), 0})
+    {
+        accept_next();
+    }
+
+    [[nodiscard]] std::string location() const {
+        return "http://127.0.0.1:" + std::to_string(acceptor_.local_endpoint().port()) + "/upnp/desc.xml";
+    }
+
+    [[nodiscard]] std::size_t requests() const {
+        return requests_;
+    }
+
+private:
+    struct session {
+        explicit session(boost::asio::ip::tcp::socket socket) : socket_(std::move(socket)) {}
+
+        boost::asio::ip::tcp::socket socket_;
+        boost::asio::streambuf request_;
+        std::string response_;
+    };
+
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            auto peer = std::make_shared<session>(std::move(socket));
+            boost::asio::async_read_until(peer->socket_, peer->request_, "\r\n\r\n",
+                [this, peer](const boost::system::error_code& read_ec, std::size_t /*bytes*/) {
+                    if (read_ec) {
+                        return;
+                    }
+                    ++requests_;
+                    peer->response_ = "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\nContent-Length: " +
+                        std::to_string(description_xml.size()) + "\r\nConnection: close\r\n\r\n" +
+                        std::string(description_xml);
+                    boost::asio::async_write(peer->socket_, boost::asio::buffer(peer->response_),
+                        [peer](const boost::system::error_code&, std::size_t) {});
+                });
+            accept_next();
+        });
+    }
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::size_t requests_{0};
+};
+
+}  // namespace
+
+TEST_CASE("parse_http_url splits LOCATION URLs", "[upnp]") {
+    using heos2mqtt::detail::parse_http_url;
+
+    auto url = parse_http_url("http://192.168.1.20:60006/upnp/desc/aios_device/aios_device.xml");
+    REQUIRE(url);
+    CHECK(url->host_ == "192.168.1.20");
+    CHECK(url->port_ == "60006");
+    CHECK(url->target_ == "/upnp/desc/aios_device/aios_device.xml");
+
+    auto v6 = parse_http_url("http://[fe80::1]:8080/desc.xml");
+    REQUIRE(v6);
+    CHECK(v6->host_ == "fe80::1");
+    CHECK(v6->port_ == "8080");
+
+    auto bare = parse_http_url("http://speaker.local");
+    REQUIRE(bare);
+    CHECK(bare->port_ == "80");
+    CHECK(bare->target_ == "/");
+
+    CHECK_FALSE(parse_http_url("https://192.168.1.20/desc.xml"));
+    CHECK_FALSE(parse_http_url("http://:80/desc.xml"));
+}
+
+TEST_CASE("parse_device_description reads the root device", "[upnp]") {
+    auto description = heos2mqtt::detail::parse_device_description(description_xml);
+    REQUIRE(description);
+    CHECK(description->friendly_name_ == "Kitchen & Dining");
+    CHECK(description->model_name_ == "HEOS 5");
+    CHECK(description->serial_number_ == "AMG12345678");
+
+    CHECK_FALSE(heos2mqtt::detail::parse_device_description("<root></root>"));
+}
+
+TEST_CASE("description_cache fetches once per USN until max-age passes", "[upnp]") {
+    boost::asio::io_context io;
+    description_server server(io);
+    heos2mqtt::description_cache cache(io);
+
+    heos2mqtt::ssdp_device device;
+    device.usn_ = "uuid:1234::urn:schemas-denon-com:device:ACT-Denon:1";
+    device.location_ = server.location();
+
+    // Concurrent requests share one fetch, later ones hit the cache.
+    std::size_t described = 0;
+    auto expect_description = [&](const boost::system::error_code& ec, const heos2mqtt::device_description& d) {
+        CHECK_FALSE(ec.failed());
+        CHECK(d.friendly_name_ == "Kitchen & Dining");
+        ++described;
+    };
+    cache.async_describe(device, expect_description);
+    cache.async_describe(device, expect_description);
+    test::run_until(io, [&]() { return described == 2; });
+    cache.async_describe(device, expect_description);
+    test::run_until(io, [&]() { return described == 3; });
+    CHECK(server.requests() == 1);
+
+    // A response with max-age=0 expires at once.
+    heos2mqtt::ssdp_device short_lived = device;
+    short_lived.usn_ = "uuid:5678";
+    short_lived.max_age_ = 0s;
+    cache.async_describe(short_lived, expect_description);
+    test::run_until(io, [&]() { return described == 4; });
+    cache.async_describe(short_lived, expect_description);
+    test::run_until(io, [&]() { return described == 5; });
+    CHECK(server.requests() == 3);
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("description_cache reports unreachable descriptions", "[upnp]") {
+    boost::asio::io_context io;
+    heos2mqtt::description_cache cache(io, 500ms);
+
+    heos2mqtt::ssdp_device device;
+    device.usn_ = "uuid:dead";
+    device.location_ = "ftp://127.0.0.1/desc.xml";
+
+    std::optional<boost::system::error_code> result;
+    cache.async_describe(device, [&](const boost::system::error_code& ec, const heos2mqtt::device_description&) {
+        result = ec;
+    });
+    test::run_until(io, [&]() { return result.has_value(); });
+    CHECK(result->failed());
+
+    test::run_remaining(io);
+}
@@ -0,0 +1,491 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace test {
+
+// In-process stand-in for an MQTT v5 broker, enough to exercise the
+// publisher deterministically: CONNECT, PUBLISH at QoS 0/1/2 with the
+// matching acknowledgements, SUBSCRIBE with wildcard routing, PINGREQ and
+// DISCONNECT. Faults can be injected: delayed acknowledgements, refused
+// connections and dropped connections. Sessions are not stored, but the
+// broker can claim to have one so that clients resume in-flight publishes.
+// Listens on loopback TCP, or on a Unix domain socket.
+template <typename Protocol>
+class basic_fake_mqtt_broker {
+public:
+    using tcp = boost::asio::ip::tcp;
+    using unix_socket = boost::asio::local::stream_protocol;
+
+    struct message {
+        std::string topic_;
+        std::string payload_;
+        std::uint8_t qos_{0};
+        bool dup_{false};
+    };
+
+    struct connect_request {
+        std::string client_id_;
+        bool clean_start_{true};
+        std::uint32_t session_expiry_{0};
+    };
+
+    explicit basic_fake_mqtt_broker(boost::asio::io_context& io, std::uint16_t port = 0)
+        requires std::same_as<Protocol, tcp>
+    : acceptor_(io, {boost::asio::ip::make_address("127.0.0.1"), port})
+    {}
+
+    // Replaces any socket file left at path.
+    basic_fake_mqtt_broker(boost::asio::io_context& io, const std::string& path)
+        requires std::same_as<Protocol, unix_socket>
+    : acceptor_(io, (std::remove(path.c_str()), typename unix_socket::endpoint(path)))
+    , path_(path)
+    {}
+
+    basic_fake_mqtt_broker(const basic_fake_mqtt_broker&) = delete;
+    basic_fake_mqtt_broker& operator=(const basic_fake_mqtt_broker&) = delete;
+
+    ~basic_fake_mqtt_broker() {
+        if (!path_.empty()) {
+            std::remove(path_.c_str());
+        }
+    }
+
+    [[nodiscard]] std::uint16_t port() const
+        requires std::same_as<Protocol, tcp>
+    {
+        return acceptor_.local_endpoint().port();
+    }
+
+    // Keep every PUBLISH in messages(); off by default so benchmarks do not
+    // measure the broker's allocations.
+    void set_record(bool record) {
+        record_ = record;
+    }
+
+    // Holds back PUBACK, PUBREC and PUBCOMP by this long.
+    void set_ack_delay(std::chrono::steady_clock::duration delay) {
+        ack_delay_ = delay;
+    }
+
+    // CONNACK reason code; anything but 0 refuses the connection.
+    void set_connack_reason(std::uint8_t reason) {
+        connack_reason_ = reason;
+    }
+
+    // Answers CONNECT with Session Present set for a client id that has
+    // connected before with Clean Start off and a session expiry interval.
+    void set_persistent_sessions(bool persistent) {
+        persistent_sessions_ = persistent;
+    }
+
+    // Drops a connection, without DISCONNECT, after it has sent this many
+    // PUBLISH packets. Zero (the default) never drops.
+    void set_disconnect_after(std::size_t publishes) {
+        disconnect_after_ = publishes;
+    }
+
+    void start() {
+        accept_next();
+    }
+
+    void stop() {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        disconnect_all();
+    }
+
+    // Closes every client connection abruptly.
+    void disconnect_all() {
+        boost::system::error_code ec;
+        for (auto& session : sessions_) {
+            session->socket_.close(ec);
+        }
+        sessions_.clear();
+    }
+
+    // Sends a QoS 0 PUBLISH to every connected client subscribed to a
+    // matching filter.
+    void publish(std::string_view topic, std::string_view payload) {
+        std::vector<std::uint8_t> body;
+        append_string(body, topic);
+        body.push_back(0x00);  // no properties
+        body.insert(body.end(), payload.begin(), payload.end());
+        for (auto& session : sessions_) {
+            for (const auto& filter : session->filters_) {
+                if (topic_matches(filter, topic)) {
+                    send(session, 0x30, body);
+                    break;
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] std::size_t connections() const {
+        return connections_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] std::size_t published() const {
+        return published_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] std::size_t subscriptions() const {
+        return subscriptions_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] const std::vector<message>& messages() const {
+        return messages_;
+    }
+
+    [[nodiscard]] const std::vector<connect_request>& connect_requests() const {
+        return connect_requests_;
+    }
+
+    // MQTT topic filter matching with the + and # wildcards.
+    static bool topic_matches(std::string_view filter, std::string_view topic) {
+        while (true) {
+            auto filter_end = filter.find('/');
+            auto topic_end = topic.find('/');
+            auto level = filter.substr(0, filter_end);
+            if (level == "#") {
+                return true;
+            }
+            if (level != "+" && level != topic.substr(0, topic_end)) {
+                return false;
+            }
+            if (filter_end == std::string_view::npos || topic_end == std::string_view::npos) {
+                return filter_end == topic_end ||
+                       (topic_end == std::string_view::npos && filter.substr(filter_end + 1) == "#");
+            }
+            filter.remove_prefix(filter_end + 1);
+            topic.remove_prefix(topic_end + 1);
+        }
+    }
+
+private:
+    struct session {
+        explicit session(typename Protocol::socket socket) : socket_(std::move(socket)) {}
+
+        typename Protocol::socket socket_;
+        std::array<std::uint8_t, 5> header_{};
+        std::size_t header_size_{0};
+        std::vector<std::uint8_t> body_;
+        std::vector<std::string> filters_;
+        std::size_t publishes_{0};
+        // Replies are batched so that writes never overlap.
+        std::vector<std::uint8_t> outbox_;
+        std::vector<std::uint8_t> sending_;
+        bool writing_{false};
+    };
+    using session_ptr = std::shared_ptr<session>;
+
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, typename Protocol::socket socket) {
+            if (ec) {
+                return;
+            }
+            auto& client = sessions_.emplace_back(std::make_shared<session>(std::move(socket)));
+            read_header(client);
+            accept_next();
+        });
+    }
+
+    // Reads the fixed header one byte at a time: the packet type, then the
+    // variable length remaining-length field.
+    void read_header(const session_ptr& client) {
+        boost::asio::async_read(
+            client->socket_, boost::asio::buffer(&client->header_[client->header_size_], 1),
+            [this, client](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+                if (ec) {
+                    return;
+                }
+                ++client->header_size_;
+                if (client->header_size_ == 1 || (client->header_[client->header_size_ - 1] & 0x80U)) {
+                    if (client->header_size_ == client->header_.size()) {
+                        return;  // malformed length
+                    }
+                    read_header(client);
+                    return;
+                }
+                std::size_t length = 0;
+                for (std::size_t i = client->header_size_ - 1; i >= 1; --i) {
+                    length = (length << 7U) | (client->header_[i] & 0x7FU);
+                }
+                client->body_.resize(length);
+                boost::asio::async_read(
+                    client->socket_, boost::asio::buffer(client->body_),
+                    [this, client](const boost::system::error_code& body_ec, std::size_t /*bytes*/) {
+                        if (body_ec) {
+                            return;
+                        }
+                        handle_packet(client);
+                        client->header_size_ = 0;
+                        if (client->socket_.is_open()) {
+                            read_header(client);
+                        }
+                    });
+            });
+    }
+
+    void handle_packet(const session_ptr& client) {
+        const auto type = static_cast<std::uint8_t>(client->header_[0] >> 4U);
+        const auto& body = client->body_;
+        switch (type) {
+        case 1: {  // CONNECT -> CONNACK without properties
+            auto request = parse_connect(body);
+            const bool session_present = persistent_sessions_ && connack_reason_ == 0 && !request.clean_start_ &&
+                std::any_of(connect_requests_.begin(), connect_requests_.end(), [&](const connect_request& earlier) {
+                    return earlier.client_id_ == request.client_id_ && earlier.session_expiry_ > 0;
+                });
+            connect_requests_.push_back(std::move(request));
+            connections_.fetch_add(1, std::memory_order_release);
+            send(client, 0x20, {static_cast<std::uint8_t>(session_present ? 0x01 : 0x00), connack_reason_, 0x00});
+            if (connack_reason_ != 0) {
+                close_after_flush(client);
+            }
+            break;
+        }
+        case 3:
+            handle_publish(client);
+            break;
+        case 6:  // PUBREL -> PUBCOMP
+            acknowledge(client, 0x70, body.at(0), body.at(1));
+            break;
+        case 8:
+            handle_subscribe(client);
+            break;
+        case 12:  // PINGREQ
+            send(client, 0xD0, {});
+            break;
+        case 14: {  // DISCONNECT
+            boost::system::error_code ignored;
+            client->socket_.close(ignored);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void handle_publish(const session_ptr& client) {
+        const auto& body = client->body_;
+        const auto qos = static_cast<std::uint8_t>((client->header_[0] >> 1U) & 0x03U);
+        const bool dup = (client->header_[0] & 0x08U) != 0;
+        std::size_t pos = 0;
+        const std::size_t topic_length = (std::size_t{body.at(0)} << 8U) | body.at(1);
+        pos += 2;
+        std::string topic(body.begin() + static_cast<std::ptrdiff_t>(pos),
+                          body.begin() + static_cast<std::ptrdiff_t>(pos + topic_length));
+        pos += topic_length;
+        std::array<std::uint8_t, 2> packet_id{};
+        if (qos > 0) {
+            packet_id = {body.at(pos), body.at(pos + 1)};
+            pos += 2;
+        }
+        pos += skip_properties(body, pos);
+        if (record_) {
+            messages_.push_back({std::move(topic),
+                std::string(body.begin() + static_cast<std::ptrdiff_t>(pos), body.end()), qos, dup});
+        }
+        published_.fetch_add(1, std::memory_order_release);
+
+        if (qos == 1) {
+            acknowledge(client, 0x40, packet_id[0], packet_id[1]);
+        } else if (qos == 2) {
+            acknowledge(client, 0x50, packet_id[0], packet_id[1]);
+        }
+
+        if (disconnect_after_ != 0 && ++client->publishes_ >= disconnect_after_) {
+            boost::system::error_code ignored;
+            client->socket_.close(ignored);
+        }
+    }
+
+    // SUBSCRIBE -> SUBACK granting each filter its requested QoS.
+    void handle_subscribe(const session_ptr& client) {
+        const auto& body = client->body_;
+        std::vector<std::uint8_t> reply{body.at(0), body.at(1), 0x00};
+        std::size_t pos = 2;
+        pos += skip_properties(body, pos);
+        while (pos + 2 < body.size()) {
+            const std::size_t length = (std::size_t{body.at(pos)} << 8U) | body.at(pos + 1);
+            pos += 2;
+            client->filters_.emplace_back(body.begin() + static_cast<std::ptrdiff_t>(pos),
+                                          body.begin() + static_cast<std::ptrdiff_t>(pos + length));
+            pos += length;
+            reply.push_back(static_cast<std::uint8_t>(body.at(pos++) & 0x03U));
+            subscriptions_.fetch_add(1, std::memory_order_release);
+        }
+        send(client, 0x90, reply);
+    }
+
+    void acknowledge(const session_ptr& client, std::uint8_t type, std::uint8_t id_high, std::uint8_t id_low) {
+        if (ack_delay_ <= std::chrono::steady_clock::duration::zero()) {
+            send(client, type, {id_high, id_low});
+            return;
+        }
+        auto timer = std::make_shared<boost::asio::steady_timer>(acceptor_.get_executor(), ack_delay_);
+        timer->async_wait([client, timer, type, id_high, id_low](const boost::system::error_code& ec) {
+            if (!ec && client->socket_.is_open()) {
+                send(client, type, {id_high, id_low});
+            }
+        });
+    }
+
+    // Length of the properties block at pos, including its length prefix.
+    static std::size_t skip_properties(const std::vector<std::uint8_t>& body, std::size_t pos) {
+        std::size_t used = 0;
+        auto length = read_varint(body, pos, used);
+        return used + length;
+    }
+
+    static std::size_t read_varint(const std::vector<std::uint8_t>& body, std::size_t pos, std::size_t& used) {
+        std::size_t value = 0;
+        std::size_t shift = 0;
+        std::uint8_t byte = 0;
+        used = 0;
+        do {
+            byte = body.at(pos + used++);
+            value |= static_cast<std::size_t>(byte & 0x7FU) << shift;
+            shift += 7;
+        } while (byte & 0x80U);
+        return value;
+    }
+
+    static std::size_t read_u16(const std::vector<std::uint8_t>& body, std::size_t pos) {
+        return (std::size_t{body.at(pos)} << 8U) | body.at(pos + 1);
+    }
+
+    // The client id, Clean Start flag and Session Expiry Interval of a
+    // CONNECT body.
+    static connect_request parse_connect(const std::vector<std::uint8_t>& body) {
+        connect_request request;
+        std::size_t pos = 2 + read_u16(body, 0) + 1;  // protocol name and level
+        request.clean_start_ = (body.at(pos) & 0x02U) != 0;
+        pos += 3;  // flags and keep alive
+
+        std::size_t used = 0;
+        const auto end = pos + read_varint(body, pos, used) + used;
+        pos += used;
+        while (pos < end) {
+            switch (body.at(pos++)) {
+            case 0x11:  // session expiry interval
+                request.session_expiry_ = static_cast<std::uint32_t>(
+                    (read_u16(body, pos) << 16U) | read_u16(body, pos + 2));
+                pos += 4;
+                break;
+            case 0x27:  // maximum packet size
+                pos += 4;
+                break;
+            case 0x21:  // receive maximum
+            case 0x22:  // topic alias maximum
+                pos += 2;
+                break;
+            case 0x17:  // request problem information
+            case 0x19:  // request response information
+                pos += 1;
+                break;
+            case 0x15:  // authentication method
+            case 0x16:  // authentication data
+                pos += 2 + read_u16(body, pos);
+                break;
+            case 0x26:  // user property
+                pos += 2 + read_u16(body, pos);
+                pos += 2 + read_u16(body, pos);
+                break;
+            default:
+                pos = end;
+                break;
+            }
+        }
+        pos = end;
+        request.client_id_.assign(body.begin() + static_cast<std::ptrdiff_t>(pos + 2),
+                                  body.begin() + static_cast<std::ptrdiff_t>(pos + 2 + read_u16(body, pos)));
+        return request;
+    }
+
+    static void append_string(std::vector<std::uint8_t>& out, std::string_view text) {
+        out.push_back(static_cast<std::uint8_t>(text.size() >> 8U));
+        out.push_back(static_cast<std::uint8_t>(text.size() & 0xFFU));
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    static void send(const session_ptr& client, std::uint8_t type, const std::vector<std::uint8_t>& body) {
+        auto& out = client->outbox_;
+        out.push_back(type);
+        auto length = body.size();
+        do {
+            auto byte = static_cast<std::uint8_t>(length & 0x7FU);
+            length >>= 7U;
+            out.push_back(length > 0 ? static_cast<std::uint8_t>(byte | 0x80U) : byte);
+        } while (length > 0);
+        out.insert(out.end(), body.begin(), body.end());
+        if (!client->writing_) {
+            flush(client);
+        }
+    }
+
+    static void flush(const session_ptr& client) {
+        if (client->outbox_.empty()) {
+            client->writing_ = false;
+            return;
+        }
+        client->writing_ = true;
+        client->sending_.clear();
+        std::swap(client->sending_, client->outbox_);
+        boost::asio::async_write(client->socket_, boost::asio::buffer(client->sending_),
+            [client](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+                if (ec) {
+                    client->writing_ = false;
+                    return;
+                }
+                flush(client);
+            });
+    }
+
+    // Lets a refusing CONNACK reach the client before closing.
+    void close_after_flush(const session_ptr& client) {
+        auto timer = std::make_shared<boost::asio::steady_timer>(acceptor_.get_executor(), std::chrono::milliseconds(10));
+        timer->async_wait([client, timer](const boost::system::error_code& /*ec*/) {
+            boost::system::error_code ignored;
+            client->socket_.close(ignored);
+        });
+    }
+
+    typename Protocol::acceptor acceptor_;
+    std::string path_;
+    std::vector<session_ptr> sessions_;
+    std::vector<message> messages_;
+    std::vector<connect_request> connect_requests_;
+    std::atomic<std::size_t> connections_{0};
+    std::atomic<std::size_t> published_{0};
+    std::atomic<std::size_t> subscriptions_{0};
+    std::chrono::steady_clock::duration ack_delay_{};
+    std::size_t disconnect_after_{0};
+    std::uint8_t connack_reason_{0};
+    bool record_{false};
+    bool persistent_sessions_{false};
+};
+
+using fake_mqtt_broker = basic_fake_mqtt_broker<boost::asio::ip::tcp>;
+using fake_mqtt_unix_broker = basic_fake_mqtt_broker<boost::asio::local::stream_protocol>;
+
+}  // namespace test
@@ -1,5 +1,6 @@
 #include "heos_client.hpp"
 
+#include "mock_heos_server.hpp"
 #include "run_until.hpp"
 #include "ssdp_responder.hpp"
 
@@ -7,9 +8,11 @@
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/core.h>
 
+#include <atomic>
 #include <chrono>
-#include <deque>
+#include <cstdint>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std::chrono_literals;
@@ -21,88 +24,12 @@ constexpr std::string_view heos_ssdp_response =
 constexpr std::string_view other_ssdp_response =
     "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:OTHER\r\n\r\n";
 
-class mock_heos_server {
-public:
-    mock_heos_server(boost::asio::io_context& io, std::uint16_t port)
-    : acceptor_(io, {boost::asio::ip::tcp::v4(), port})
-    , socket_(io)
-    {}
-
-    struct batch {
-        std::vector<std::string> lines_;
-        bool close_after_{true};
-        std::size_t index_{0};
-    };
-
-    void enqueue(batch batch_item) {
-        batches_.push_back(std::move(batch_item));
-    }
-
-    [[nodiscard]] std::uint16_t port() const {
-        return acceptor_.local_endpoint().port();
-    }
-
-    void start() {
-        accept_next();
-    }
-
-    void stop() {
-        boost::system::error_code ec;
-        acceptor_.close(ec);
-        socket_.close(ec);
-    }
-
-private:
-    void accept_next() {
-        acceptor_.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
-            if (ec) {
-                return;
-            }
-            socket_ = std::move(socket);
-            if (batches_.empty()) {
-                return;
-            }
-
-            auto batch_item = std::make_shared<batch>(std::move(batches_.front()));
-            batches_.pop_front();
-            send_batch(batch_item);
-        });
-    }
-
-    void send_batch(const std::shared_ptr<batch>& batch_item) {
-        if (batch_item->index_ >= batch_item->lines_.size()) {
-            if (batch_item->close_after_) {
-                boost::system::error_code ec;
-                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-                socket_.close(ec);
-                accept_next();
-            }
-            return;
-        }
-
-        auto line = batch_item->lines_[batch_item->index_++] + "\r\n";
-        boost::asio::async_write(
-            socket_, boost::asio::buffer(line),
-            [this, batch_item](const boost::system::error_code& ec, std::size_t /*bytes*/) {
-                if (ec) {
-                    accept_next();
-                    return;
-                }
-                send_batch(batch_item);
-            });
-    }
-
-    boost::asio::ip::tcp::acceptor acceptor_;
-    boost::asio::ip::tcp::socket socket_;
-    std::deque<batch> batches_;
-};
-
 }  // namespace
 
 TEST_CASE("heos_client streams lines in order", "[heos-client]") {
     boost::asio::io_context io;
 
-    mock_heos_server server(io, 0);
+    test::mock_heos_server server(io, 0);
     server.enqueue({{"line1", "line2", "line3"}, false});
     server.start();
 
@@ -112,7 +39,7 @@ TEST_CASE("heos_client streams lines in order", "[heos-client]") {
 
     heos2mqtt::heos_client client("test_client",
         io, std::string(device_name), server.port(),
-        [&](std::string line) { received.push_back(std::move(line)); },
+        [&](std::string line, heos2mqtt::line_trace) { received.push_back(std::move(line)); },
         responder.endpoint());
 
     client.set_reconnect_backoff(50ms, 200ms);
@@ -134,10 +61,42 @@ TEST_CASE("heos_client streams lines in order", "[heos-client]") {
     test::run_for(io, 200ms);
 }
 
+TEST_CASE("heos_client stamps lines with read and dispatch times", "[heos-client]") {
+    boost::asio::io_context io;
+
+    test::mock_heos_server server(io, 0);
+    server.enqueue({{"line1"}, false});
+    server.start();
+
+    std::vector<heos2mqtt::line_trace> traces;
+    test::ssdp_responder responder(io);
+
+    const auto started = heos2mqtt::line_trace::clock::now();
+    heos2mqtt::heos_client client("test_client",
+        io, "living_room", server.port(),
+        [&](std::string /*line*/, heos2mqtt::line_trace trace) { traces.push_back(trace); },
+        responder.endpoint());
+    client.start();
+
+    auto req = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req.sender_);
+
+    test::run_until(io, [&]() { return traces.size() == 1; });
+
+    const auto& trace = traces.front();
+    CHECK(trace.traced());
+    CHECK(trace.read_ >= started);
+    CHECK(trace.dispatched_ >= trace.read_);
+
+    client.stop();
+    server.stop();
+    test::run_remaining(io);
+}
+
 TEST_CASE("heos_client reconnects after disconnect", "[heos-client]") {
     boost::asio::io_context io;
 
-    mock_heos_server server(io, 0);
+    test::mock_heos_server server(io, 0);
     server.enqueue({{"first"}, true});
     server.enqueue({{"second"}, false});
     server.start();
@@ -148,7 +107,7 @@ TEST_CASE("heos_client reconnects after disconnect", "[heos-client]") {
 
     heos2mqtt::heos_client client("test_client",
         io, std::string(device_name), server.port(),
-        [&](std::string line) { received.push_back(std::move(line)); },
+        [&](std::string line, heos2mqtt::line_trace) { received.push_back(std::move(line)); },
         responder.endpoint());
 
     client.set_reconnect_backoff(50ms, 200ms);
@@ -177,14 +136,14 @@ TEST_CASE("heos_client reconnects after disconnect", "[heos-client]") {
 TEST_CASE("heos_client stop is idempotent", "[heos-client]") {
     boost::asio::io_context io;
 
-    mock_heos_server server(io, 0);
+    test::mock_heos_server server(io, 0);
     server.start();
 
     constexpr std::string_view device_name = "living_room";
     test::ssdp_responder responder(io);
 
     heos2mqtt::heos_client client("test_client", io, std::string(device_name), server.port(),
-                                  [](std::string) {}, responder.endpoint());
+                                  [](std::string, heos2mqtt::line_trace) {}, responder.endpoint());
 
     client.set_reconnect_backoff(50ms, 200ms);
     client.start();
@@ -207,10 +166,49 @@ TEST_CASE("heos_client stop is idempotent", "[heos-client]") {
     test::run_remaining(io);
 }
 
+TEST_CASE("heos_client stops cleanly while a resolve completes on another thread", "[heos-client]") {
+    // As with --threads 2: the resolve completes on the resolver's strand
+    // while stop() runs on the client's, and the completion must still be
+    // handled on the client's strand.
+    for (int round = 0; round < 20; ++round) {
+        boost::asio::io_context io(2);
+
+        test::mock_heos_server server(io, 0);
+        server.enqueue({{"line1"}, false});
+        server.start();
+
+        test::ssdp_responder responder(io);
+        std::atomic<std::size_t> received{0};
+        heos2mqtt::heos_client client("test_client", io, "living_room", server.port(),
+            [&](std::string, heos2mqtt::line_trace) { ++received; }, responder.endpoint());
+        client.set_reconnect_backoff(10ms, 50ms);
+        client.start();
+        auto req = responder.expect_request();
+
+        auto work = boost::asio::make_work_guard(io);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 2; ++i) {
+            threads.emplace_back([&io]() { io.run(); });
+        }
+        responder.send_response(heos_ssdp_response, req.sender_);
+        client.stop();
+        std::this_thread::sleep_for(20ms);
+        const auto after_stop = received.load();
+        std::this_thread::sleep_for(50ms);
+        CHECK(received.load() == after_stop);
+
+        boost::asio::post(io, [&]() { server.stop(); });
+        work.reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
 TEST_CASE("heos_client retries after non-matching SSDP response", "[heos-client]") {
     boost::asio::io_context io;
 
-    mock_heos_server server(io, 0);
+    test::mock_heos_server server(io, 0);
     server.enqueue({{"line1"}, false});
     server.start();
 
@@ -220,7 +218,7 @@ TEST_CASE("heos_client retries after non-matching SSDP response", "[heos-client]
 
     heos2mqtt::heos_client client("test_client",
         io, std::string(device_name), server.port(),
-        [&](std::string line) { received.push_back(std::move(line)); },
+        [&](std::string line, heos2mqtt::line_trace) { received.push_back(std::move(line)); },
         responder.endpoint());
 
     client.set_reconnect_backoff(10ms, 50ms);
@@ -245,3 +243,97 @@ TEST_CASE("heos_client retries after non-matching SSDP response", "[heos-client]
     server.stop();
     test::run_remaining(io);
 }
+
+TEST_CASE("heos_client delivers over-long lines in bounded pieces", "[heos-client]") {
+    boost::asio::io_context io;
+
+    // 150 bytes with a two byte UTF-8 character straddling the 64 byte cut.
+    std::string long_line(63, 'a');
+    long_line.append("\xc3\xa9");
+    long_line.append(85, 'b');
+
+    test::mock_heos_server server(io, 0);
+    server.enqueue({{long_line, "short"}, false});
+    server.start();
+
+    struct piece {
+        std::string text_;
+        std::uint32_t fragment_;
+        bool continued_;
+    };
+    std::vector<piece> received;
+    test::ssdp_responder responder(io);
+
+    heos2mqtt::heos_client client("test_client",
+        io, "living_room", server.port(),
+        [&](std::string line, heos2mqtt::line_trace trace) {
+            received.push_back({std::move(line), trace.fragment_, trace.continued_});
+        },
+        responder.endpoint());
+    client.set_max_line_size(64);
+    client.start();
+
+    auto req = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req.sender_);
+
+    test::run_until(io, [&]() {
+        return !received.empty() && received.back().text_ == "short";
+    });
+
+    REQUIRE(received.size() == 4);
+    std::string joined;
+    for (std::size_t i = 0; i < 3; ++i) {
+        CHECK(received[i].text_.size() <= 64);
+        CHECK(received[i].fragment_ == i);
+        CHECK(received[i].continued_ == (i < 2));
+        joined += received[i].text_;
+    }
+    CHECK(received[0].text_ == std::string(63, 'a'));
+    CHECK(joined == long_line);
+    CHECK(received[3].fragment_ == 0);
+    CHECK_FALSE(received[3].continued_);
+
+    client.stop();
+    server.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("line_or_limit waits for the byte past the limit before cutting", "[heos-client]") {
+    auto check = [](const std::string& buffered) {
+        const heos2mqtt::detail::line_or_limit match{8};
+        auto [end, complete] = match(buffered.begin(), buffered.end());
+        return std::pair(static_cast<std::size_t>(end - buffered.begin()), complete);
+    };
+
+    // Exactly the limit without a newline: the next byte decides.
+    CHECK(check(std::string(8, 'a')) == std::pair<std::size_t, bool>(8, false));
+    CHECK(check(std::string(8, 'a') + "\n") == std::pair<std::size_t, bool>(9, true));
+    CHECK(check(std::string(9, 'a')) == std::pair<std::size_t, bool>(8, true));
+    CHECK(check("abc\ndef") == std::pair<std::size_t, bool>(4, true));
+    // A two byte character straddling the limit moves to the next piece.
+    CHECK(check(std::string(7, 'a') + "\xc3\xa9x") == std::pair<std::size_t, bool>(7, true));
+}
+
+TEST_CASE("line_or_limit resumes its search where it stopped", "[heos-client]") {
+    // As read_until calls it: each call starts where the previous one
+    // stopped, with the same match condition.
+    const heos2mqtt::detail::line_or_limit match{8};
+    const std::string buffered = "abc" "de" "fgh" "ij";
+    auto [first, first_complete] = match(buffered.begin(), buffered.begin() + 3);
+    CHECK(first == buffered.begin() + 3);
+    CHECK_FALSE(first_complete);
+    auto [second, second_complete] = match(first, buffered.begin() + 5);
+    CHECK(second == buffered.begin() + 5);
+    CHECK_FALSE(second_complete);
+    // The limit still counts from the start of the line.
+    auto [cut, cut_complete] = match(second, buffered.end());
+    CHECK(cut == buffered.begin() + 8);
+    CHECK(cut_complete);
+
+    const std::string line = "abcd" "ef\nxyz";
+    auto [partial, partial_complete] = match(line.begin(), line.begin() + 4);
+    CHECK_FALSE(partial_complete);
+    auto [newline, newline_complete] = match(partial, line.end());
+    CHECK(newline == line.begin() + 7);
+    CHECK(newline_complete);
+}
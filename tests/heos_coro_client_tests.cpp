@@ -0,0 +1,127 @@
+#include "heos_coro_client.hpp"
+
+#include "mock_heos_server.hpp"
+#include "run_until.hpp"
+#include "ssdp_responder.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr std::string_view heos_ssdp_response =
+    "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n";
+
+}  // namespace
+
+TEST_CASE("heos_coro_client streams lines in order", "[heos-coro-client]") {
+    boost::asio::io_context io;
+
+    test::mock_heos_server server(io, 0);
+    server.enqueue({{"line1", "line2", "line3"}, false});
+    server.start();
+
+    std::vector<std::string> received;
+    test::ssdp_responder responder(io);
+
+    heos2mqtt::heos_coro_client client("test_client",
+        io, "living_room", server.port(),
+        [&](std::string line, heos2mqtt::line_trace) { received.push_back(std::move(line)); },
+        responder.endpoint());
+
+    client.set_reconnect_backoff(50ms, 200ms);
+    client.start();
+
+    auto req = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req.sender_);
+
+    test::run_until(io, [&]() {
+        return received.size() == 3;
+    });
+
+    REQUIRE(received == std::vector<std::string>{"line1", "line2", "line3"});
+
+    client.stop();
+    server.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("heos_coro_client reconnects after disconnect", "[heos-coro-client]") {
+    boost::asio::io_context io;
+
+    test::mock_heos_server server(io, 0);
+    server.enqueue({{"first"}, true});
+    server.enqueue({{"second"}, false});
+    server.start();
+
+    std::vector<std::string> received;
+    test::ssdp_responder responder(io);
+
+    heos2mqtt::heos_coro_client client("test_client",
+        io, "living_room", server.port(),
+        [&](std::string line, heos2mqtt::line_trace) { received.push_back(std::move(line)); },
+        responder.endpoint());
+
+    client.set_reconnect_backoff(50ms, 200ms);
+    client.start();
+
+    auto req = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req.sender_);
+    auto req2 = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req2.sender_);
+
+    test::run_until(io, [&]() {
+        return received.size() == 2;
+    });
+
+    REQUIRE(received == std::vector<std::string>{"first", "second"});
+
+    client.stop();
+    server.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("heos_coro_client sends heartbeat when idle", "[heos-coro-client]") {
+    boost::asio::io_context io;
+
+    boost::asio::ip::tcp::acceptor acceptor(io, {boost::asio::ip::tcp::v4(), 0});
+    boost::asio::ip::tcp::socket peer(io);
+    std::string heartbeat;
+    boost::asio::streambuf peer_buffer;
+    acceptor.async_accept(peer, [&](const boost::system::error_code& ec) {
+        REQUIRE_FALSE(ec.failed());
+        boost::asio::async_read_until(peer, peer_buffer, '\n',
+            [&](const boost::system::error_code& read_ec, std::size_t bytes) {
+                REQUIRE_FALSE(read_ec.failed());
+                heartbeat.assign(boost::asio::buffers_begin(peer_buffer.data()),
+                                 boost::asio::buffers_begin(peer_buffer.data()) +
+                                     static_cast<std::ptrdiff_t>(bytes));
+            });
+    });
+
+    test::ssdp_responder responder(io);
+    heos2mqtt::heos_coro_client client("test_client",
+        io, "living_room", acceptor.local_endpoint().port(),
+        [](std::string, heos2mqtt::line_trace) {}, responder.endpoint());
+
+    client.set_heartbeat_interval(50ms);
+    client.start();
+
+    auto req = responder.expect_request();
+    responder.send_response(heos_ssdp_response, req.sender_);
+
+    test::run_until(io, [&]() {
+        return !heartbeat.empty();
+    });
+
+    CHECK(heartbeat == "heos://system/heart_beat\r\n");
+
+    client.stop();
+    test::run_remaining(io);
+}
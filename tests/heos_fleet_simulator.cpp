@@ -0,0 +1,574 @@
+// Impersonates a fleet of HEOS devices for load testing the bridge.
+//
+// Every simulated device gets its own loopback address (127.0.1.1,
+// 127.0.1.2, ...), a TCP CLI server on that address and an SSDP identity
+// with a distinct USN. One shared SSDP listener answers M-SEARCH requests;
+// each device replies from its own address, so resolvers see one response
+// per device. Connected CLI clients receive a stream of realistic change
+// events and get answers to the common commands.
+//
+// On Linux the whole 127.0.0.0/8 block is routed to lo, so no setup is
+// needed. Elsewhere the aliases must be added to the loopback interface.
+
+#include <boost/asio.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using udp = net::ip::udp;
+using namespace std::chrono_literals;
+
+constexpr std::string_view heos_search_target = "urn:schemas-denon-com:device:ACT-Denon:1";
+
+struct options {
+    std::size_t devices_{100};
+    std::string first_address_{"127.0.1.1"};
+    net::ip::port_type cli_port_{1255};
+    std::string ssdp_group_{"239.255.255.250"};
+    net::ip::port_type ssdp_port_{1900};
+    double event_rate_{2.0};
+    std::chrono::milliseconds max_response_delay_{1000};
+    std::size_t threads_{1};
+    std::chrono::seconds report_interval_{5};
+};
+
+void print_usage(const char* name) {
+    fmt::print(
+        "Usage: {} [--devices N] [--first-address ADDR] [--cli-port PORT] "
+        "[--ssdp-group ADDR] [--ssdp-port PORT] [--max-response-delay MS] "
+        "[--event-rate EVENTS_PER_SECOND] "
+        "[--threads N] [--report-interval SECONDS]\n",
+        name);
+}
+
+options parse_args(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg{argv[i]};
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                print_usage(argv[0]);
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--devices") {
+            opts.devices_ = std::stoul(value());
+        } else if (arg == "--first-address") {
+            opts.first_address_ = value();
+        } else if (arg == "--cli-port") {
+            opts.cli_port_ = static_cast<net::ip::port_type>(std::stoul(value()));
+        } else if (arg == "--ssdp-group") {
+            opts.ssdp_group_ = value();
+        } else if (arg == "--ssdp-port") {
+            opts.ssdp_port_ = static_cast<net::ip::port_type>(std::stoul(value()));
+        } else if (arg == "--max-response-delay") {
+            opts.max_response_delay_ = std::chrono::milliseconds(std::stoul(value()));
+        } else if (arg == "--event-rate") {
+            opts.event_rate_ = std::stod(value());
+        } else if (arg == "--threads") {
+            opts.threads_ = std::max<std::size_t>(std::stoul(value()), 1);
+        } else if (arg == "--report-interval") {
+            opts.report_interval_ = std::chrono::seconds(std::stoul(value()));
+        } else if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        } else {
+            fmt::print(stderr, "Unknown argument: {}\n", arg);
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return opts;
+}
+
+// Counters shared by every device, printed periodically.
+struct fleet_stats {
+    std::atomic<std::uint64_t> searches_{0};
+    std::atomic<std::uint64_t> connections_{0};
+    std::atomic<std::uint64_t> events_{0};
+    std::atomic<std::uint64_t> commands_{0};
+};
+
+// Returns the value of header name in an HTTP-style message, compared
+// case-insensitively, or an empty view.
+std::string_view header_value(std::string_view message, std::string_view name) {
+    auto iequals = [](std::string_view a, std::string_view b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    };
+    while (!message.empty()) {
+        auto end = message.find("\r\n");
+        auto line = message.substr(0, end);
+        message.remove_prefix(end == std::string_view::npos ? message.size() : end + 2);
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos || !iequals(line.substr(0, colon), name)) {
+            continue;
+        }
+        auto result = line.substr(colon + 1);
+        while (!result.empty() && result.front() == ' ') {
+            result.remove_prefix(1);
+        }
+        return result;
+    }
+    return {};
+}
+
+// Returns the value of key in a query string such as "pid=1&level=20".
+std::string_view query_value(std::string_view query, std::string_view key) {
+    while (!query.empty()) {
+        auto end = query.find('&');
+        auto item = query.substr(0, end);
+        query.remove_prefix(end == std::string_view::npos ? query.size() : end + 1);
+        if (item.size() > key.size() && item.substr(0, key.size()) == key && item[key.size()] == '=') {
+            return item.substr(key.size() + 1);
+        }
+    }
+    return {};
+}
+
+class simulated_device;
+
+// One CLI connection. Writes are queued so events and command responses
+// never interleave on the wire.
+class cli_session : public std::enable_shared_from_this<cli_session> {
+public:
+    cli_session(tcp::socket socket, simulated_device& device)
+      : socket_(std::move(socket))
+      , device_(device)
+    {}
+
+    void start() {
+        read_next();
+    }
+
+    void send(std::string line) {
+        line.append("\r\n");
+        outbox_.push_back(std::move(line));
+        if (outbox_.size() == 1) {
+            write_next();
+        }
+    }
+
+    [[nodiscard]] bool open() const {
+        return socket_.is_open();
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+
+private:
+    void read_next();
+    void write_next() {
+        net::async_write(socket_, net::buffer(outbox_.front()),
+            [self = shared_from_this()](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+                if (ec) {
+                    self->close();
+                    return;
+                }
+                self->outbox_.pop_front();
+                if (!self->outbox_.empty()) {
+                    self->write_next();
+                }
+            });
+    }
+
+    tcp::socket socket_;
+    simulated_device& device_;
+    net::streambuf buffer_;
+    std::deque<std::string> outbox_;
+};
+
+class simulated_device {
+public:
+    simulated_device(net::io_context& io, std::size_t index, const net::ip::address_v4& address,
+                     const options& opts, fleet_stats& stats)
+      : strand_(net::make_strand(io))
+      , acceptor_(strand_, tcp::endpoint(address, opts.cli_port_))
+      , ssdp_socket_(strand_, udp::endpoint(address, 0))
+      , event_timer_(strand_)
+      , address_(address)
+      , stats_(stats)
+      , event_rate_(opts.event_rate_)
+      , random_(static_cast<std::mt19937::result_type>(index))
+      , pid_(static_cast<std::int32_t>(random_()) | 1)
+      , name_(fmt::format("Speaker {}", index + 1))
+      , usn_(fmt::format("uuid:5e0b9e6d-0000-4000-8000-{:012x}::{}", index, heos_search_target))
+      , volume_(static_cast<int>(random_() % 60))
+    {}
+
+    void start() {
+        net::dispatch(strand_, [this]() {
+            accept_next();
+            schedule_event();
+        });
+    }
+
+    void stop() {
+        net::dispatch(strand_, [this]() {
+            boost::system::error_code ec;
+            acceptor_.close(ec);
+            ssdp_socket_.close(ec);
+            event_timer_.cancel();
+            for (auto& session : sessions_) {
+                session->close();
+            }
+            sessions_.clear();
+        });
+    }
+
+    // Sends this device's SSDP response to a searcher after a random delay
+    // of up to max_delay, spreading the replies like real devices honouring
+    // the MX header do.
+    void answer_search(const udp::endpoint& searcher, std::chrono::milliseconds max_delay) {
+        net::dispatch(strand_, [this, searcher, max_delay]() {
+            auto response = std::make_shared<std::string>(fmt::format(
+                "HTTP/1.1 200 OK\r\n"
+                "CACHE-CONTROL: max-age=180\r\n"
+                "EXT:\r\n"
+                "LOCATION: http://{}:60006/upnp/desc/aios_device/aios_device.xml\r\n"
+                "SERVER: LINUX UPnP/1.0 Denon-Heos/149200\r\n"
+                "ST: {}\r\n"
+                "USN: {}\r\n"
+                "\r\n",
+                address_.to_string(), heos_search_target, usn_));
+            auto delay = std::make_shared<net::steady_timer>(strand_);
+            delay->expires_after(std::chrono::milliseconds(random_() % (max_delay.count() + 1)));
+            delay->async_wait([this, searcher, response, delay](const boost::system::error_code& ec) {
+                if (ec) {
+                    return;
+                }
+                ssdp_socket_.async_send_to(net::buffer(*response), searcher,
+                    [response](const boost::system::error_code& /*ec*/, std::size_t /*bytes*/) {});
+            });
+        });
+    }
+
+    // Called on the session's strand (the device strand) for every
+    // command line received.
+    void handle_command(cli_session& session, std::string_view line) {
+        stats_.commands_.fetch_add(1, std::memory_order_relaxed);
+        constexpr std::string_view scheme = "heos://";
+        if (line.substr(0, scheme.size()) == scheme) {
+            line.remove_prefix(scheme.size());
+        }
+        auto question = line.find('?');
+        auto command = line.substr(0, question);
+        auto query = question == std::string_view::npos ? std::string_view{} : line.substr(question + 1);
+
+        if (command == "player/get_players") {
+            session.send(fmt::format(
+                R"({{"heos": {{"command": "player/get_players", "result": "success", "message": ""}}, )"
+                R"("payload": [{{"name": "{}", "pid": {}, "model": "HEOS 1", "version": "3.34.620", )"
+                R"("ip": "{}", "network": "wifi", "lineout": 0}}]}})",
+                name_, pid_, address_.to_string()));
+        } else if (command == "player/get_volume") {
+            session.send(fmt::format(
+                R"({{"heos": {{"command": "player/get_volume", "result": "success", "message": "pid={}&level={}"}}}})",
+                pid_, volume_));
+        } else if (command == "player/set_volume") {
+            if (auto level = query_value(query, "level"); !level.empty()) {
+                volume_ = std::clamp(std::atoi(std::string(level).c_str()), 0, 100);
+            }
+            session.send(fmt::format(
+                R"({{"heos": {{"command": "player/set_volume", "result": "success", "message": "pid={}&level={}"}}}})",
+                pid_, volume_));
+            broadcast(fmt::format(
+                R"({{"heos": {{"command": "event/player_volume_changed", "message": "pid={}&level={}&mute=off"}}}})",
+                pid_, volume_));
+        } else if (command == "player/get_play_state") {
+            session.send(fmt::format(
+                R"({{"heos": {{"command": "player/get_play_state", "result": "success", "message": "pid={}&state={}"}}}})",
+                pid_, playing_ ? "play" : "pause"));
+        } else {
+            // heart_beat, register_for_change_events and anything unknown
+            // are acknowledged with their own query echoed back.
+            session.send(fmt::format(
+                R"({{"heos": {{"command": "{}", "result": "success", "message": "{}"}}}})",
+                command, query));
+        }
+    }
+
+private:
+    void accept_next() {
+        acceptor_.async_accept(strand_, [this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            stats_.connections_.fetch_add(1, std::memory_order_relaxed);
+            std::erase_if(sessions_, [](const auto& session) { return !session->open(); });
+            auto session = std::make_shared<cli_session>(std::move(socket), *this);
+            sessions_.push_back(session);
+            session->start();
+            accept_next();
+        });
+    }
+
+    // Events arrive as a Poisson process at event_rate_ per second.
+    void schedule_event() {
+        if (event_rate_ <= 0.0) {
+            return;
+        }
+        std::exponential_distribution<double> interval(event_rate_);
+        event_timer_.expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(interval(random_))));
+        event_timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (ec) {
+                return;
+            }
+            broadcast(next_event());
+            schedule_event();
+        });
+    }
+
+    // Mirrors the mix a playing speaker produces: mostly progress updates,
+    // with occasional volume, state and track changes.
+    std::string next_event() {
+        auto roll = random_() % 100;
+        if (roll < 70) {
+            position_ms_ += 1000;
+            return fmt::format(
+                R"({{"heos": {{"command": "event/player_now_playing_progress", )"
+                R"("message": "pid={}&cur_pos={}&duration=215000"}}}})",
+                pid_, position_ms_ % 215000);
+        }
+        if (roll < 85) {
+            volume_ = std::clamp(volume_ + static_cast<int>(random_() % 5) - 2, 0, 100);
+            return fmt::format(
+                R"({{"heos": {{"command": "event/player_volume_changed", "message": "pid={}&level={}&mute=off"}}}})",
+                pid_, volume_);
+        }
+        if (roll < 95) {
+            playing_ = !playing_;
+            return fmt::format(
+                R"({{"heos": {{"command": "event/player_state_changed", "message": "pid={}&state={}"}}}})",
+                pid_, playing_ ? "play" : "pause");
+        }
+        position_ms_ = 0;
+        return fmt::format(
+            R"({{"heos": {{"command": "event/player_now_playing_changed", "message": "pid={}"}}}})", pid_);
+    }
+
+    void broadcast(const std::string& line) {
+        for (auto& session : sessions_) {
+            if (session->open()) {
+                session->send(line);
+                stats_.events_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    net::strand<net::io_context::executor_type> strand_;
+    tcp::acceptor acceptor_;
+    udp::socket ssdp_socket_;
+    net::steady_timer event_timer_;
+    net::ip::address_v4 address_;
+    fleet_stats& stats_;
+    double event_rate_;
+    std::mt19937 random_;
+    std::int32_t pid_;
+    std::string name_;
+    std::string usn_;
+    int volume_;
+    bool playing_{true};
+    std::uint64_t position_ms_{0};
+    std::vector<std::shared_ptr<cli_session>> sessions_;
+};
+
+void cli_session::read_next() {
+    net::async_read_until(socket_, buffer_, '\n',
+        [self = shared_from_this()](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+            if (ec) {
+                self->close();
+                return;
+            }
+            std::istream stream(&self->buffer_);
+            std::string line;
+            std::getline(stream, line);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                self->device_.handle_command(*self, line);
+            }
+            self->read_next();
+        });
+}
+
+// Listens for M-SEARCH requests on the SSDP multicast group and on its
+// port for unicast searches, and fans them out to every device.
+class ssdp_listener {
+public:
+    ssdp_listener(net::io_context& io, const options& opts,
+                  std::vector<std::unique_ptr<simulated_device>>& devices, fleet_stats& stats)
+      : socket_(io)
+      , max_response_delay_(opts.max_response_delay_)
+      , devices_(devices)
+      , stats_(stats)
+    {
+        socket_.open(udp::v4());
+        socket_.set_option(net::socket_base::reuse_address(true));
+        socket_.bind(udp::endpoint(net::ip::address_v4::any(), opts.ssdp_port_));
+        auto group = net::ip::make_address_v4(opts.ssdp_group_);
+        boost::system::error_code ec;
+        socket_.set_option(net::ip::multicast::join_group(group, net::ip::address_v4::loopback()), ec);
+        if (ec) {
+            fmt::print(stderr, "Cannot join {} on loopback ({}); answering unicast searches only\n",
+                       opts.ssdp_group_, ec.message());
+        }
+    }
+
+    void start() {
+        receive_next();
+    }
+
+    void stop() {
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+
+private:
+    void receive_next() {
+        socket_.async_receive_from(net::buffer(buffer_), sender_,
+            [this](const boost::system::error_code& ec, std::size_t bytes) {
+                if (ec) {
+                    return;
+                }
+                std::string_view request(buffer_.data(), bytes);
+                auto st = header_value(request, "ST");
+                if (request.substr(0, 8) == "M-SEARCH" && (st == heos_search_target || st == "ssdp:all")) {
+                    stats_.searches_.fetch_add(1, std::memory_order_relaxed);
+                    auto max_delay = std::min(response_delay(header_value(request, "MX")), max_response_delay_);
+                    for (auto& device : devices_) {
+                        device->answer_search(sender_, max_delay);
+                    }
+                }
+                receive_next();
+            });
+    }
+
+    // MX is the searcher's maximum wait in seconds.
+    static std::chrono::milliseconds response_delay(std::string_view mx) {
+        int seconds = 1;
+        std::from_chars(mx.data(), mx.data() + mx.size(), seconds);
+        return std::chrono::seconds(std::max(seconds, 0));
+    }
+
+    udp::socket socket_;
+    std::chrono::milliseconds max_response_delay_;
+    std::vector<std::unique_ptr<simulated_device>>& devices_;
+    fleet_stats& stats_;
+    udp::endpoint sender_;
+    std::array<char, 2048> buffer_{};
+};
+
+// Returns the index-th usable address starting at first, skipping the
+// network and broadcast octets .0 and .255.
+net::ip::address_v4 device_address(const net::ip::address_v4& first, std::size_t index) {
+    auto value = first.to_uint();
+    for (std::size_t i = 0; i < index; ++i) {
+        do {
+            ++value;
+        } while ((value & 0xffU) == 0 || (value & 0xffU) == 0xffU);
+    }
+    return net::ip::address_v4(value);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto opts = parse_args(argc, argv);
+
+    net::io_context io(static_cast<int>(opts.threads_));
+    fleet_stats stats;
+
+    const auto first = net::ip::make_address_v4(opts.first_address_);
+    std::vector<std::unique_ptr<simulated_device>> devices;
+    devices.reserve(opts.devices_);
+    try {
+        for (std::size_t i = 0; i < opts.devices_; ++i) {
+            devices.push_back(std::make_unique<simulated_device>(io, i, device_address(first, i), opts, stats));
+        }
+    } catch (const boost::system::system_error& e) {
+        fmt::print(stderr, "Cannot bind device {} at {}: {}\n", devices.size() + 1,
+                   device_address(first, devices.size()).to_string(), e.code().message());
+        return EXIT_FAILURE;
+    }
+
+    ssdp_listener listener(io, opts, devices, stats);
+    listener.start();
+    for (auto& device : devices) {
+        device->start();
+    }
+
+    net::steady_timer report_timer(io);
+    std::function<void()> report = [&]() {
+        report_timer.expires_after(opts.report_interval_);
+        report_timer.async_wait([&](const boost::system::error_code& ec) {
+            if (ec) {
+                return;
+            }
+            fmt::print("searches {} connections {} events {} commands {}\n",
+                       stats.searches_.load(), stats.connections_.load(), stats.events_.load(),
+                       stats.commands_.load());
+            report();
+        });
+    };
+    if (opts.report_interval_.count() > 0) {
+        report();
+    }
+
+    net::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](const boost::system::error_code& ec, int /*signal_number*/) {
+        if (ec) {
+            return;
+        }
+        fmt::print("Stopping {} devices\n", devices.size());
+        listener.stop();
+        report_timer.cancel();
+        for (auto& device : devices) {
+            device->stop();
+        }
+    });
+
+    fmt::print("Simulating {} HEOS devices from {} to {} (CLI port {}, {} events/s each)\n",
+               devices.size(), first.to_string(),
+               device_address(first, devices.empty() ? 0 : devices.size() - 1).to_string(),
+               opts.cli_port_, opts.event_rate_);
+
+    std::vector<std::thread> pool;
+    for (std::size_t i = 1; i < opts.threads_; ++i) {
+        pool.emplace_back([&io]() { io.run(); });
+    }
+    io.run();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "heos_line.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr std::string_view volume_event =
+    R"({"heos": {"command": "event/player_volume_changed", "message": "pid=-1467659498&level=23&mute=off"}})";
+constexpr std::string_view sources_event =
+    R"({"heos": {"command": "event/sources_changed"}})";
+constexpr std::string_view players_response =
+    R"({"heos": {"command": "player/get_players", "result": "success", "message": ""}, "payload": [{"pid": 1}]})";
+
+}  // namespace
+
+TEST_CASE("scan_heos_line extracts command and message", "[heos-line]") {
+    auto fields = heos2mqtt::scan_heos_line(volume_event);
+    CHECK(fields.command_ == "event/player_volume_changed");
+    CHECK(fields.message_ == "pid=-1467659498&level=23&mute=off");
+    CHECK(heos2mqtt::message_pid(fields.message_) == -1467659498);
+
+    fields = heos2mqtt::scan_heos_line(R"({"heos":{"command":"system/heart_beat","result":"success"}})");
+    CHECK(fields.command_ == "system/heart_beat");
+    CHECK(fields.message_.empty());
+
+    CHECK(heos2mqtt::scan_heos_line("not a heos line").command_.empty());
+    CHECK(heos2mqtt::scan_heos_line(R"({"heos": {"command": 7}})").command_.empty());
+}
+
+TEST_CASE("scan_heos_line extracts result and stops at the payload", "[heos-line]") {
+    auto fields = heos2mqtt::scan_heos_line(players_response);
+    CHECK(fields.command_ == "player/get_players");
+    CHECK(fields.result_ == "success");
+    CHECK(fields.message_.empty());
+    CHECK(fields.has_payload_);
+
+    fields = heos2mqtt::scan_heos_line(
+        R"({"heos": {"command": "browse/browse", "result": "success", "message": "sid=1"}, )"
+        R"("payload": [{"name": "say \"command\": \"x\"", "command": "fake"}]})");
+    CHECK(fields.command_ == "browse/browse");
+    CHECK(fields.message_ == "sid=1");
+    CHECK(fields.has_payload_);
+
+    fields = heos2mqtt::scan_heos_line(R"({"heos": {"message": "a\"b", "command": "system/heart_beat"}})");
+    CHECK(fields.command_ == "system/heart_beat");
+    CHECK(fields.message_ == R"(a\"b)");
+    CHECK_FALSE(fields.has_payload_);
+}
+
+TEST_CASE("quote_mask agrees with the scalar scanner", "[heos-line]") {
+    std::mt19937 random(7);
+    for (int round = 0; round < 200; ++round) {
+        std::string text(random() % 100, 'a');
+        for (auto& c : text) {
+            c = random() % 8 == 0 ? '"' : static_cast<char>('a' + random() % 26);
+        }
+        for (std::size_t pos = 0; pos <= text.size(); ++pos) {
+            REQUIRE(heos2mqtt::detail::quote_mask(text, pos) == heos2mqtt::detail::quote_mask_scalar(text, pos));
+        }
+    }
+}
+
+TEST_CASE("message_pid only accepts a whole pid parameter", "[heos-line]") {
+    CHECK(heos2mqtt::message_pid("level=3&pid=42") == 42);
+    CHECK_FALSE(heos2mqtt::message_pid("spid=42"));
+    CHECK_FALSE(heos2mqtt::message_pid("pid=abc"));
+    CHECK_FALSE(heos2mqtt::message_pid(""));
+}
+
+TEST_CASE("line_filter drops by command, prefix and player", "[heos-line]") {
+    metrics::registry registry;
+    heos2mqtt::line_filter filter(registry);
+    CHECK(filter.empty());
+    CHECK(filter.accepts(volume_event));
+
+    filter.add_drop("event/sources_changed");
+    filter.add_drop("event/player_volume_changed@-1467659498");
+    filter.add_drop("player/*");
+    CHECK_FALSE(filter.empty());
+
+    CHECK_FALSE(filter.accepts(sources_event));
+    CHECK_FALSE(filter.accepts(volume_event));
+    CHECK_FALSE(filter.accepts(players_response));
+    CHECK(filter.accepts(R"({"heos": {"command": "event/player_volume_changed", "message": "pid=5&level=1"}})"));
+    CHECK(filter.accepts(R"({"heos": {"command": "event/sources_changed_too"}})"));
+    CHECK(filter.accepts(R"({"heos": {"command": "event/groups_changed"}})"));
+    CHECK(filter.accepts("unparseable"));
+
+    std::string text;
+    registry.render_prometheus(text);
+    CHECK(text.find("heos_lines_filtered_total 3\n") != std::string::npos);
+}
+
+TEST_CASE("line_filter rejects malformed rules", "[heos-line]") {
+    metrics::registry registry;
+    heos2mqtt::line_filter filter(registry);
+    CHECK_THROWS_AS(filter.add_drop(""), std::invalid_argument);
+    CHECK_THROWS_AS(filter.add_drop("event/Upper"), std::invalid_argument);
+    CHECK_THROWS_AS(filter.add_drop("event/x@"), std::invalid_argument);
+    CHECK_THROWS_AS(filter.add_drop("event/x@12a"), std::invalid_argument);
+    CHECK(filter.empty());
+}
+
+TEST_CASE("classify_command maps every documented name", "[heos-line]") {
+    using heos2mqtt::heos_command;
+    static_assert(heos2mqtt::classify_command("event/player_volume_changed") == heos_command::event_player_volume_changed);
+    static_assert(heos2mqtt::classify_command("player/get_volume") == heos_command::player_get_volume);
+
+    for (std::size_t i = 1; i < heos2mqtt::heos_command_count; ++i) {
+        auto command = static_cast<heos_command>(i);
+        CHECK(heos2mqtt::classify_command(heos2mqtt::to_string(command)) == command);
+    }
+    CHECK(heos2mqtt::classify_command("") == heos_command::unknown);
+    CHECK(heos2mqtt::classify_command("player/get_volumes") == heos_command::unknown);
+    CHECK(heos2mqtt::classify_command("event/") == heos_command::unknown);
+}
+
+TEST_CASE("command_counters count lines per command", "[heos-line]") {
+    metrics::registry registry;
+    heos2mqtt::command_counters counters(registry);
+    CHECK(counters.count(volume_event) == heos2mqtt::heos_command::event_player_volume_changed);
+    CHECK(counters.count(volume_event) == heos2mqtt::heos_command::event_player_volume_changed);
+    CHECK(counters.count("garbage") == heos2mqtt::heos_command::unknown);
+
+    std::string text;
+    registry.render_prometheus(text);
+    CHECK(text.find("heos_lines_total{command=\"event/player_volume_changed\"} 2\n") != std::string::npos);
+    CHECK(text.find("heos_lines_total{command=\"other\"} 1\n") != std::string::npos);
+}
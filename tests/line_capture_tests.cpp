@@ -0,0 +1,148 @@
+#include "line_capture.hpp"
+
+#include "run_until.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+std::filesystem::path capture_path(std::string_view name) {
+    return std::filesystem::temp_directory_path() / fmt::format("heos2mqtt_{}_{}.ndjson", name, ::getpid());
+}
+
+struct replay_result {
+    std::vector<std::string> lines_;
+    std::size_t done_lines_{0};
+    bool done_{false};
+};
+
+replay_result replay(const std::filesystem::path& path, double speed) {
+    boost::asio::io_context io;
+    replay_result result;
+    heos2mqtt::line_replayer replayer(io, path.string(), speed,
+        [&](std::string line, heos2mqtt::line_trace trace) {
+            CHECK(trace.traced());
+            result.lines_.push_back(std::move(line));
+        },
+        [&](std::size_t lines, heos2mqtt::line_trace::clock::duration) {
+            result.done_lines_ = lines;
+            result.done_ = true;
+        });
+    replayer.start();
+    test::run_until(io, [&]() { return result.done_; });
+    test::run_remaining(io);
+    return result;
+}
+
+}  // namespace
+
+TEST_CASE("replay speed parsing", "[line-capture]") {
+    using heos2mqtt::detail::parse_replay_speed;
+    CHECK(parse_replay_speed("max") == 0.0);
+    CHECK(parse_replay_speed("2x") == 2.0);
+    CHECK(parse_replay_speed("0.5") == 0.5);
+    CHECK_FALSE(parse_replay_speed("0x"));
+    CHECK_FALSE(parse_replay_speed("-1"));
+    CHECK_FALSE(parse_replay_speed("fast"));
+    CHECK_FALSE(parse_replay_speed(""));
+}
+
+TEST_CASE("recorded lines replay in order at max speed", "[line-capture]") {
+    const auto path = capture_path("max");
+    const auto origin = heos2mqtt::line_trace::clock::now();
+    {
+        heos2mqtt::line_recorder recorder(path.string());
+        recorder.record(R"({"heos": {"command": "event/players_changed"}})", origin);
+        recorder.record("line with \"quotes\" and \\ backslash", origin + 5s);
+        recorder.record("", origin + 6s);
+        CHECK(recorder.recorded() == 3);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto result = replay(path, 0.0);
+    CHECK(std::chrono::steady_clock::now() - start < 1s);
+    CHECK(result.done_lines_ == 3);
+    CHECK(result.lines_ == std::vector<std::string>{
+        R"({"heos": {"command": "event/players_changed"}})",
+        "line with \"quotes\" and \\ backslash",
+        ""});
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("replay honours recorded pacing scaled by speed", "[line-capture]") {
+    const auto path = capture_path("paced");
+    const auto origin = heos2mqtt::line_trace::clock::now();
+    {
+        heos2mqtt::line_recorder recorder(path.string());
+        recorder.record("first", origin);
+        recorder.record("second", origin + 1s);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto result = replay(path, 10.0);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(elapsed >= 100ms);
+    CHECK(elapsed < 1s);
+    CHECK(result.lines_ == std::vector<std::string>{"first", "second"});
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("replay skips malformed records", "[line-capture]") {
+    const auto path = capture_path("malformed");
+    {
+        std::ofstream out(path);
+        out << R"({"t_us":0,"line":"good"})" << '\n'
+            << "not json\n"
+            << R"({"t_us":"late","line":"bad time"})" << '\n'
+            << '\n'
+            << R"({"t_us":10,"line":"also good"})" << '\n';
+    }
+
+    auto result = replay(path, 0.0);
+    CHECK(result.lines_ == std::vector<std::string>{"good", "also good"});
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("replay delivers the pieces of an over-long line as pieces", "[line-capture]") {
+    const auto path = capture_path("fragments");
+    const auto origin = heos2mqtt::line_trace::clock::now();
+    {
+        heos2mqtt::line_recorder recorder(path.string());
+        recorder.record("first piece", {.read_ = origin, .fragment_ = 0, .continued_ = true});
+        recorder.record("last piece", {.read_ = origin, .fragment_ = 1, .continued_ = false});
+        recorder.record("whole", origin);
+    }
+
+    boost::asio::io_context io;
+    std::vector<heos2mqtt::line_trace> traces;
+    bool done = false;
+    heos2mqtt::line_replayer replayer(io, path.string(), 0.0,
+        [&](std::string, heos2mqtt::line_trace trace) { traces.push_back(trace); },
+        [&](std::size_t, heos2mqtt::line_trace::clock::duration) { done = true; });
+    replayer.start();
+    test::run_until(io, [&]() { return done; });
+
+    REQUIRE(traces.size() == 3);
+    CHECK(traces[0].fragment_ == 0);
+    CHECK(traces[0].continued_);
+    CHECK(traces[1].fragment_ == 1);
+    CHECK_FALSE(traces[1].continued_);
+    CHECK_FALSE(traces[2].fragmented());
+
+    test::run_remaining(io);
+    std::filesystem::remove(path);
+}
@@ -1,11 +1,19 @@
+#include "logging/async_destination.hpp"
 #include "logging/logging.hpp"
 
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace {
 
@@ -47,6 +55,47 @@ private:
     std::ostream stream_;
 };
 
+// Destination that keeps deferred records unformatted until asked, to show
+// that arguments were captured by value at the call site.
+class deferred_capture final : public logging::log_destination {
+public:
+    void emit(const logging::log_record& record) override {
+        eager_.emplace_back(record.message());
+    }
+
+    [[nodiscard]] bool defers_formatting() const override {
+        return true;
+    }
+
+    void emit_deferred(const logging::deferred_record& record) override {
+        deferred_.push_back({record.format(), record.formatter(),
+                             {record.args().begin(), record.args().end()}});
+    }
+
+    [[nodiscard]] std::vector<std::string> format_deferred() const {
+        std::vector<std::string> messages;
+        for (const auto& item : deferred_) {
+            auto& message = messages.emplace_back();
+            item.formatter_(message, item.format_, item.args_.data());
+        }
+        return messages;
+    }
+
+    [[nodiscard]] const std::vector<std::string>& eager() const {
+        return eager_;
+    }
+
+private:
+    struct captured {
+        std::string_view format_;
+        logging::deferred_formatter formatter_;
+        std::vector<std::byte> args_;
+    };
+
+    std::vector<captured> deferred_;
+    std::vector<std::string> eager_;
+};
+
 }  // namespace
 
 TEST_CASE("logging emits formatted messages", "[logging]") {
@@ -95,3 +144,186 @@ TEST_CASE("logging routes by severity destination", "[logging]") {
 
     CHECK(error_output.find("err 3") != std::string::npos);
 }
+
+TEST_CASE("logging module override enables one source file", "[logging]") {
+    if (logging::compile_time_min_level > logging::severity::debug) {
+        SKIP("debug logging is compiled out");
+    }
+    log_capture capture;
+    scoped_logger_override guard(logging::logger(logging::severity::info, capture.destination()));
+
+    logging::debug("hidden {}", 1);
+    CHECK(logging::logger::get_module(std::source_location::current()).name() == "logging_tests");
+
+    logging::logger::set_module_level("logging_tests", logging::severity::debug);
+    logging::debug("shown {}", 2);
+    logging::logger::set_module_level("logging_tests", logging::severity::error);
+    logging::warning("hidden {}", 3);
+    logging::logger::set_module_level("logging_tests", std::nullopt);
+    logging::debug("hidden {}", 4);
+
+    auto output = capture.str();
+    CHECK(output.find("hidden") == std::string::npos);
+    CHECK(output.find("shown 2") != std::string::npos);
+}
+
+TEST_CASE("logging applies level specs", "[logging]") {
+    scoped_logger_override guard(logging::logger(logging::severity::info,
+        std::make_shared<deferred_capture>()));
+    auto& module = logging::logger::get_module(std::source_location::current());
+
+    CHECK(logging::logger::apply_level_spec("warning,logging_tests=debug"));
+    CHECK(logging::logger::get_default().min_level() == logging::severity::warning);
+    CHECK(module.level() == logging::severity::debug);
+
+    CHECK(logging::logger::apply_level_spec("logging_tests=default"));
+    CHECK_FALSE(module.level().has_value());
+
+    CHECK_FALSE(logging::logger::apply_level_spec("logging_tests=error,bogus"));
+    CHECK_FALSE(logging::logger::apply_level_spec("default"));
+    CHECK_FALSE(module.level().has_value());
+    CHECK(logging::logger::get_default().min_level() == logging::severity::warning);
+}
+
+TEST_CASE("logging defers formatting of captured arguments", "[logging]") {
+    auto capture = std::make_shared<deferred_capture>();
+    scoped_logger_override guard(logging::logger(logging::severity::debug, capture));
+
+    std::string text = "before";
+    logging::info("{} {} {:.1f} {}", 42, text, 2.5, logging::severity::warning);
+    text = "after";
+
+    CHECK(capture->eager().empty());
+    CHECK(capture->format_deferred() == std::vector<std::string>{"42 before 2.5 WRN"});
+}
+
+TEST_CASE("logging formats non-capturable arguments eagerly", "[logging]") {
+    auto capture = std::make_shared<deferred_capture>();
+    scoped_logger_override guard(logging::logger(logging::severity::debug, capture));
+
+    int value = 0;
+    logging::info("pointer {}", static_cast<const void*>(&value));
+
+    CHECK(capture->format_deferred().empty());
+    REQUIRE(capture->eager().size() == 1);
+    CHECK(capture->eager().front().starts_with("pointer 0x"));
+}
+
+TEST_CASE("async destination writes records in order", "[logging]") {
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::tmpfile(), &std::fclose);
+    REQUIRE(file);
+
+    {
+        auto destination = std::make_shared<logging::log_destination_async>(fileno(file.get()));
+        scoped_logger_override guard(logging::logger(logging::severity::debug, destination));
+
+        for (int i = 0; i < 100; ++i) {
+            logging::info("record {}", i);
+        }
+        destination->flush();
+        CHECK(destination->dropped() == 0);
+    }
+
+    std::rewind(file.get());
+    std::string contents;
+    std::array<char, 4096> chunk{};
+    while (auto n = std::fread(chunk.data(), 1, chunk.size(), file.get())) {
+        contents.append(chunk.data(), n);
+    }
+
+    std::size_t previous = 0;
+    for (int i = 0; i < 100; ++i) {
+        auto pos = contents.find("record " + std::to_string(i) + "\n");
+        REQUIRE(pos != std::string::npos);
+        CHECK(pos >= previous);
+        previous = pos;
+    }
+    CHECK(contents.find("INF") != std::string::npos);
+}
+
+TEST_CASE("async destination writes messages longer than a slot in full", "[logging]") {
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::tmpfile(), &std::fclose);
+    REQUIRE(file);
+
+    const std::string longer(logging::log_destination_async::max_message_size * 3, 'x');
+    const std::string shorter(16, 'y');
+    {
+        logging::log_destination_async destination(
+            fileno(file.get()), {.capacity_ = 2, .overflow_ = logging::overflow_policy::block});
+        for (int i = 0; i < 4; ++i) {
+            destination.emit(logging::log_record(logging::severity::info, longer + "end", std::source_location::current()));
+            destination.emit(logging::log_record(logging::severity::info, shorter, std::source_location::current()));
+        }
+        destination.flush();
+        CHECK(destination.dropped() == 0);
+    }
+
+    std::rewind(file.get());
+    std::string contents;
+    std::array<char, 4096> chunk{};
+    while (auto n = std::fread(chunk.data(), 1, chunk.size(), file.get())) {
+        contents.append(chunk.data(), n);
+    }
+
+    std::size_t full = 0;
+    std::size_t brief = 0;
+    std::istringstream lines(contents);
+    for (std::string line; std::getline(lines, line);) {
+        if (line.ends_with(longer + "end")) {
+            ++full;
+        } else if (line.ends_with(" " + shorter)) {
+            ++brief;
+        }
+    }
+    CHECK(full == 4);
+    CHECK(brief == 4);
+}
+
+TEST_CASE("async destination counts records dropped on overflow", "[logging]") {
+    std::array<int, 2> fds{};
+    REQUIRE(::pipe(fds.data()) == 0);
+
+    std::thread reader;
+    {
+        // Nobody reads the pipe yet, so the writer blocks once the pipe
+        // buffer fills and the tiny ring overflows behind it.
+        logging::log_destination_async destination(
+            fds[1], {.capacity_ = 4, .overflow_ = logging::overflow_policy::drop});
+        const std::string message(400, 'x');
+        for (int i = 0; i < 2000; ++i) {
+            destination.emit(logging::log_record(logging::severity::info, message, std::source_location::current()));
+        }
+        CHECK(destination.dropped() > 0);
+
+        reader = std::thread([fd = fds[0]]() {
+            std::array<char, 4096> chunk{};
+            while (::read(fd, chunk.data(), chunk.size()) > 0) {
+            }
+        });
+    }
+
+    ::close(fds[1]);
+    reader.join();
+    ::close(fds[0]);
+}
+
+TEST_CASE("logging cost of disabled calls", "[.][benchmark]") {
+    auto capture = std::make_shared<deferred_capture>();
+    scoped_logger_override guard(logging::logger(logging::severity::error, capture));
+    int value = 42;
+
+    BENCHMARK("below runtime level") {
+        logging::warning("value {} {}", value, "text");
+        return value;
+    };
+
+    if constexpr (logging::compile_time_min_level > logging::severity::debug) {
+        BENCHMARK("below compile-time level") {
+            logging::debug("value {} {}", value, "text");
+            return value;
+        };
+    }
+
+    CHECK(capture->eager().empty());
+    CHECK(capture->format_deferred().empty());
+}
@@ -0,0 +1,129 @@
+#include "metrics/metrics.hpp"
+#include "metrics_server.hpp"
+
+#include "run_until.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+using Catch::Matchers::ContainsSubstring;
+
+TEST_CASE("metrics registry renders Prometheus text", "[metrics]") {
+    metrics::registry registry;
+    registry.add_counter("lines_total", "Lines read", R"(device="a")").inc(3);
+    registry.add_counter("lines_total", "Lines read", R"(device="b")").inc();
+    registry.add_gauge("depth", "Queue depth").set(-2);
+
+    std::string text;
+    registry.render_prometheus(text);
+
+    CHECK_THAT(text, ContainsSubstring("# HELP lines_total Lines read\n# TYPE lines_total counter\n"));
+    CHECK_THAT(text, ContainsSubstring("lines_total{device=\"a\"} 3\n"));
+    CHECK_THAT(text, ContainsSubstring("lines_total{device=\"b\"} 1\n"));
+    CHECK_THAT(text, ContainsSubstring("# TYPE depth gauge\ndepth -2\n"));
+}
+
+TEST_CASE("metrics registry returns existing series", "[metrics]") {
+    metrics::registry registry;
+    auto& first = registry.add_counter("events_total", "Events");
+    auto& second = registry.add_counter("events_total", "Events");
+    CHECK(&first == &second);
+
+    CHECK_THROWS_AS(registry.add_gauge("events_total", "Events"), std::invalid_argument);
+}
+
+TEST_CASE("metrics histogram accumulates buckets", "[metrics]") {
+    metrics::registry registry;
+    constexpr std::array<double, 2> bounds{0.1, 1.0};
+    auto& latency = registry.add_histogram("latency_seconds", "Latency", bounds);
+    latency.observe(0.05);
+    latency.observe(500ms);
+    latency.observe(2.0);
+    latency.observe(0.1);
+
+    auto snapshot = latency.collect();
+    CHECK(snapshot.counts_ == std::vector<std::uint64_t>{2, 1, 1});
+    CHECK(snapshot.count_ == 4);
+    CHECK(snapshot.sum_ == 2.65);
+
+    std::string text;
+    registry.render_prometheus(text);
+    CHECK_THAT(text, ContainsSubstring("latency_seconds_bucket{le=\"0.1\"} 2\n"));
+    CHECK_THAT(text, ContainsSubstring("latency_seconds_bucket{le=\"1\"} 3\n"));
+    CHECK_THAT(text, ContainsSubstring("latency_seconds_bucket{le=\"+Inf\"} 4\n"));
+    CHECK_THAT(text, ContainsSubstring("latency_seconds_count 4\n"));
+
+    std::string json;
+    registry.render_json(json);
+    CHECK(json == R"({"latency_seconds":{"count":4,"sum":2.65,"buckets":{"0.1":2,"1":3,"+Inf":4}}})");
+}
+
+TEST_CASE("metrics counters are safe to update from many threads", "[metrics]") {
+    metrics::registry registry;
+    auto& count = registry.add_counter("updates_total", "Updates");
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&count]() {
+            for (int j = 0; j < 10000; ++j) {
+                count.inc();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(count.value() == 40000);
+}
+
+TEST_CASE("metrics_server serves the registry", "[metrics]") {
+    namespace http = boost::beast::http;
+    using tcp = boost::asio::ip::tcp;
+
+    boost::asio::io_context io;
+    metrics::registry registry;
+    registry.add_counter("served_total", "Served").inc(7);
+
+    heos2mqtt::metrics_server server(io, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0), registry);
+    server.start();
+    const auto endpoint = server.local_endpoint();
+
+    auto fetch = [&](std::string target) {
+        std::atomic<bool> done{false};
+        http::response<http::string_body> response;
+        std::thread client([&]() {
+            boost::asio::io_context client_io;
+            tcp::socket socket(client_io);
+            socket.connect(endpoint);
+            http::request<http::empty_body> request{http::verb::get, target, 11};
+            http::write(socket, request);
+            boost::beast::flat_buffer buffer;
+            http::read(socket, buffer, response);
+            done = true;
+        });
+        test::run_until(io, [&]() { return done.load(); });
+        client.join();
+        return response;
+    };
+
+    auto metrics = fetch("/metrics");
+    CHECK(metrics.result() == http::status::ok);
+    CHECK_THAT(std::string(metrics[http::field::content_type]), ContainsSubstring("text/plain"));
+    CHECK_THAT(metrics.body(), ContainsSubstring("served_total 7\n"));
+
+    CHECK(fetch("/other").result() == http::status::not_found);
+
+    server.stop();
+    test::run_remaining(io);
+}
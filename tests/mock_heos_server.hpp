@@ -0,0 +1,91 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace test {
+
+class mock_heos_server {
+public:
+    mock_heos_server(boost::asio::io_context& io, std::uint16_t port)
+    : acceptor_(io, {boost::asio::ip::tcp::v4(), port})
+    , socket_(io)
+    {}
+
+    struct batch {
+        std::vector<std::string> lines_;
+        bool close_after_{true};
+        std::size_t index_{0};
+    };
+
+    void enqueue(batch batch_item) {
+        batches_.push_back(std::move(batch_item));
+    }
+
+    [[nodiscard]] std::uint16_t port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+    void start() {
+        accept_next();
+    }
+
+    void stop() {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        socket_.close(ec);
+    }
+
+private:
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            socket_ = std::move(socket);
+            if (batches_.empty()) {
+                return;
+            }
+
+            auto batch_item = std::make_shared<batch>(std::move(batches_.front()));
+            batches_.pop_front();
+            send_batch(batch_item);
+        });
+    }
+
+    void send_batch(const std::shared_ptr<batch>& batch_item) {
+        if (batch_item->index_ >= batch_item->lines_.size()) {
+            if (batch_item->close_after_) {
+                boost::system::error_code ec;
+                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+                socket_.close(ec);
+                accept_next();
+            }
+            return;
+        }
+
+        auto line = batch_item->lines_[batch_item->index_++] + "\r\n";
+        boost::asio::async_write(
+            socket_, boost::asio::buffer(line),
+            [this, batch_item](const boost::system::error_code& ec, std::size_t /*bytes*/) {
+                if (ec) {
+                    accept_next();
+                    return;
+                }
+                send_batch(batch_item);
+            });
+    }
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::tcp::socket socket_;
+    std::deque<batch> batches_;
+};
+
+}  // namespace test
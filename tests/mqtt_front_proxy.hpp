@@ -0,0 +1,209 @@
+#pragma once
+
+#include "tls_test_server.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/stream_traits.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace test {
+
+// Terminates TLS, MQTT over WebSocket or both in front of a plain TCP broker
+// such as fake_mqtt_broker, the way a Mosquitto listener would, and relays
+// the MQTT bytes both ways. Uses the certificate of
+// use_self_signed_certificate().
+class mqtt_front_proxy {
+public:
+    using tcp = boost::asio::ip::tcp;
+
+    enum class mode {
+        tls,
+        websocket,
+        websocket_tls,
+    };
+
+    mqtt_front_proxy(boost::asio::io_context& io, mode front, std::uint16_t backend_port)
+      : context_(boost::asio::ssl::context::tls_server)
+      , acceptor_(io, {boost::asio::ip::make_address("127.0.0.1"), 0})
+      , mode_(front)
+      , backend_port_(backend_port)
+    {
+        use_self_signed_certificate(context_);
+        accept_next();
+    }
+
+    [[nodiscard]] std::uint16_t port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+    boost::asio::ssl::context& context() {
+        return context_;
+    }
+
+    // Connections whose TLS and WebSocket handshakes completed.
+    [[nodiscard]] std::size_t accepted() const {
+        return accepted_;
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    }
+
+private:
+    using tls_stream = boost::asio::ssl::stream<tcp::socket>;
+
+    template <typename Stream>
+    struct session : std::enable_shared_from_this<session<Stream>> {
+        template <typename... Args>
+        explicit session(tcp::socket backend, Args&&... args)
+          : client_(std::forward<Args>(args)...)
+          , backend_(std::move(backend))
+        {}
+
+        static constexpr bool websocket = !std::is_same_v<Stream, tls_stream>;
+
+        void relay() {
+            if constexpr (websocket) {
+                client_.binary(true);
+            }
+            pump_up();
+            pump_down();
+        }
+
+        void pump_up() {
+            client_.async_read_some(boost::asio::buffer(up_),
+                [self = this->shared_from_this()](const boost::system::error_code& ec, std::size_t bytes) {
+                    if (ec) {
+                        self->close();
+                        return;
+                    }
+                    boost::asio::async_write(self->backend_, boost::asio::buffer(self->up_, bytes),
+                        [self](const boost::system::error_code& write_ec, std::size_t /*bytes*/) {
+                            if (write_ec) {
+                                self->close();
+                                return;
+                            }
+                            self->pump_up();
+                        });
+                });
+        }
+
+        void pump_down() {
+            backend_.async_read_some(boost::asio::buffer(down_),
+                [self = this->shared_from_this()](const boost::system::error_code& ec, std::size_t bytes) {
+                    if (ec) {
+                        self->close();
+                        return;
+                    }
+                    auto next = [self](const boost::system::error_code& write_ec, std::size_t /*bytes*/) {
+                        if (write_ec) {
+                            self->close();
+                            return;
+                        }
+                        self->pump_down();
+                    };
+                    if constexpr (websocket) {
+                        self->client_.async_write(boost::asio::buffer(self->down_, bytes), std::move(next));
+                    } else {
+                        boost::asio::async_write(self->client_, boost::asio::buffer(self->down_, bytes),
+                            std::move(next));
+                    }
+                });
+        }
+
+        void close() {
+            boost::system::error_code ignored;
+            backend_.close(ignored);
+            boost::beast::get_lowest_layer(client_).close(ignored);
+        }
+
+        Stream client_;
+        tcp::socket backend_;
+        std::array<char, 4096> up_{};
+        std::array<char, 4096> down_{};
+    };
+
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            auto backend = std::make_shared<tcp::socket>(socket.get_executor());
+            backend->async_connect({boost::asio::ip::make_address("127.0.0.1"), backend_port_},
+                [this, backend, client = std::make_shared<tcp::socket>(std::move(socket))](
+                    const boost::system::error_code& connect_ec) {
+                    if (!connect_ec) {
+                        serve(std::move(*client), std::move(*backend));
+                    }
+                });
+            accept_next();
+        });
+    }
+
+    void serve(tcp::socket client, tcp::socket backend) {
+        using websocket_stream = boost::beast::websocket::stream<tcp::socket>;
+        using websocket_tls_stream = boost::beast::websocket::stream<tls_stream>;
+        switch (mode_) {
+        case mode::tls: {
+            auto relay = std::make_shared<session<tls_stream>>(std::move(backend), std::move(client), context_);
+            relay->client_.async_handshake(tls_stream::server, [this, relay](const boost::system::error_code& ec) {
+                if (!ec) {
+                    ++accepted_;
+                    relay->relay();
+                }
+            });
+            break;
+        }
+        case mode::websocket: {
+            auto relay = std::make_shared<session<websocket_stream>>(std::move(backend), std::move(client));
+            accept_websocket(relay);
+            break;
+        }
+        case mode::websocket_tls: {
+            auto relay =
+                std::make_shared<session<websocket_tls_stream>>(std::move(backend), std::move(client), context_);
+            relay->client_.next_layer().async_handshake(tls_stream::server,
+                [this, relay](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        accept_websocket(relay);
+                    }
+                });
+            break;
+        }
+        }
+    }
+
+    template <typename Session>
+    void accept_websocket(const std::shared_ptr<Session>& relay) {
+        // MQTT clients ask for the "mqtt" subprotocol and expect it back.
+        relay->client_.set_option(boost::beast::websocket::stream_base::decorator(
+            [](boost::beast::websocket::response_type& response) {
+                response.set(boost::beast::http::field::sec_websocket_protocol, "mqtt");
+            }));
+        relay->client_.async_accept([this, relay](const boost::system::error_code& ec) {
+            if (!ec) {
+                ++accepted_;
+                relay->relay();
+            }
+        });
+    }
+
+    boost::asio::ssl::context context_;
+    tcp::acceptor acceptor_;
+    mode mode_;
+    std::uint16_t backend_port_;
+    std::size_t accepted_{0};
+};
+
+}  // namespace test
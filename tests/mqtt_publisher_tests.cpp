@@ -0,0 +1,549 @@
+#include "metrics/metrics.hpp"
+#include "mqtt_publisher.hpp"
+
+#include "fake_mqtt_broker.hpp"
+#include "mqtt_front_proxy.hpp"
+#include "run_until.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+#include <fmt/core.h>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+using Catch::Matchers::ContainsSubstring;
+
+namespace {
+
+// Starts publisher against broker and waits until the CONNACK has been
+// processed.
+template <typename Broker>
+void connect(boost::asio::io_context& io, heos2mqtt::mqtt_publisher& publisher,
+             const Broker& broker, std::size_t connections = 1) {
+    publisher.start();
+    test::run_until(io, [&]() { return broker.connections() >= connections; });
+    test::run_for(io, 100ms);
+}
+
+}  // namespace
+
+TEST_CASE("mqtt_publisher publishes lines as JSON at QoS 1", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_record(true);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    connect(io, publisher, broker);
+
+    publisher.publish_raw("line1");
+    publisher.publish_raw("line2");
+    test::run_until(io, [&]() { return broker.published() == 2; });
+
+    const auto& messages = broker.messages();
+    REQUIRE(messages.size() == 2);
+    CHECK(messages[0].topic_ == "heos/raw");
+    CHECK(messages[0].qos_ == 1);
+    CHECK_THAT(messages[0].payload_, ContainsSubstring(R"("raw":"line1")"));
+    CHECK_THAT(messages[1].payload_, ContainsSubstring(R"("raw":"line2")"));
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher keeps publishing while acknowledgements lag", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_ack_delay(300ms);
+    broker.start();
+
+    auto& in_flight = metrics::registry::get_default().add_gauge("mqtt_in_flight", "Publishes awaiting PUBACK");
+    const auto idle = in_flight.value();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    connect(io, publisher, broker);
+
+    for (int i = 0; i < 10; ++i) {
+        publisher.publish_raw("line");
+    }
+    test::run_until(io, [&]() { return broker.published() == 10; });
+    CHECK(in_flight.value() == idle + 10);
+
+    test::run_until(io, [&]() { return in_flight.value() == idle; });
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher reconnects after the broker drops it", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_record(true);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    connect(io, publisher, broker);
+
+    broker.disconnect_all();
+    test::run_until(io, [&]() { return broker.connections() == 2; }, 15s);
+    test::run_for(io, 100ms);
+
+    publisher.publish_raw("after reconnect");
+    test::run_until(io, [&]() { return broker.published() == 1; });
+    CHECK_THAT(broker.messages().front().payload_, ContainsSubstring("after reconnect"));
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher survives a reconnect storm", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_disconnect_after(3);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    connect(io, publisher, broker);
+
+    // Keep publishing; every third message costs the publisher its
+    // connection and lines sent while reconnecting wait in the backlog.
+    boost::asio::steady_timer ticker(io);
+    std::function<void()> tick = [&]() {
+        publisher.publish_raw("tick");
+        ticker.expires_after(10ms);
+        ticker.async_wait([&](const boost::system::error_code& ec) {
+            if (!ec) {
+                tick();
+            }
+        });
+    };
+    tick();
+
+    test::run_until(io, [&]() { return broker.connections() >= 3; }, 30s);
+    ticker.cancel();
+    CHECK(broker.published() >= 6);
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher delivers control messages", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.start();
+
+    std::vector<std::pair<std::string, std::string>> received;
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    publisher.set_control_handler([&](std::string_view command, std::string_view payload) {
+        received.emplace_back(command, payload);
+    });
+    connect(io, publisher, broker);
+    test::run_until(io, [&]() { return broker.subscriptions() == 1; });
+
+    broker.publish("heos/control/log_level", "ssdp_resolver=debug");
+    broker.publish("heos/other", "ignored");
+    test::run_until(io, [&]() { return !received.empty(); });
+    test::run_for(io, 100ms);
+
+    REQUIRE(received.size() == 1);
+    CHECK(received.front().first == "log_level");
+    CHECK(received.front().second == "ssdp_resolver=debug");
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("build_payload marks pieces of an over-long line", "[mqtt-publisher]") {
+    CHECK(heos2mqtt::detail::build_payload("abc", "t") == R"({"raw":"abc","ts":"t"})");
+
+    heos2mqtt::line_trace first{.fragment_ = 0, .continued_ = true};
+    CHECK(heos2mqtt::detail::build_payload("abc", "t", first) ==
+          R"({"raw":"abc","ts":"t","part":0,"more":true})");
+
+    heos2mqtt::line_trace last{.fragment_ = 2, .continued_ = false};
+    CHECK(heos2mqtt::detail::build_payload("def", "t", last) ==
+          R"({"raw":"def","ts":"t","part":2,"more":false})");
+}
+
+TEST_CASE("parse_brokers and rank_brokers order brokers by health", "[mqtt-publisher]") {
+    using heos2mqtt::detail::broker_health;
+    auto brokers = heos2mqtt::detail::parse_brokers("a:1884, b,[::1]:1885,,fe80::1", 1883);
+    REQUIRE(brokers.size() == 4);
+    CHECK(brokers[0].host_ == "a");
+    CHECK(brokers[0].port_ == 1884);
+    CHECK(brokers[1].host_ == "b");
+    CHECK(brokers[1].port_ == 1883);
+    CHECK(brokers[2].host_ == "::1");
+    CHECK(brokers[2].port_ == 1885);
+    CHECK(brokers[3].host_ == "fe80::1");
+    CHECK(brokers[3].port_ == 1883);
+
+    const auto now = broker_health::clock::now();
+    // Untried brokers keep their configured order.
+    CHECK(heos2mqtt::detail::rank_brokers(brokers, now) == "a:1884,b:1883,[::1]:1885,[fe80::1]:1883");
+
+    // A failure sends a broker to the back; a fast connect to the front.
+    brokers[0].record_failure(now);
+    brokers[2].record_success(10ms);
+    CHECK(heos2mqtt::detail::rank_brokers(brokers, now) == "[::1]:1885,b:1883,[fe80::1]:1883,a:1884");
+
+    // Failures are forgiven once they are old enough.
+    CHECK(heos2mqtt::detail::rank_brokers(brokers, now + broker_health::failure_memory) ==
+          "[::1]:1885,b:1883,[fe80::1]:1883,a:1884");
+    CHECK(brokers.back().score(now + broker_health::failure_memory) == broker_health::untried_latency);
+
+    // Unix sockets stand behind a placeholder loopback port.
+    auto local = heos2mqtt::detail::parse_brokers("unix:///run/mosquitto/mosquitto.sock", 1883);
+    REQUIRE(local.size() == 1);
+    CHECK(local[0].unix_path_ == "/run/mosquitto/mosquitto.sock");
+    CHECK(local[0].name() == "unix:///run/mosquitto/mosquitto.sock");
+    CHECK(local[0].host_ == "127.0.0.1");
+    CHECK(heos2mqtt::detail::unix_socket_path(local[0].port_) == "/run/mosquitto/mosquitto.sock");
+    CHECK(heos2mqtt::detail::parse_brokers("unix:///run/mosquitto/mosquitto.sock", 1883)[0].port_ == local[0].port_);
+}
+
+TEST_CASE("mqtt_publisher fails over to the next broker and keeps its lines", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker primary(io);
+    test::fake_mqtt_broker secondary(io);
+    primary.start();
+    secondary.set_record(true);
+    secondary.start();
+
+    heos2mqtt::mqtt_publisher publisher(
+        io, fmt::format("127.0.0.1:{},127.0.0.1:{}", primary.port(), secondary.port()), "1883", "heos");
+    connect(io, publisher, primary);
+    CHECK(secondary.connections() == 0);
+
+    primary.stop();
+    publisher.publish_raw("during failover 1");
+    publisher.publish_raw("during failover 2");
+
+    // Well inside the three seconds the single broker restart waits.
+    const auto started = std::chrono::steady_clock::now();
+    test::run_until(io, [&]() { return secondary.published() == 2; }, 5s);
+    CHECK(std::chrono::steady_clock::now() - started < 2s);
+
+    const auto& messages = secondary.messages();
+    REQUIRE(messages.size() == 2);
+    CHECK_THAT(messages[0].payload_, ContainsSubstring("during failover 1"));
+    CHECK_THAT(messages[1].payload_, ContainsSubstring("during failover 2"));
+
+    publisher.stop();
+    secondary.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher fails over on a dropped connection despite its session", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker primary(io);
+    test::fake_mqtt_broker secondary(io);
+    primary.start();
+    secondary.set_record(true);
+    secondary.start();
+
+    // Default session expiry; the primary keeps accepting connections, so
+    // only an immediate failover avoids reconnecting to it.
+    heos2mqtt::mqtt_publisher publisher(
+        io, fmt::format("127.0.0.1:{},127.0.0.1:{}", primary.port(), secondary.port()), "1883", "heos");
+    connect(io, publisher, primary);
+
+    primary.disconnect_all();
+    publisher.publish_raw("after the drop");
+    const auto started = std::chrono::steady_clock::now();
+    test::run_until(io, [&]() { return secondary.published() == 1; }, 5s);
+    CHECK(std::chrono::steady_clock::now() - started < 2s);
+    CHECK(primary.connections() == 1);
+    CHECK_THAT(secondary.messages().front().payload_, ContainsSubstring("after the drop"));
+
+    publisher.stop();
+    primary.stop();
+    secondary.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher resends publishes in flight at a failover in their original order", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker primary(io);
+    test::fake_mqtt_broker secondary(io);
+    primary.set_ack_delay(5s);
+    primary.start();
+    secondary.set_record(true);
+    secondary.start();
+
+    heos2mqtt::mqtt_publisher publisher(
+        io, fmt::format("127.0.0.1:{},127.0.0.1:{}", primary.port(), secondary.port()), "1883", "heos");
+    connect(io, publisher, primary);
+
+    for (int i = 0; i < 3; ++i) {
+        publisher.publish_raw(fmt::format("in flight {}", i));
+    }
+    test::run_until(io, [&]() { return primary.published() == 3; });
+
+    primary.disconnect_all();
+    publisher.publish_raw("after the drop");
+    test::run_until(io, [&]() { return secondary.published() == 4; });
+
+    const auto messages = secondary.messages();
+    REQUIRE(messages.size() == 4);
+    for (int i = 0; i < 3; ++i) {
+        CHECK_THAT(messages[i].payload_, ContainsSubstring(fmt::format("in flight {}", i)));
+    }
+    CHECK_THAT(messages[3].payload_, ContainsSubstring("after the drop"));
+
+    publisher.stop();
+    primary.stop();
+    secondary.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher resumes its session and resends unacknowledged publishes", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_record(true);
+    broker.set_persistent_sessions(true);
+    broker.set_ack_delay(1s);
+    broker.start();
+
+    auto& errors = metrics::registry::get_default().add_counter(
+        "mqtt_publish_errors_total", "Publishes that failed or were rejected");
+    const auto errors_before = errors.value();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    publisher.set_client_id("heos2mqtt-session-test");
+    publisher.set_session_expiry(600s);
+    connect(io, publisher, broker);
+
+    publisher.publish_raw("unacked 1");
+    publisher.publish_raw("unacked 2");
+    test::run_until(io, [&]() { return broker.published() == 2; });
+
+    // Drop the connection while both PUBACKs are still held back.
+    broker.disconnect_all();
+    test::run_until(io, [&]() { return broker.published() == 4; }, 15s);
+
+    const auto& requests = broker.connect_requests();
+    REQUIRE(requests.size() == 2);
+    for (const auto& request : requests) {
+        CHECK(request.client_id_ == "heos2mqtt-session-test");
+        CHECK_FALSE(request.clean_start_);
+        CHECK(request.session_expiry_ == 600);
+    }
+
+    const auto& messages = broker.messages();
+    REQUIRE(messages.size() == 4);
+    CHECK_FALSE(messages[0].dup_);
+    CHECK(messages[2].dup_);
+    CHECK(messages[3].dup_);
+    CHECK_THAT(messages[2].payload_ + messages[3].payload_, ContainsSubstring("unacked 1"));
+    CHECK_THAT(messages[2].payload_ + messages[3].payload_, ContainsSubstring("unacked 2"));
+
+    test::run_for(io, 1500ms);
+    CHECK(errors.value() == errors_before);
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher publishes over a Unix domain socket", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    const auto path = fmt::format("/tmp/heos2mqtt-test-{}.sock", ::getpid());
+    test::fake_mqtt_unix_broker broker(io, path);
+    broker.set_record(true);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "unix://" + path, "1883", "heos");
+    connect(io, publisher, broker);
+
+    publisher.publish_raw("over uds");
+    test::run_until(io, [&]() { return broker.published() == 1; });
+    CHECK_THAT(broker.messages().front().payload_, ContainsSubstring("over uds"));
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("priority_backlog serves urgent lines first and sheds the least urgent", "[mqtt-publisher]") {
+    using heos2mqtt::publish_priority;
+    CHECK(heos2mqtt::command_priority(heos2mqtt::heos_command::event_player_now_playing_progress) ==
+          publish_priority::telemetry);
+    CHECK(heos2mqtt::command_priority(heos2mqtt::heos_command::event_player_state_changed) ==
+          publish_priority::state);
+    CHECK(heos2mqtt::command_priority(heos2mqtt::heos_command::event_player_now_playing_changed) ==
+          publish_priority::metadata);
+    CHECK(heos2mqtt::command_priority(heos2mqtt::heos_command::player_set_volume) ==
+          publish_priority::control);
+
+    heos2mqtt::detail::priority_backlog<int> backlog(4);
+    CHECK_FALSE(backlog.push(publish_priority::telemetry, 1));
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 2));
+    CHECK_FALSE(backlog.push(publish_priority::telemetry, 3));
+    CHECK_FALSE(backlog.push(publish_priority::state, 4));
+    // Full: the oldest telemetry line makes room.
+    CHECK(backlog.push(publish_priority::control, 5) == publish_priority::telemetry);
+    CHECK(backlog.size() == 4);
+    CHECK(backlog.size(publish_priority::telemetry) == 1);
+    // A line less urgent than everything queued is shed itself.
+    CHECK(backlog.push(publish_priority::state, 6) == publish_priority::telemetry);
+    CHECK(backlog.push(publish_priority::telemetry, 7) == publish_priority::telemetry);
+
+    std::vector<int> order;
+    while (auto value = backlog.pop()) {
+        order.push_back(*value);
+    }
+    CHECK(order == std::vector<int>{5, 4, 6, 2});
+    CHECK(backlog.empty());
+}
+
+TEST_CASE("priority_backlog sheds the pieces of a long line together", "[mqtt-publisher]") {
+    using heos2mqtt::publish_priority;
+
+    heos2mqtt::detail::priority_backlog<int> backlog(3);
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 1, 7, false));
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 2, 7, false));
+    CHECK_FALSE(backlog.push(publish_priority::state, 3));
+    // Both queued pieces go, and so does the rest of the line.
+    CHECK(backlog.push(publish_priority::state, 4) == publish_priority::metadata);
+    CHECK(backlog.size() == 2);
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 5, 7, true));
+    CHECK(backlog.size(publish_priority::metadata) == 0);
+    CHECK(backlog.pop() == 3);
+    CHECK(backlog.pop() == 4);
+
+    // A line already being published is passed over.
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 10, 8, false));
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 11, 8, false));
+    CHECK(backlog.pop() == 10);
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 12, 8, true));
+    CHECK_FALSE(backlog.push(publish_priority::metadata, 13));
+    CHECK(backlog.push(publish_priority::metadata, 14) == publish_priority::metadata);
+
+    std::vector<int> order;
+    while (auto value = backlog.pop()) {
+        order.push_back(*value);
+    }
+    CHECK(order == std::vector<int>{11, 12, 14});
+}
+
+TEST_CASE("priority_backlog puts undelivered lines back in front in order", "[mqtt-publisher]") {
+    using heos2mqtt::publish_priority;
+
+    heos2mqtt::detail::priority_backlog<int> backlog(10);
+    CHECK_FALSE(backlog.push(publish_priority::state, 3));
+    CHECK_FALSE(backlog.requeue_front(publish_priority::state, 1));
+    CHECK_FALSE(backlog.requeue_front(publish_priority::state, 2));
+    CHECK_FALSE(backlog.push(publish_priority::control, 0));
+
+    std::vector<int> order;
+    while (auto value = backlog.pop()) {
+        order.push_back(*value);
+    }
+    CHECK(order == std::vector<int>{0, 1, 2, 3});
+}
+
+TEST_CASE("mqtt_publisher lets state changes overtake backed up telemetry", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_record(true);
+    broker.set_ack_delay(20ms);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    publisher.set_in_flight_limit(1);
+    connect(io, publisher, broker);
+
+    for (int i = 0; i < 5; ++i) {
+        publisher.publish_raw(fmt::format("progress {}", i), {}, heos2mqtt::publish_priority::telemetry);
+    }
+    publisher.publish_raw("state", {}, heos2mqtt::publish_priority::state);
+    test::run_until(io, [&]() { return broker.published() == 6; });
+
+    // The first tick was already in flight; the state change is next.
+    const auto messages = broker.messages();
+    REQUIRE(messages.size() == 6);
+    CHECK_THAT(messages[0].payload_, ContainsSubstring("progress 0"));
+    CHECK_THAT(messages[1].payload_, ContainsSubstring(R"("raw":"state")"));
+    CHECK_THAT(messages[2].payload_, ContainsSubstring("progress 1"));
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("mqtt_publisher publishes over TLS and WebSocket transports", "[mqtt-publisher]") {
+    using heos2mqtt::mqtt_transport;
+    using front = test::mqtt_front_proxy::mode;
+    const auto [transport, mode] = GENERATE(std::pair(mqtt_transport::tls, front::tls),
+                                            std::pair(mqtt_transport::websocket, front::websocket),
+                                            std::pair(mqtt_transport::websocket_tls, front::websocket_tls));
+    CAPTURE(heos2mqtt::to_string(transport));
+
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_record(true);
+    broker.start();
+    test::mqtt_front_proxy proxy(io, mode, broker.port());
+    const auto ca_file = fmt::format("/tmp/heos2mqtt-test-ca-{}.pem", ::getpid());
+    test::write_certificate(proxy.context(), ca_file);
+
+    // The certificate is verified against the broker's IP address.
+    heos2mqtt::mqtt_transport_options options;
+    options.transport_ = transport;
+    options.ca_file_ = ca_file;
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(proxy.port()), "heos", options);
+    connect(io, publisher, broker);
+    CHECK(proxy.accepted() == 1);
+
+    publisher.publish_raw("over the transport");
+    test::run_until(io, [&]() { return broker.published() == 1; });
+    CHECK_THAT(broker.messages().front().payload_, ContainsSubstring("over the transport"));
+
+    publisher.stop();
+    proxy.stop();
+    broker.stop();
+    test::run_remaining(io);
+    std::remove(ca_file.c_str());
+}
+
+TEST_CASE("mqtt_publisher reports connection and the last acknowledgement", "[mqtt-publisher]") {
+    boost::asio::io_context io;
+    test::fake_mqtt_broker broker(io);
+    broker.set_ack_delay(200ms);
+    broker.start();
+
+    heos2mqtt::mqtt_publisher publisher(io, "127.0.0.1", std::to_string(broker.port()), "heos");
+    bool connected = false;
+    publisher.notify_when_connected([&]() { connected = true; });
+    publisher.start();
+    test::run_until(io, [&]() { return connected; });
+
+    bool idle = false;
+    for (int i = 0; i < 3; ++i) {
+        publisher.publish_raw("line");
+    }
+    publisher.notify_when_idle([&]() { idle = true; });
+    test::run_until(io, [&]() { return broker.published() == 3; });
+    CHECK_FALSE(idle);
+    test::run_until(io, [&]() { return idle; });
+
+    publisher.stop();
+    broker.stop();
+    test::run_remaining(io);
+}
@@ -0,0 +1,122 @@
+#include "mqtt_transport.hpp"
+
+#include "run_until.hpp"
+#include "tls_test_server.hpp"
+
+#include <boost/asio.hpp>
+#include <fmt/core.h>
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <optional>
+#include <string>
+
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// One connection through context, offering whatever session the cache
+// holds for "localhost".
+boost::system::error_code try_connect(boost::asio::io_context& io, boost::asio::ssl::context& context,
+                                      std::uint16_t port, const std::string& host = "localhost") {
+    std::optional<boost::system::error_code> result;
+    test::tls_connect_once(io, context, port,
+        [&host](SSL* ssl) { heos2mqtt::tls_session_cache::prepare(ssl, host); },
+        [&](boost::system::error_code ec) { result = ec; });
+    test::run_until(io, [&]() { return result.has_value(); });
+    return *result;
+}
+
+void connect_once(boost::asio::io_context& io, boost::asio::ssl::context& context, std::uint16_t port) {
+    REQUIRE_FALSE(try_connect(io, context, port));
+}
+
+}  // namespace
+
+TEST_CASE("parse_mqtt_transport accepts the transport names", "[mqtt-transport]") {
+    using heos2mqtt::mqtt_transport;
+    for (auto transport : {mqtt_transport::tcp, mqtt_transport::tls, mqtt_transport::websocket,
+                           mqtt_transport::websocket_tls}) {
+        CHECK(heos2mqtt::parse_mqtt_transport(heos2mqtt::to_string(transport)) == transport);
+    }
+    CHECK(heos2mqtt::parse_mqtt_transport("wss") == mqtt_transport::websocket_tls);
+    CHECK_FALSE(heos2mqtt::parse_mqtt_transport("mqtts").has_value());
+}
+
+TEST_CASE("tls_session_cache resumes sessions on reconnect", "[mqtt-transport]") {
+    boost::asio::io_context io;
+    test::tls_test_server server(io);
+
+    metrics::registry registry;
+    heos2mqtt::tls_session_cache cache(registry);
+    heos2mqtt::mqtt_transport_options options;
+    options.transport_ = heos2mqtt::mqtt_transport::tls;
+    options.verify_peer_ = false;
+    auto context = heos2mqtt::make_tls_context(options, cache);
+
+    connect_once(io, context, server.port());
+    CHECK(cache.size() == 1);
+    connect_once(io, context, server.port());
+    connect_once(io, context, server.port());
+
+    CHECK(server.handshakes() == 3);
+    CHECK(server.resumed() == 2);
+    CHECK(registry.add_counter("mqtt_tls_handshakes_total", "").value() == 3);
+    CHECK(registry.add_counter("mqtt_tls_resumed_total", "").value() == 2);
+
+    server.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("tls_session_cache does full handshakes when resumption is off", "[mqtt-transport]") {
+    boost::asio::io_context io;
+    test::tls_test_server server(io);
+
+    metrics::registry registry;
+    heos2mqtt::tls_session_cache cache(registry);
+    heos2mqtt::mqtt_transport_options options;
+    options.transport_ = heos2mqtt::mqtt_transport::tls;
+    options.verify_peer_ = false;
+    options.resume_sessions_ = false;
+    auto context = heos2mqtt::make_tls_context(options, cache);
+
+    connect_once(io, context, server.port());
+    connect_once(io, context, server.port());
+
+    CHECK(cache.size() == 0);
+    CHECK(server.handshakes() == 2);
+    CHECK(server.resumed() == 0);
+    CHECK(registry.add_counter("mqtt_tls_handshakes_total", "").value() == 2);
+
+    server.stop();
+    test::run_remaining(io);
+}
+
+TEST_CASE("tls_session_cache verifies IP literals against the certificate's addresses", "[mqtt-transport]") {
+    boost::asio::io_context io;
+    test::tls_test_server server(io);
+    const auto ca_file = fmt::format("/tmp/heos2mqtt-test-ca-{}.pem", ::getpid());
+    test::write_certificate(server.context(), ca_file);
+
+    metrics::registry registry;
+    heos2mqtt::tls_session_cache cache(registry);
+    heos2mqtt::mqtt_transport_options options;
+    options.transport_ = heos2mqtt::mqtt_transport::tls;
+    options.ca_file_ = ca_file;
+    auto context = heos2mqtt::make_tls_context(options, cache);
+
+    // No SNI is sent for the address, and the session is still cached
+    // under it.
+    CHECK_FALSE(try_connect(io, context, server.port(), "127.0.0.1"));
+    CHECK(cache.size() == 1);
+    CHECK_FALSE(try_connect(io, context, server.port(), "127.0.0.1"));
+    CHECK(server.resumed() == 1);
+    CHECK(try_connect(io, context, server.port(), "127.0.0.2"));
+    CHECK(try_connect(io, context, server.port(), "example.com"));
+
+    std::remove(ca_file.c_str());
+    server.stop();
+    test::run_remaining(io);
+}
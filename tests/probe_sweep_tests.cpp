@@ -0,0 +1,175 @@
+#include "probe_sweep.hpp"
+
+#include "run_until.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <optional>
+#include <string>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Accepts on one loopback address and answers the first line read with a
+// fixed reply.
+class cli_stub {
+public:
+    cli_stub(boost::asio::io_context& io, const boost::asio::ip::tcp::endpoint& endpoint, std::string reply)
+      : acceptor_(io, endpoint)
+      , reply_(std::move(reply))
+    {
+        accept_next();
+    }
+
+    [[nodiscard]] boost::asio::ip::port_type port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    struct session {
+        explicit session(boost::asio::ip::tcp::socket socket) : socket_(std::move(socket)) {}
+
+        boost::asio::ip::tcp::socket socket_;
+        boost::asio::streambuf request_;
+    };
+
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            auto peer = std::make_shared<session>(std::move(socket));
+            boost::asio::async_read_until(peer->socket_, peer->request_, '\n',
+                [this, peer](const boost::system::error_code& read_ec, std::size_t /*bytes*/) {
+                    if (read_ec) {
+                        return;
+                    }
+                    boost::asio::async_write(peer->socket_, boost::asio::buffer(reply_),
+                        [peer](const boost::system::error_code&, std::size_t) {});
+                });
+            accept_next();
+        });
+    }
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::string reply_;
+};
+
+}  // namespace
+
+TEST_CASE("parse_cidr lists the host addresses of a block", "[probe]") {
+    using heos2mqtt::detail::parse_cidr;
+    using boost::asio::ip::make_address_v4;
+
+    auto hosts = parse_cidr("192.168.1.77/24");
+    REQUIRE(hosts);
+    CHECK(hosts->size() == 254);
+    CHECK(hosts->front() == make_address_v4("192.168.1.1"));
+    CHECK(hosts->back() == make_address_v4("192.168.1.254"));
+
+    auto single = parse_cidr("10.0.0.5/32");
+    REQUIRE(single);
+    CHECK(*single == std::vector{make_address_v4("10.0.0.5")});
+    CHECK(parse_cidr("10.0.0.4/31")->size() == 2);
+
+    CHECK_FALSE(parse_cidr("10.0.0.0"));
+    CHECK_FALSE(parse_cidr("10.0.0.0/33"));
+    CHECK_FALSE(parse_cidr("10.0.0/24"));
+    CHECK_FALSE(parse_cidr("10.0.0.0/"));
+    CHECK_FALSE(parse_cidr("10.0.0.0/8"));
+}
+
+TEST_CASE("probe_sweep finds the host answering like a HEOS CLI", "[probe]") {
+    boost::asio::io_context io;
+
+    // Linux routes all of 127.0.0.0/8 to the loopback interface, so each
+    // address below is a separate host with the same port.
+    cli_stub device(io, {boost::asio::ip::make_address("127.0.0.7"), 0},
+        R"({"heos": {"command": "player/get_players", "result": "success", "message": ""}, "payload": []})"
+        "\r\n");
+    cli_stub impostor(io, {boost::asio::ip::make_address("127.0.0.3"), device.port()},
+        "HTTP/1.1 400 Bad Request\r\n\r\n");
+
+    auto hosts = heos2mqtt::detail::parse_cidr("127.0.0.0/27");
+    REQUIRE(hosts);
+    heos2mqtt::probe_sweep sweep(io, std::move(*hosts), device.port(), {.concurrency_ = 8});
+
+    std::optional<boost::asio::ip::address> found;
+    sweep.async_probe([&](const boost::system::error_code& ec, const boost::asio::ip::address& address) {
+        CHECK_FALSE(ec.failed());
+        found = address;
+    });
+    test::run_until(io, [&]() { return found.has_value(); });
+    CHECK(*found == boost::asio::ip::make_address("127.0.0.7"));
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("probe_sweep reports host_not_found when no host answers", "[probe]") {
+    boost::asio::io_context io;
+
+    cli_stub impostor(io, {boost::asio::ip::make_address("127.0.0.3"), 0}, "hello\r\n");
+
+    auto hosts = heos2mqtt::detail::parse_cidr("127.0.0.0/28");
+    REQUIRE(hosts);
+    heos2mqtt::probe_sweep sweep(io, std::move(*hosts), impostor.port());
+
+    std::optional<boost::system::error_code> result;
+    sweep.async_probe([&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+        result = ec;
+    });
+    test::run_until(io, [&]() { return result.has_value(); });
+    CHECK(*result == boost::asio::error::host_not_found);
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("probe_sweep aborts a sweep it is destroyed during", "[probe]") {
+    boost::asio::io_context io;
+
+    // Accepts through its backlog but never answers, so the attempt stays
+    // in verification.
+    boost::asio::ip::tcp::acceptor silent(io, {boost::asio::ip::make_address("127.0.0.5"), 0});
+    auto hosts = heos2mqtt::detail::parse_cidr("127.0.0.5/32");
+    REQUIRE(hosts);
+    std::optional<heos2mqtt::probe_sweep> sweep;
+    sweep.emplace(io, std::move(*hosts), silent.local_endpoint().port(),
+        heos2mqtt::probe_sweep::options{.verify_timeout_ = 5s});
+
+    std::optional<boost::system::error_code> result;
+    sweep->async_probe([&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+        result = ec;
+    });
+    test::run_for(io, 50ms);
+    CHECK_FALSE(result.has_value());
+
+    sweep.reset();
+    test::run_until(io, [&]() { return result.has_value(); });
+    CHECK(*result == boost::asio::error::operation_aborted);
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("probe_sweep rejects a host that streams without a newline", "[probe]") {
+    boost::asio::io_context io;
+
+    cli_stub chatty(io, {boost::asio::ip::make_address("127.0.0.9"), 0}, std::string(64 * 1024, 'x'));
+    auto hosts = heos2mqtt::detail::parse_cidr("127.0.0.9/32");
+    REQUIRE(hosts);
+    heos2mqtt::probe_sweep sweep(io, std::move(*hosts), chatty.port(),
+        heos2mqtt::probe_sweep::options{.verify_timeout_ = 5s});
+
+    std::optional<boost::system::error_code> result;
+    sweep.async_probe([&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+        result = ec;
+    });
+    // Well before the verify timeout: the read gives up once its buffer
+    // is full.
+    test::run_until(io, [&]() { return result.has_value(); }, 2s);
+    CHECK(*result == boost::asio::error::host_not_found);
+
+    test::run_remaining(io);
+}
@@ -8,6 +8,8 @@
 #include <catch2/matchers/catch_matchers_string.hpp>
 
 #include <chrono>
+#include <optional>
+#include <string>
 
 using namespace std::chrono_literals;
 using Catch::Matchers::ContainsSubstring;
@@ -38,3 +40,184 @@ TEST_CASE("ssdp_resolver receives multicast response", "[ssdp]") {
 
     test::run_remaining(io);
 }
+
+TEST_CASE("ssdp_resolver coalesces concurrent resolves per search target", "[ssdp]") {
+    boost::asio::io_context io;
+    test::ssdp_responder responder(io);
+    heos2mqtt::ssdp_resolver resolver(io, responder.endpoint());
+
+    const std::string heos_target = "urn:schemas-denon-com:device:ACT-Denon:1";
+    const std::string other_target = "urn:schemas-upnp-org:device:MediaRenderer:1";
+
+    int heos_resolved = 0;
+    int other_resolved = 0;
+    auto expect_success = [](int& count) {
+        return test::expect_calls(
+            1, [&count](const boost::system::error_code& ec, const boost::asio::ip::address& address) {
+                ++count;
+                CHECK_FALSE(ec.failed());
+                CHECK(address.is_v4());
+            });
+    };
+    resolver.async_resolve(heos_target, 2s, expect_success(heos_resolved));
+    resolver.async_resolve(heos_target, 2s, expect_success(heos_resolved));
+    resolver.async_resolve(other_target, 2s, expect_success(other_resolved));
+
+    // One M-SEARCH per distinct search target.
+    auto first = responder.expect_request();
+    auto second = responder.expect_request();
+    CHECK_THAT(first.payload_, ContainsSubstring(heos_target));
+    CHECK_THAT(second.payload_, ContainsSubstring(other_target));
+    CHECK(first.sender_ == second.sender_);
+
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n", first.sender_);
+    test::run_until(io, [&]() { return heos_resolved == 2; });
+    CHECK(other_resolved == 0);
+
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-upnp-org:device:MediaRenderer:1\r\n\r\n", second.sender_);
+    test::run_until(io, [&]() { return other_resolved == 1; });
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("ssdp_resolver times out each resolve at its own deadline", "[ssdp]") {
+    boost::asio::io_context io;
+    test::ssdp_responder responder(io);
+    heos2mqtt::ssdp_resolver resolver(io, responder.endpoint());
+
+    const std::string heos_target = "urn:schemas-denon-com:device:ACT-Denon:1";
+
+    bool timed_out = false;
+    bool resolved = false;
+    resolver.async_resolve(heos_target, 100ms,
+        test::expect_calls(1, [&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+            timed_out = true;
+            CHECK(ec == boost::asio::error::timed_out);
+        }));
+    resolver.async_resolve(heos_target, 5s,
+        test::expect_calls(1, [&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+            resolved = true;
+            CHECK_FALSE(ec.failed());
+        }));
+
+    auto req = responder.expect_request();
+    test::run_until(io, [&]() { return timed_out; });
+    CHECK_FALSE(resolved);
+
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n", req.sender_);
+    test::run_until(io, [&]() { return resolved; });
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("ssdp_resolver completes a cancelled resolve with operation_aborted", "[ssdp]") {
+    boost::asio::io_context io;
+    test::ssdp_responder responder(io);
+    heos2mqtt::ssdp_resolver resolver(io, responder.endpoint());
+
+    const std::string heos_target = "urn:schemas-denon-com:device:ACT-Denon:1";
+
+    boost::asio::cancellation_signal cancel;
+    bool cancelled = false;
+    bool resolved = false;
+    resolver.async_resolve(heos_target, 5s,
+        boost::asio::bind_cancellation_slot(cancel.slot(),
+            test::expect_calls(1, [&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+                cancelled = true;
+                CHECK(ec == boost::asio::error::operation_aborted);
+            })));
+    resolver.async_resolve(heos_target, 5s,
+        test::expect_calls(1, [&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+            resolved = true;
+            CHECK_FALSE(ec.failed());
+        }));
+
+    auto req = responder.expect_request();
+    cancel.emit(boost::asio::cancellation_type::terminal);
+    test::run_until(io, [&]() { return cancelled; });
+    CHECK_FALSE(resolved);
+
+    // The other resolve of the same target keeps its search.
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n", req.sender_);
+    test::run_until(io, [&]() { return resolved; });
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("ssdp_resolver searches from every interface in parallel", "[ssdp]") {
+    boost::asio::io_context io;
+    test::ssdp_responder responder(io);
+    heos2mqtt::ssdp_resolver resolver(io, responder.endpoint());
+
+    // Linux routes all of 127.0.0.0/8 to the loopback interface, which
+    // stands in for two interfaces here.
+    auto first_address = boost::asio::ip::make_address("127.0.0.1");
+    auto second_address = boost::asio::ip::make_address("127.0.0.2");
+    resolver.set_interfaces({{"lo", first_address, 1}, {"lo:1", second_address, 1}});
+
+    bool resolved = false;
+    resolver.async_resolve(
+        "urn:schemas-denon-com:device:ACT-Denon:1", 2s,
+        test::expect_calls(
+            1, [&](const boost::system::error_code& ec, const boost::asio::ip::address&) {
+                resolved = true;
+                CHECK_FALSE(ec.failed());
+            }));
+
+    auto first = responder.expect_request();
+    auto second = responder.expect_request();
+    CHECK(first.sender_.address() != second.sender_.address());
+
+    // Only the second interface hears back.
+    const auto& answered = first.sender_.address() == second_address ? first : second;
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n", answered.sender_);
+    test::run_until(io, [&]() { return resolved; });
+
+    test::run_remaining(io);
+}
+
+TEST_CASE("multicast_interfaces lists no loopback addresses", "[ssdp]") {
+    for (const auto& iface : heos2mqtt::multicast_interfaces()) {
+        CHECK_FALSE(iface.address_.is_loopback());
+        CHECK(iface.index_ != 0);
+        if (iface.address_.is_v6()) {
+            CHECK(iface.address_.to_v6().is_link_local());
+        }
+    }
+}
+
+TEST_CASE("ssdp_resolver reports USN, LOCATION and max-age", "[ssdp]") {
+    boost::asio::io_context io;
+    test::ssdp_responder responder(io);
+    heos2mqtt::ssdp_resolver resolver(io, responder.endpoint());
+
+    std::optional<heos2mqtt::ssdp_device> device;
+    resolver.async_resolve_device(
+        "urn:schemas-denon-com:device:ACT-Denon:1", 1s,
+        [&](const boost::system::error_code& ec, heos2mqtt::ssdp_device result) {
+            CHECK_FALSE(ec.failed());
+            device = std::move(result);
+        });
+
+    auto req = responder.expect_request();
+    responder.send_response(
+        "HTTP/1.1 200 OK\r\n"
+        "CACHE-CONTROL: max-age=180\r\n"
+        "LOCATION: http://127.0.0.1:60006/upnp/desc/aios_device/aios_device.xml\r\n"
+        "ST: urn:schemas-denon-com:device:ACT-Denon:1\r\n"
+        "USN: uuid:e4b1a3b0-1234::urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n",
+        req.sender_);
+    test::run_until(io, [&]() { return device.has_value(); });
+
+    CHECK(device->address_.is_v4());
+    CHECK(device->usn_ == "uuid:e4b1a3b0-1234::urn:schemas-denon-com:device:ACT-Denon:1");
+    CHECK(device->location_ == "http://127.0.0.1:60006/upnp/desc/aios_device/aios_device.xml");
+    CHECK(device->max_age_ == 180s);
+
+    test::run_remaining(io);
+}
@@ -0,0 +1,145 @@
+#include "heos_client.hpp"
+#include "heos_coro_client.hpp"
+#include "mpsc_queue.hpp"
+
+#include "mock_heos_server.hpp"
+#include "run_until.hpp"
+#include "ssdp_responder.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <fmt/core.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr std::string_view heos_ssdp_response =
+    "HTTP/1.1 200 OK\r\nST: urn:schemas-denon-com:device:ACT-Denon:1\r\n\r\n";
+
+constexpr std::string_view sample_event =
+    R"({"heos": {"command": "event/player_volume_changed", "message": "pid=-1467659498&level=23&mute=off"}})";
+
+// One simulated speaker: a mock CLI server streaming a fixed number of
+// events, plus the SSDP responder that points the client at it.
+struct simulated_device {
+    simulated_device(boost::asio::io_context& io, std::size_t lines)
+      : server_(io, 0)
+      , responder_(io)
+    {
+        // Send the whole stream in one write so the server side is not the
+        // bottleneck being measured.
+        std::string stream;
+        stream.reserve(lines * (sample_event.size() + 2));
+        for (std::size_t i = 0; i + 1 < lines; ++i) {
+            stream.append(sample_event);
+            stream.append("\r\n");
+        }
+        stream.append(sample_event);
+        server_.enqueue({{std::move(stream)}, false});
+        server_.start();
+    }
+
+    test::mock_heos_server server_;
+    test::ssdp_responder responder_;
+};
+
+struct throughput_result {
+    std::size_t lines_{0};
+    std::size_t bytes_{0};
+    double seconds_{0};
+
+    [[nodiscard]] double lines_per_second() const {
+        return static_cast<double>(lines_) / seconds_;
+    }
+    [[nodiscard]] double megabytes_per_second() const {
+        return static_cast<double>(bytes_) / seconds_ / 1e6;
+    }
+};
+
+template <typename Client>
+throughput_result measure_throughput(unsigned threads, std::size_t device_count, std::size_t lines_per_device) {
+    const std::size_t total_lines = device_count * lines_per_device;
+
+    boost::asio::io_context io(static_cast<int>(threads));
+    auto sink_strand = boost::asio::make_strand(io);
+
+    // Mirrors mqtt_publisher: every device hands lines to one consumer strand.
+    std::atomic<std::size_t> consumed{0};
+    std::atomic<std::size_t> payload_bytes{0};
+    heos2mqtt::handoff_queue<std::string, decltype(sink_strand)> sink(
+        sink_strand, [&](std::string line) {
+            payload_bytes.fetch_add(line.size(), std::memory_order_relaxed);
+            consumed.fetch_add(1, std::memory_order_relaxed);
+        });
+
+    std::vector<std::unique_ptr<simulated_device>> devices;
+    std::vector<std::unique_ptr<Client>> clients;
+    for (std::size_t i = 0; i < device_count; ++i) {
+        auto& device = devices.emplace_back(std::make_unique<simulated_device>(io, lines_per_device));
+        auto& client = clients.emplace_back(std::make_unique<Client>(
+            fmt::format("bench_{}", i), io, fmt::format("device_{}", i), device->server_.port(),
+            [&sink](std::string line, heos2mqtt::line_trace) { sink.push(std::move(line)); },
+            device->responder_.endpoint()));
+        client->start();
+        auto req = device->responder_.expect_request();
+        device->responder_.send_response(heos_ssdp_response, req.sender_);
+    }
+
+    auto work_guard = boost::asio::make_work_guard(io);
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) {
+        pool.emplace_back([&io]() { io.run(); });
+    }
+
+    const auto deadline = started + 30s;
+    while (consumed.load(std::memory_order_relaxed) < total_lines &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+
+    for (auto& client : clients) {
+        client->stop();
+    }
+    for (auto& device : devices) {
+        device->server_.stop();
+    }
+    work_guard.reset();
+    io.stop();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    REQUIRE(consumed.load() == total_lines);
+    return {total_lines, payload_bytes.load(), std::chrono::duration<double>(elapsed).count()};
+}
+
+}  // namespace
+
+TEST_CASE("heos_client throughput across io threads", "[.][benchmark]") {
+    const auto threads = GENERATE(1U, 2U, 4U);
+    constexpr std::size_t device_count = 8;
+
+    auto result = measure_throughput<heos2mqtt::heos_client>(threads, device_count, 20000);
+    fmt::print("{} thread(s), {} devices: {:.0f} lines/s ({:.1f} MB/s)\n",
+        threads, device_count, result.lines_per_second(), result.megabytes_per_second());
+}
+
+TEST_CASE("heos_client callback vs coroutine throughput", "[.][benchmark]") {
+    constexpr std::size_t lines = 100000;
+
+    auto callback = measure_throughput<heos2mqtt::heos_client>(1, 1, lines);
+    auto coroutine = measure_throughput<heos2mqtt::heos_coro_client>(1, 1, lines);
+    fmt::print("callback: {:.0f} lines/s, coroutine: {:.0f} lines/s\n",
+        callback.lines_per_second(), coroutine.lines_per_second());
+}
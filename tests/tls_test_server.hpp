@@ -0,0 +1,189 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/write.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace test {
+
+// Gives context a freshly generated self-signed RSA certificate for
+// "localhost" and 127.0.0.1, the usual Mosquitto test setup.
+inline void use_self_signed_certificate(boost::asio::ssl::context& context) {
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_RSA_gen(2048), &EVP_PKEY_free);
+    std::unique_ptr<X509, decltype(&X509_free)> certificate(X509_new(), &X509_free);
+    if (!key || !certificate) {
+        throw std::runtime_error("use_self_signed_certificate: cannot create a certificate");
+    }
+    X509_set_version(certificate.get(), 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate.get()), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate.get()), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate.get()), 24L * 60 * 60);
+    X509_set_pubkey(certificate.get(), key.get());
+    auto* name = X509_get_subject_name(certificate.get());
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    X509_set_issuer_name(certificate.get(), name);
+    X509V3_CTX extension_context;
+    X509V3_set_ctx_nodb(&extension_context);
+    X509V3_set_ctx(&extension_context, certificate.get(), certificate.get(), nullptr, nullptr, 0);
+    std::unique_ptr<X509_EXTENSION, decltype(&X509_EXTENSION_free)> alt_names(
+        X509V3_EXT_conf_nid(nullptr, &extension_context, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1"),
+        &X509_EXTENSION_free);
+    if (!alt_names || X509_add_ext(certificate.get(), alt_names.get(), -1) != 1 ||
+        X509_sign(certificate.get(), key.get(), EVP_sha256()) == 0 ||
+        SSL_CTX_use_certificate(context.native_handle(), certificate.get()) != 1 ||
+        SSL_CTX_use_PrivateKey(context.native_handle(), key.get()) != 1) {
+        throw std::runtime_error("use_self_signed_certificate: cannot use the certificate");
+    }
+}
+
+// Writes the certificate of context as PEM to path, for clients to trust.
+inline void write_certificate(boost::asio::ssl::context& context, const std::string& path) {
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(path.c_str(), "w"), &std::fclose);
+    auto* certificate = SSL_CTX_get0_certificate(context.native_handle());
+    if (!file || certificate == nullptr || PEM_write_X509(file.get(), certificate) != 1) {
+        throw std::runtime_error("write_certificate: cannot write " + path);
+    }
+}
+
+// Stand-in for a TLS broker: accepts on loopback with a certificate from
+// use_self_signed_certificate(), completes the handshake (issuing session
+// tickets, as Mosquitto does), sends one byte and then waits for the
+// client to go away. Counts handshakes and how many of them resumed a
+// session.
+class tls_test_server {
+public:
+    using tcp = boost::asio::ip::tcp;
+
+    explicit tls_test_server(boost::asio::io_context& io)
+      : context_(boost::asio::ssl::context::tls_server)
+      , acceptor_(io, {boost::asio::ip::make_address("127.0.0.1"), 0})
+    {
+        use_self_signed_certificate(context_);
+        accept_next();
+    }
+
+    [[nodiscard]] std::uint16_t port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+    [[nodiscard]] std::size_t handshakes() const {
+        return handshakes_;
+    }
+
+    boost::asio::ssl::context& context() {
+        return context_;
+    }
+
+    [[nodiscard]] std::size_t resumed() const {
+        return resumed_;
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    }
+
+private:
+    using stream = boost::asio::ssl::stream<tcp::socket>;
+
+    struct session {
+        session(tcp::socket socket, boost::asio::ssl::context& context)
+          : stream_(std::move(socket), context)
+        {}
+
+        stream stream_;
+        std::array<char, 1> buffer_{'x'};
+    };
+
+    void accept_next() {
+        acceptor_.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            // Without it, Nagle holds the reply behind the session tickets
+            // until the client's delayed ACK.
+            socket.set_option(tcp::no_delay(true));
+            auto client = std::make_shared<session>(std::move(socket), context_);
+            client->stream_.async_handshake(stream::server, [this, client](const boost::system::error_code& handshake_ec) {
+                if (handshake_ec) {
+                    return;
+                }
+                ++handshakes_;
+                if (SSL_session_reused(client->stream_.native_handle()) != 0) {
+                    ++resumed_;
+                }
+                boost::asio::async_write(client->stream_, boost::asio::buffer(client->buffer_),
+                    [client](const boost::system::error_code& write_ec, std::size_t /*bytes*/) {
+                        if (write_ec) {
+                            return;
+                        }
+                        boost::asio::async_read(client->stream_, boost::asio::buffer(client->buffer_),
+                            [client](const boost::system::error_code& /*read_ec*/, std::size_t /*bytes*/) {});
+                    });
+            });
+            accept_next();
+        });
+    }
+
+    boost::asio::ssl::context context_;
+    tcp::acceptor acceptor_;
+    std::size_t handshakes_{0};
+    std::size_t resumed_{0};
+};
+
+// Connects to port through context the way the MQTT client does: prepare
+// runs before the handshake, and the first byte from the server is read so
+// that TLS 1.3 session tickets are processed. Then drops the connection
+// without a TLS shutdown. Calls done with the outcome.
+inline void tls_connect_once(boost::asio::io_context& io,
+                             boost::asio::ssl::context& context,
+                             std::uint16_t port,
+                             const std::function<void(SSL*)>& prepare,
+                             std::function<void(boost::system::error_code)> done) {
+    using stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+    auto client = std::make_shared<stream>(io, context);
+    auto buffer = std::make_shared<std::array<char, 1>>();
+    client->next_layer().async_connect({boost::asio::ip::make_address("127.0.0.1"), port},
+        [client, buffer, prepare, done = std::move(done)](const boost::system::error_code& ec) mutable {
+            if (ec) {
+                done(ec);
+                return;
+            }
+            client->next_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+            prepare(client->native_handle());
+            client->async_handshake(stream::client,
+                [client, buffer, done = std::move(done)](const boost::system::error_code& handshake_ec) mutable {
+                    if (handshake_ec) {
+                        done(handshake_ec);
+                        return;
+                    }
+                    boost::asio::async_read(*client, boost::asio::buffer(*buffer),
+                        [client, buffer, done = std::move(done)](const boost::system::error_code& read_ec,
+                                                                 std::size_t /*bytes*/) {
+                            boost::system::error_code ignored;
+                            client->next_layer().close(ignored);
+                            done(read_ec);
+                        });
+                });
+        });
+}
+
+}  // namespace test